@@ -0,0 +1,113 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_ALLOCATION_TRACKER_H
+#define NIKMAN_ALLOCATION_TRACKER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Counts the heap allocations of the whole program, and of each thread, by replacing
+// the global operator new. Only with NIKMAN_TRACK_ALLOCATIONS (the CMake option of the
+// same name), since the counters cost a few atomic operations per allocation; without
+// it every count stays 0. The replacement must be defined once per program, which is
+// fine as long as each executable is built from a single translation unit.
+
+struct AllocationCounts {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+
+    AllocationCounts operator-(const AllocationCounts& other) const {
+        return { count - other.count, bytes - other.bytes };
+    }
+};
+
+#if defined NIKMAN_TRACK_ALLOCATIONS
+
+static constexpr bool kTrackAllocations = true;
+
+static std::atomic<uint64_t> allocation_count{ 0 };
+static std::atomic<uint64_t> allocation_bytes{ 0 };
+static thread_local AllocationCounts thread_allocations;
+
+void* TrackedAllocate(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+    thread_allocations.count++;
+    thread_allocations.bytes += size;
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size) {
+    return TrackedAllocate(size);
+}
+
+void* operator new[](size_t size) {
+    return TrackedAllocate(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    std::free(p);
+}
+
+// Of every thread, since the start
+AllocationCounts Allocations() {
+    return { allocation_count.load(std::memory_order_relaxed), allocation_bytes.load(std::memory_order_relaxed) };
+}
+
+// Of the calling thread, since it started
+AllocationCounts ThreadAllocations() {
+    return thread_allocations;
+}
+
+#else
+
+static constexpr bool kTrackAllocations = false;
+
+AllocationCounts Allocations() {
+    return {};
+}
+
+AllocationCounts ThreadAllocations() {
+    return {};
+}
+
+#endif
+
+#endif // NIKMAN_ALLOCATION_TRACKER_H
@@ -0,0 +1,176 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_ASSET_LOADER_H
+#define NIKMAN_ASSET_LOADER_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <functional>
+#include <future>
+#include <optional>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include <stb_image.h>
+
+#include "asset_pack.h"
+#include "thread_pool.h"
+#include "profiler.h"
+
+// An image as uploaded by MakeTextureGeneral: RGBA rows, from the bottom if
+// stbi_set_flip_vertically_on_load was set, as the game does. The pixels are either
+// a view of the asset pack, or decoded here and owned
+struct DecodedImage {
+
+    int width = 0;
+    int height = 0;
+    const unsigned char* pixels = nullptr;
+    unsigned char* decoded = nullptr;
+
+    DecodedImage() {}
+
+    DecodedImage(DecodedImage&& other) {
+        *this = std::move(other);
+    }
+
+    DecodedImage& operator=(DecodedImage&& other) {
+        std::swap(width, other.width);
+        std::swap(height, other.height);
+        std::swap(pixels, other.pixels);
+        std::swap(decoded, other.decoded);
+        return *this;
+    }
+
+    ~DecodedImage() {
+        stbi_image_free(decoded);
+    }
+
+    DecodedImage(const DecodedImage& other) = delete;
+    DecodedImage& operator=(const DecodedImage& other) = delete;
+
+};
+
+DecodedImage DecodeImage(const std::string& path) {
+
+    PROFILE_SCOPE("DecodeImage");
+    DecodedImage image;
+    const AssetFile asset(path);
+    if (asset.view.format == AssetFormat::Rgba8) {
+        image.width = asset.view.width;
+        image.height = asset.view.height;
+        image.pixels = asset.view.data;
+    }
+    else if (asset.Valid()) {
+        int channels;
+        image.decoded = stbi_load_from_memory(asset.view.data, static_cast<int>(asset.view.size), &image.width, &image.height, &channels, 4);
+        image.pixels = image.decoded;
+    }
+    return image;
+}
+
+
+// Reads and decodes assets on a pool of worker threads, started before the window so
+// that loading overlaps with the creation of the GL context. Jobs keep their results
+// where they are needed; only what needs GL (or SFML buffers) is left to the main
+// thread, once the loader is Done. The jobs must be added before Start.
+struct AssetLoader {
+
+    std::vector<std::function<void()>> jobs;
+    std::map<std::string, DecodedImage> images;
+    std::optional<ThreadPool> pool;
+    std::future<void> running;
+    std::atomic<int> n_done{ 0 };
+
+    void Add(std::function<void()> job) {
+        jobs.push_back(std::move(job));
+    }
+
+    // Decodes the image at path, taken later by MakeTextureGeneral
+    void AddImage(const std::string& path) {
+        DecodedImage& image = images[path];
+        Add([&image, path]() {
+            image = DecodeImage(path);
+        });
+    }
+
+    // The calling thread is free to do other work until Done, a thread for each of the other cores loads
+    void Start(int n_workers = std::max(0, static_cast<int>(std::thread::hardware_concurrency()) - 2)) {
+        pool.emplace(n_workers);
+        running = std::async(std::launch::async, [this]() {
+            profiler.SetThreadName("Loader");
+            pool->ParallelFor(static_cast<int>(jobs.size()), [this](int i) {
+                jobs[i]();
+                ++n_done;
+            });
+        });
+    }
+
+    // Fraction of the jobs done, for a loading screen
+    float Progress() const {
+        return jobs.empty() ? 1.f : static_cast<float>(n_done) / jobs.size();
+    }
+
+    bool Done() const {
+        return !running.valid() || running.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    // Waits for the jobs and stops the workers, the results can be used afterwards
+    void Wait() {
+        PROFILE_SCOPE("AssetLoader::Wait");
+        if (running.valid()) {
+            running.get();
+        }
+        pool.reset();
+        jobs.clear();
+    }
+
+    // The image decoded for path, or an empty one if it wasn't added
+    DecodedImage TakeImage(const std::string& path) {
+        DecodedImage image;
+        auto it = images.find(path);
+        if (it != images.end() && !Busy()) {
+            image = std::move(it->second);
+            images.erase(it);
+        }
+        return image;
+    }
+
+    bool Busy() const {
+        return running.valid() || pool.has_value();
+    }
+
+    AssetLoader() {}
+
+    AssetLoader(const AssetLoader& other) = delete;
+    AssetLoader(AssetLoader&& other) = delete;
+    AssetLoader& operator=(const AssetLoader& other) = delete;
+    AssetLoader& operator=(AssetLoader&& other) = delete;
+
+};
+
+static AssetLoader asset_loader;
+
+#endif // NIKMAN_ASSET_LOADER_H
@@ -0,0 +1,369 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_ASSET_PACK_H
+#define NIKMAN_ASSET_PACK_H
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <iostream>
+#include <istream>
+#include <fstream>
+#include <algorithm>
+#include <filesystem>
+#include <cstdint>
+#include <cstring>
+
+#include "mapped_file.h"
+
+// An asset pack holds the files of the game in a single file, written by NikmanPack,
+// so that starting the game opens one file instead of dozens. It is mapped in memory,
+// and the loaders get views of it: nothing is copied until GL or SFML take the data.
+//
+// The pack is made of an AssetPackHeader, the AssetPackEntry of every file sorted by
+// name, the names, and the payloads in the same order, each aligned to
+// kAssetPackAlignment. Names are paths relative to the root of the pack, with '/' as
+// separator: the directory of the pack once installed, the source tree for the one
+// written by the build. Images are stored decoded, as RGBA rows from the bottom, the way the
+// game loads them.
+static constexpr char kAssetPackMagic[4] = { 'N', 'K', 'P', 'K' };
+static constexpr uint32_t kAssetPackVersion = 1;
+static constexpr size_t kAssetPackAlignment = 64;
+static constexpr char* const kAssetPackFilename = "../nikman.nkp";   // installed
+static constexpr char* const kAssetRoot = "..";                       // as the paths of the game start
+
+// Where the build writes the pack
+#if defined NIKMAN_ASSET_PACK
+static constexpr char* const kBuildAssetPackFilename = NIKMAN_ASSET_PACK;
+#else
+static constexpr char* const kBuildAssetPackFilename = kAssetPackFilename;
+#endif
+
+enum class AssetFormat : uint32_t {
+    Raw,    // the file as it is
+    Rgba8,  // a decoded image, width * height * 4 bytes
+};
+
+struct AssetPackHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t n_entries;
+    uint32_t names_size;
+};
+static_assert(sizeof(AssetPackHeader) == 16, "AssetPackHeader must have no padding");
+
+struct AssetPackEntry {
+    uint64_t offset;        // of the payload, from the beginning of the pack
+    uint64_t size;
+    uint32_t name_offset;   // in the names
+    uint32_t name_size;
+    AssetFormat format;
+    int32_t width;          // only for images
+    int32_t height;
+    uint32_t reserved;
+};
+static_assert(sizeof(AssetPackEntry) == 40, "AssetPackEntry must have no padding");
+
+struct AssetView {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    AssetFormat format = AssetFormat::Raw;
+    int width = 0;
+    int height = 0;
+};
+
+struct AssetPack {
+
+    std::optional<MappedFile> file;
+    std::string root;   // of the names, as the paths looked up start
+    const AssetPackEntry* entries = nullptr;
+    const char* names = nullptr;
+    uint32_t n_entries = 0;
+
+    AssetPack() {}
+
+    // Without a pack the loaders read the single files, so a missing one is not an error.
+    // The names are relative to root, by default the directory of the pack
+    bool Open(const char* filename, const char* root_dir = nullptr) {
+
+        Close();
+        std::error_code ec;
+        if (!std::filesystem::exists(filename, ec)) {
+            return false;
+        }
+
+        file.emplace(filename);
+        if (!file->Valid() || !Validate()) {
+            std::cerr << "Error in AssetPack: invalid format of " << filename << ".\n";
+            Close();
+            return false;
+        }
+
+        if (root_dir != nullptr) {
+            root = root_dir;
+            return true;
+        }
+        root = filename;
+        const size_t slash = root.find_last_of("/\\");
+        root = slash == std::string::npos ? std::string(".") : root.substr(0, slash);
+        return true;
+    }
+
+    void Close() {
+        file.reset();
+        entries = nullptr;
+        names = nullptr;
+        n_entries = 0;
+    }
+
+    bool IsOpen() const {
+        return entries != nullptr;
+    }
+
+    std::string_view Name(const AssetPackEntry& entry) const {
+        return std::string_view(names + entry.name_offset, entry.name_size);
+    }
+
+    // The asset at path, a path as the game builds them (e.g. "../shaders/map.vert" for
+    // a pack in ".."), or an empty view if the pack doesn't have it
+    AssetView Find(const std::string& path) const {
+
+        AssetView view;
+        const std::string name = Relative(path);
+        if (!IsOpen() || name.empty()) {
+            return view;
+        }
+
+        const AssetPackEntry* end = entries + n_entries;
+        const AssetPackEntry* it = std::lower_bound(entries, end, name, [this](const AssetPackEntry& entry, const std::string& name) {
+            return Name(entry) < name;
+        });
+        if (it == end || Name(*it) != name) {
+            return view;
+        }
+
+        view.data = file->data + it->offset;
+        view.size = static_cast<size_t>(it->size);
+        view.format = it->format;
+        view.width = it->width;
+        view.height = it->height;
+        return view;
+    }
+
+    // Names of the files directly inside directory, sorted
+    std::vector<std::string> List(const std::string& directory) const {
+
+        std::vector<std::string> res;
+        std::string prefix = Relative(directory);
+        if (!IsOpen() || prefix.empty()) {
+            return res;
+        }
+        prefix += '/';
+
+        for (uint32_t i = 0; i < n_entries; ++i) {
+            const std::string_view name = Name(entries[i]);
+            if (name.size() > prefix.size() && name.compare(0, prefix.size(), prefix) == 0 && name.find('/', prefix.size()) == std::string_view::npos) {
+                res.emplace_back(name.substr(prefix.size()));
+            }
+        }
+        return res;
+    }
+
+    AssetPack(const AssetPack& other) = delete;
+    AssetPack(AssetPack&& other) = delete;
+    AssetPack& operator=(const AssetPack& other) = delete;
+    AssetPack& operator=(AssetPack&& other) = delete;
+
+    // path relative to root, or an empty string if it is not inside it
+    std::string Relative(const std::string& path) const {
+        std::string name = path;
+        std::replace(name.begin(), name.end(), '\\', '/');
+        if (name.size() <= root.size() + 1 || name.compare(0, root.size(), root) != 0 || name[root.size()] != '/') {
+            return std::string();
+        }
+        return name.substr(root.size() + 1);
+    }
+
+    bool Validate() {
+
+        AssetPackHeader header;
+        if (file->size < sizeof(header)) {
+            return false;
+        }
+        memcpy(&header, file->data, sizeof(header));
+        if (memcmp(header.magic, kAssetPackMagic, sizeof(header.magic)) != 0 || header.version != kAssetPackVersion) {
+            return false;
+        }
+
+        const size_t names_offset = sizeof(header) + static_cast<size_t>(header.n_entries) * sizeof(AssetPackEntry);
+        if (file->size < names_offset + header.names_size) {
+            return false;
+        }
+        const AssetPackEntry* table = reinterpret_cast<const AssetPackEntry*>(file->data + sizeof(header));
+        const char* table_names = reinterpret_cast<const char*>(file->data + names_offset);
+        std::string_view previous;
+        for (uint32_t i = 0; i < header.n_entries; ++i) {
+            const AssetPackEntry& entry = table[i];
+            if (entry.offset > file->size || entry.size > file->size - entry.offset ||
+                static_cast<uint64_t>(entry.name_offset) + entry.name_size > header.names_size) {
+                return false;
+            }
+            // Images are uploaded as width * height RGBA pixels
+            if (entry.format == AssetFormat::Rgba8 && (entry.width <= 0 || entry.height <= 0 ||
+                static_cast<uint64_t>(entry.width) * static_cast<uint64_t>(entry.height) * 4 > entry.size)) {
+                return false;
+            }
+            // Find looks the names up with a binary search
+            const std::string_view name(table_names + entry.name_offset, entry.name_size);
+            if (i > 0 && !(previous < name)) {
+                return false;
+            }
+            previous = name;
+        }
+
+        entries = table;
+        names = table_names;
+        n_entries = header.n_entries;
+        return true;
+    }
+
+};
+
+// Opened at startup by the game, if there is a pack
+static AssetPack asset_pack;
+
+// Opens the installed pack, or else the one written by the build, whose names are
+// relative to the source tree, the directory with the resources
+bool OpenAssetPack() {
+    return asset_pack.Open(kAssetPackFilename) || asset_pack.Open(kBuildAssetPackFilename, kAssetRoot);
+}
+
+// Names of the files directly inside directory, sorted: from the asset_pack if it has
+// any, otherwise from the directory itself
+std::vector<std::string> ListAssets(const std::string& directory) {
+    std::vector<std::string> names = asset_pack.List(directory);
+    if (names.empty()) {
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+            if (entry.is_regular_file(ec)) {
+                names.push_back(entry.path().filename().string());
+            }
+        }
+        std::sort(names.begin(), names.end());
+    }
+    return names;
+}
+
+
+// A whole asset in memory: a view of the asset_pack if it has it, otherwise the file
+// mapped on its own
+struct AssetFile {
+
+    AssetView view;
+    std::optional<MappedFile> file;
+
+    AssetFile(const std::string& path) {
+        view = asset_pack.Find(path);
+        if (view.data == nullptr) {
+            file.emplace(path.c_str());
+            view.data = file->data;
+            view.size = file->size;
+        }
+    }
+
+    bool Valid() const {
+        return view.data != nullptr;
+    }
+
+    AssetFile(const AssetFile& other) = delete;
+    AssetFile(AssetFile&& other) = delete;
+    AssetFile& operator=(const AssetFile& other) = delete;
+    AssetFile& operator=(AssetFile&& other) = delete;
+
+};
+
+
+// Reads an asset of the asset_pack without copying it
+struct AssetStreamBuf : std::streambuf {
+
+    AssetStreamBuf(const unsigned char* data, size_t size) {
+        char* begin = const_cast<char*>(reinterpret_cast<const char*>(data));
+        setg(begin, begin, begin + size);
+    }
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which = std::ios_base::in) override {
+        off_type pos = off;
+        if (dir == std::ios_base::cur) {
+            pos += gptr() - eback();
+        }
+        else if (dir == std::ios_base::end) {
+            pos += egptr() - eback();
+        }
+        if (!(which & std::ios_base::in) || pos < 0 || pos > egptr() - eback()) {
+            return pos_type(off_type(-1));
+        }
+        setg(eback(), eback() + pos, egptr());
+        return pos_type(pos);
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in) override {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+
+};
+
+// Input stream of an asset, from the asset_pack if it has it, otherwise from the file.
+// Use is_open as with a std::ifstream
+struct AssetStream : std::istream {
+
+    std::filebuf file_buf;
+    std::optional<AssetStreamBuf> pack_buf;
+
+    AssetStream(const std::string& path, std::ios_base::openmode mode = std::ios_base::in) : std::istream(nullptr) {
+        const AssetView view = asset_pack.Find(path);
+        if (view.data != nullptr) {
+            pack_buf.emplace(view.data, view.size);
+            rdbuf(&pack_buf.value());
+        }
+        else {
+            file_buf.open(path, mode | std::ios_base::in);
+            rdbuf(&file_buf);
+            if (!file_buf.is_open()) {
+                setstate(std::ios_base::failbit);
+            }
+        }
+    }
+
+    bool is_open() const {
+        return pack_buf.has_value() || file_buf.is_open();
+    }
+
+    AssetStream(const AssetStream& other) = delete;
+    AssetStream(AssetStream&& other) = delete;
+    AssetStream& operator=(const AssetStream& other) = delete;
+    AssetStream& operator=(AssetStream&& other) = delete;
+
+};
+
+#endif // NIKMAN_ASSET_PACK_H
@@ -0,0 +1,91 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_COMMON_H
+#define NIKMAN_COMMON_H
+
+// Utilities shared by the game and the headless simulation: nothing here may
+// depend on OpenGL or audio
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+
+#include "asset_pack.h"
+
+static constexpr char* const kLevelRoot = "../resources/levels";
+static constexpr char* const kLevelsList = "list.txt";
+
+// 64-bit FNV-1a, pass the previous result as hash to continue it over several buffers
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// root/name with a single allocation, where std::filesystem::path would make several
+std::string JoinPath(const char* root, const char* name) {
+    std::string path;
+    path.reserve(strlen(root) + 1 + strlen(name));
+    path.append(root).append(1, '/').append(name);
+    return path;
+}
+
+unsigned char DirTo2Bit(unsigned char dir) {
+    if (dir == 1) return 0;
+    else if (dir == 2) return 1;
+    else if (dir == 4) return 2;
+    else return 3;
+}
+
+std::vector<std::string> LoadLevelsList() {
+
+    std::vector<std::string> res;
+
+    AssetStream is(JoinPath(kLevelRoot, kLevelsList));
+    if (!is.is_open()) {
+        std::cerr << "LoadLevelList: can't open levels list.\n";
+        return res;
+    }
+
+    while (true) {
+        std::string s;
+        std::getline(is, s);
+        if (s.size() > 0) {
+            res.push_back(std::move(s));
+        }
+        else {
+            break;
+        }
+    }
+
+    return res;
+}
+
+#endif // NIKMAN_COMMON_H
@@ -0,0 +1,65 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_COUNTER_RNG_H
+#define NIKMAN_COUNTER_RNG_H
+
+#include <cstdint>
+
+// Counter-based random generator: the n-th number of a stream is a hash of the
+// stream key and n. Streams built from the same seed and different ids are
+// independent, so each ghost can draw its own numbers on any thread.
+// It satisfies UniformRandomBitGenerator, but the std distributions are not the same
+// on every standard library: the Simulation uses Below, so that checksums and replays
+// match across compilers.
+struct CounterRng {
+
+    using result_type = uint64_t;
+
+    uint64_t key = 0;
+    uint64_t counter = 0;
+
+    CounterRng() {}
+    CounterRng(uint64_t seed, uint64_t stream) : key(Mix(seed ^ Mix(stream + 0x9E3779B97F4A7C15ull))) {}
+
+    // SplitMix64 finalizer
+    static uint64_t Mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT64_MAX; }
+
+    result_type operator()() {
+        return Mix(key + (counter++) * 0x9E3779B97F4A7C15ull);
+    }
+
+    // Uniform in [0, n), from the top 32 bits scaled by n: the bias is at most n / 2^32
+    uint32_t Below(uint32_t n) {
+        return static_cast<uint32_t>(((*this)() >> 32) * n >> 32);
+    }
+
+};
+
+#endif // NIKMAN_COUNTER_RNG_H
@@ -25,6 +25,8 @@
 
 #include <filesystem>
 #include <vector>
+#include <map>
+#include <string>
 #include <random>
 #include <bitset>
 
@@ -34,11 +36,14 @@
 
 #include "shader.h"
 #include "level.h"
-
-struct Point {
-    float x;
-    float y;
-};
+#include "slot.h"
+#include "simulation.h"
+#include "sprite_batch.h"
+#include "render_prep.h"
+#include "profiler.h"
+#include "sprites.h"
+#include "asset_loader.h"
+#include "mixer.h"
 
 void MakeRect(float width, float height, unsigned int& VAO, unsigned int& VBO) {
 
@@ -54,7 +59,7 @@ void MakeRect(float width, float height, unsigned int& VAO, unsigned int& VBO) {
 
     // 1. bind Vertex Array Object
     glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
+    render_state.BindVertexArray(VAO);
 
     // 2. copy our vertices array in a buffer for OpenGL to use
     glGenBuffers(1, &VBO);
@@ -68,6 +73,15 @@ void MakeRect(float width, float height, unsigned int& VAO, unsigned int& VBO) {
     glEnableVertexAttribArray(1);
 }
 
+// South-West and North-East corners of a sprite in the texture atlas
+Point SouthWest(const SpriteRect& sprite) {
+    return { sprite.x0, sprite.y0 };
+}
+
+Point NorthEast(const SpriteRect& sprite) {
+    return { sprite.x1, sprite.y1 };
+}
+
 // Point a and Point b are the South-West and North-East corners in the texture atlas
 void MakeRectWithCoords(float width, float height, Point a, Point b, unsigned int& VAO, unsigned int& VBO) {
 
@@ -83,7 +97,7 @@ void MakeRectWithCoords(float width, float height, Point a, Point b, unsigned in
 
     // 1. bind Vertex Array Object
     glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
+    render_state.BindVertexArray(VAO);
 
     // 2. copy our vertices array in a buffer for OpenGL to use
     glGenBuffers(1, &VBO);
@@ -97,77 +111,142 @@ void MakeRectWithCoords(float width, float height, Point a, Point b, unsigned in
     glEnableVertexAttribArray(1);
 }
 
+struct DecodedSound {
+    std::vector<sf::Int16> samples;
+    unsigned int channels = 0;
+    unsigned int sample_rate = 0;
+};
 
-struct Slot {
-    // Default data is just a crust
-    unsigned short data = 16;    // wasd walls 0 1 2 3 crust 4 weapon 5 home 6 teleport 7 dir 8 9 10 11
-    float angle = 1.5f;
+// Sounds of kSoundsRoot decoded by PreloadSounds, by name. Cleared once the Game has them
+static std::map<std::string, DecodedSound> preloaded_sounds;
+
+bool DecodeSound(const char* name, DecodedSound& sound) {
+    PROFILE_SCOPE("DecodeSound");
+    const AssetFile asset(SoundPath(name));
+    sf::InputSoundFile file;
+    if (!asset.Valid() || !file.openFromMemory(asset.view.data, asset.view.size)) {
+        return false;
+    }
+    sound.samples.resize(static_cast<size_t>(file.getSampleCount()));
+    sound.samples.resize(static_cast<size_t>(file.read(sound.samples.data(), sound.samples.size())));
+    sound.channels = file.getChannelCount();
+    sound.sample_rate = file.getSampleRate();
+    return true;
+}
 
-    bool Crust() const {
-        return data & 16;
+// Decodes every sound of kSoundsRoot on the loader, but the music, which is streamed
+void PreloadSounds(AssetLoader& loader) {
+    for (const std::string& name : ListAssets(kSoundsRoot)) {
+        if (name != "music.wav") {
+            DecodedSound& sound = preloaded_sounds[name];
+            loader.Add([&sound, name]() {
+                DecodeSound(name.c_str(), sound);
+            });
+        }
     }
+}
 
-    bool Weapon() const {
-        return data & 32;
+// Sounds come from preloaded_sounds, or are decoded from the asset pack or the file in kSoundsRoot.
+// preloaded_sounds is only read once the loader is done with it, not while its workers write
+bool LoadSound(sf::SoundBuffer& buffer, const char* name) {
+    if (!asset_loader.Busy()) {
+        auto it = preloaded_sounds.find(name);
+        if (it != preloaded_sounds.end() && !it->second.samples.empty()) {
+            const DecodedSound& sound = it->second;
+            return buffer.loadFromSamples(sound.samples.data(), sound.samples.size(), sound.channels, sound.sample_rate);
+        }
     }
+    const AssetFile asset(SoundPath(name));
+    return asset.Valid() && buffer.loadFromMemory(asset.view.data, asset.view.size);
+}
 
-    bool Home() const {
-        return data & 64;
-    }
+// Music is streamed while it plays, so only from the asset pack, which stays mapped,
+// or from the file
+bool OpenMusic(sf::Music& music, const char* name) {
+    const std::string path = SoundPath(name);
+    const AssetView view = asset_pack.Find(path);
+    return view.data != nullptr ? music.openFromMemory(view.data, view.size) : music.openFromFile(path);
+}
 
-    bool Teleport() const {
-        return data & 128;
-    }
+// Sound buffers by name in kSoundsRoot, each loaded once and shared by all the SoundClips
+// that play it. A buffer is freed together with its last SoundClip
+struct SoundRegistry {
 
-    unsigned char Direction() const {
-        return (data & (256 + 512 + 1024 + 2048)) >> 8;
-    }
+    struct Entry {
+        sf::SoundBuffer buffer;
+        int references = 0;
+    };
 
-    void SetCrust() {
-        data |= 16;
-    }
+    std::map<std::string, Entry> buffers;
 
-    void RemoveCrust() {
-        data &= ~16;
+    // Entries of a std::map are never moved, so the buffer stays where the sf::Sounds point
+    const sf::SoundBuffer& Acquire(const char* name) {
+        auto it = buffers.find(name);
+        if (it == buffers.end()) {
+            PROFILE_SCOPE("SoundRegistry::Load");
+            it = buffers.emplace(std::piecewise_construct, std::forward_as_tuple(name), std::forward_as_tuple()).first;
+            if (!LoadSound(it->second.buffer, name)) {
+                std::cerr << "SoundRegistry::Acquire: can't open file \"" << name << "\"\n";
+            }
+        }
+        ++it->second.references;
+        return it->second.buffer;
     }
 
-    void SetWeapon() {
-        data |= 32;
+    void Release(const std::string& name) {
+        auto it = buffers.find(name);
+        if (it != buffers.end() && --it->second.references == 0) {
+            buffers.erase(it);
+        }
     }
 
-    void RemoveWeapon() {
-        data &= ~32;
-    }
+};
 
-    void SetHome() {
-        data |= 64;
-    }
+static SoundRegistry sound_registry;
 
-    void RemoveHome() {
-        data &= ~64;
-    }
+// Handle to a buffer of the sound_registry, released on destruction
+struct SoundClip {
 
-    void SetTeleport() {
-        data |= 128;
+    std::string name;
+    const sf::SoundBuffer* buffer;
+
+    SoundClip(const char* name_) : name(name_), buffer(&sound_registry.Acquire(name_)) {}
+
+    SoundClip(const SoundClip& other) = delete;
+    SoundClip& operator=(const SoundClip& other) = delete;
+    SoundClip& operator=(SoundClip&& other) = delete;
+
+    SoundClip(SoundClip&& other) : name(std::move(other.name)), buffer(other.buffer) {
+        other.buffer = nullptr;
     }
 
-    void RemoveTeleport() {
-        data &= ~128;
+    const sf::SoundBuffer& operator*() const {
+        return *buffer;
     }
 
-    // dir is a 4-bit value: w a s d
-    void SetDirection(unsigned char dir) {
-        data = (data & ~(512 + 256 + 1024 + 2048)) | (dir << 8);
+    ~SoundClip() {
+        if (buffer != nullptr) {
+            sound_registry.Release(name);
+        }
     }
 
-    Slot() {}
 };
 
+// Position between the last two ticks of the Simulation, alpha being the fraction of
+// tick elapsed since the last one. Jumps longer than a cell (teleports, ghosts going
+// back home) are not interpolated, or the sprite would slide across the maze
+Point Interpolate(float last_x, float last_y, float x, float y, float alpha) {
+    if (fabsf(x - last_x) + fabsf(y - last_y) > 1.f) {
+        return { x, y };
+    }
+    return { last_x + (x - last_x) * alpha, last_y + (y - last_y) * alpha };
+}
+
+
 struct Sfondo {
 
     unsigned int VBO;
     unsigned int VAO;
-    unsigned int texture;
     Shader shader;
     int remaining_crusts;
 
@@ -175,10 +254,7 @@ struct Sfondo {
 
     Sfondo() : shader("sfondo") {
 
-        MakeRect(2.f / 1.26f, 2.f, VAO, VBO);
-
-        int width, height;
-        texture = MakeTexture("cover.png", width, height, false, false);
+        MakeRectWithCoords(2.f / 1.26f, 2.f, SouthWest(kSpriteCover), NorthEast(kSpriteCover), VAO, VBO);
 
         glm::mat4 world(1.f);
         world = glm::translate(world, glm::vec3(-1.f + 1.f / 1.26f, 0.f, 0.f));
@@ -189,15 +265,15 @@ struct Sfondo {
 
     ~Sfondo() {
         glDeleteBuffers(1, &VBO);
-        glDeleteVertexArrays(1, &VAO);
-        glDeleteTextures(1, &texture);
+        render_state.DeleteVertexArray(VAO);
     }
 
     void Render() const {
+        PROFILE_SCOPE("Sfondo::Render");
         shader.use();
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+        render_state.BindTexture(atlas);
+        render_state.BindVertexArray(VAO);
+        render_state.DrawArrays(GL_TRIANGLES, 0, 6);
     }
 
     Sfondo(const Sfondo& other) = delete;
@@ -217,9 +293,6 @@ struct Map {
     unsigned int VAO;
     //unsigned int texture;
     Shader shader;
-    int remaining_crusts;
-
-    std::vector<Slot> grid;
 
     Map() : shader("map") {
 
@@ -234,90 +307,30 @@ struct Map {
         shader.SetMat4("world", world);
         shader.SetMat4("projection", kProjection);
 
-        shader.SetFloat("x_s", 311.f / 384.f);
-        shader.SetFloat("x_e", 383.f / 384.f);
-        shader.SetFloat("y_s", 296.f / 369.f);
-        shader.SetFloat("y_e", 368.f / 369.f);
+        shader.SetFloat("x_s", kSpriteFloor.x0);
+        shader.SetFloat("x_e", kSpriteFloor.x1);
+        shader.SetFloat("y_s", kSpriteFloor.y0);
+        shader.SetFloat("y_e", kSpriteFloor.y1);
 
     }
 
     ~Map() {
         glDeleteBuffers(1, &VBO);
-        glDeleteVertexArrays(1, &VAO);
+        render_state.DeleteVertexArray(VAO);
     }
 
     void Render() const {
+        PROFILE_SCOPE("Map::Render");
         shader.use();
-        glBindTexture(GL_TEXTURE_2D, atlas);
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-    }
-
-    void FillWalls(
-        const std::vector<std::pair<int, int>>& ver_walls,
-        const std::vector<std::pair<int, int>>& hor_walls) {
-
-        for (const auto& pos : ver_walls) {
-            if (pos.first > 0) {
-                grid[pos.first - 1 + pos.second * w].data |= (1 << 3);
-            }
-            if (pos.first < w) {
-                grid[pos.first + pos.second * w].data |= (1 << 1);
-            }
-        }
-
-        for (const auto& pos : hor_walls) {
-            if (pos.second > 0) {
-                grid[pos.first + (pos.second - 1) * w].data |= (1 << 0);
-            }
-            if (pos.second < h) {
-                grid[pos.first + pos.second * w].data |= (1 << 2);
-            }
-        }
-
+        render_state.BindTexture(atlas);
+        render_state.BindVertexArray(VAO);
+        render_state.DrawArrays(GL_TRIANGLES, 0, 6);
     }
 
-    void LoadLevel(const LevelDesc& level, std::mt19937& mt) {
+    void LoadLevel(const LevelDesc& level) {
         h = level.h;
         w = level.w;
 
-        std::uniform_real_distribution<float> dis(0.0f, 2.f * 3.14159f);
-
-        grid = std::vector<Slot>(h * w);
-
-        for (int i = 0; i < h * w; ++i) {
-            grid[i].angle = dis(mt);
-        }
-
-        for (const auto& x : level.home) {
-            grid[x.first + x.second * w].RemoveCrust();
-            grid[x.first + x.second * w].SetHome();
-        }
-        for (const auto& x : level.weapons) {
-            grid[x.first + x.second * w].RemoveCrust();
-            grid[x.first + x.second * w].SetWeapon();
-        }
-        for (const auto& x : level.mud) {
-            grid[x.first + x.second * w].RemoveCrust();
-        }
-        for (const auto& x : level.empty) {
-            grid[x.first + x.second * w].RemoveCrust();
-        }
-        for (const auto& x : level.teleports) {
-            grid[x.first + x.second * w].RemoveCrust();
-            grid[x.first + x.second * w].SetTeleport();
-        }
-        grid[level.nik_pos.first + level.nik_pos.second * w].RemoveCrust();
-        grid[level.ste_pos.first + level.ste_pos.second * w].RemoveCrust();
-
-        FillWalls(level.ver_walls, level.hor_walls);
-        remaining_crusts = h * w - 2 -
-            level.weapons.size() -
-            level.home.size() -
-            level.mud.size() -
-            level.teleports.size() -
-            level.empty.size();
-
         shader.use();
         glm::mat4 world(1.f);
         world = glm::scale(world, glm::vec3(w, h, 1.f));
@@ -341,19 +354,23 @@ struct Wall {
     unsigned int VAO;
     //unsigned int texture;
     Shader shader;
+    Uniform<glm::mat4> world_uniform;
     std::vector<std::pair<int, int>> ver_positions;
     std::vector<std::pair<int, int>> hor_positions;
     float h;
     float w;
+    mutable std::vector<glm::mat4> worlds;  // Reused by Render
 
     Wall() : shader("wall") {
 
-        MakeRectWithCoords(14.f / 72.f, 86.f / 72.f, { 265.f / 384.f, 169.f / 369.f }, { 279.f / 384.f, 255.f / 369.f }, VAO, VBO);
+        MakeRectWithCoords(14.f / 72.f, 86.f / 72.f, SouthWest(kSpriteWall), NorthEast(kSpriteWall), VAO, VBO);
         //MakeRect(14.f / 72.f, 86.f / 72.f, VAO, VBO);
 
         int width, height;
         //texture = MakeTexture("wall.png", width, height, true);
 
+        world_uniform = shader.GetUniform<glm::mat4>("world");
+
         shader.use();
         glm::mat4 world(1.f);
         world = glm::scale(world, glm::vec3(size, size, 1.f));
@@ -364,39 +381,20 @@ struct Wall {
 
     ~Wall() {
         glDeleteBuffers(1, &VBO);
-        glDeleteVertexArrays(1, &VAO);
+        render_state.DeleteVertexArray(VAO);
     }
 
     void Render() const {
+        PROFILE_SCOPE("Wall::Render");
         shader.use();
-        glBindTexture(GL_TEXTURE_2D, atlas);
-        glBindVertexArray(VAO);
+        render_state.BindTexture(atlas);
+        render_state.BindVertexArray(VAO);
 
         // TODO: use instancing
-        glm::mat4 world;
-        for (const auto& pos : ver_positions) {
-            world = glm::mat4(1.f);
-            world = glm::translate(world, glm::vec3(
-                -w / 2 + pos.first * size,
-                -h / 2 + size / 2 + pos.second * size,
-                0.f)
-            );
-            world = glm::scale(world, glm::vec3(size, size, 1.f));
-            shader.SetMat4("world", world);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
-        }
-
-        for (const auto& pos : hor_positions) {
-            world = glm::mat4(1.f);
-            world = glm::translate(world, glm::vec3(
-                -w / 2 + size / 2 + pos.first * size,
-                -h / 2 + pos.second * size,
-                0.f)
-            );
-            world = glm::scale(world, glm::vec3(size, size, 1.f));
-            world = glm::rotate(world, glm::radians(90.f), glm::vec3(0.f, 0.f, 1.f));
-            shader.SetMat4("world", world);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+        BuildWallMatrices(ver_positions, hor_positions, h, w, size, worlds);
+        for (const auto& world : worlds) {
+            shader.Set(world_uniform, world);
+            render_state.DrawArrays(GL_TRIANGLES, 0, 6);
         }
 
     }
@@ -423,50 +421,44 @@ struct Teleport {
     unsigned int VAO;
     //unsigned int texture;
     Shader shader;
+    Uniform<glm::mat4> world_uniform;
     int h;
     int w;
     std::vector<std::pair<int, int>> teleports;
 
-    std::vector<Slot>& grid;
-    std::mt19937& mt;
+    SoundClip soundClip;
 
-    sf::SoundBuffer soundBuffer;
-    sf::Sound sound;
 
+    Teleport() : shader("teleport"), soundClip("waw.wav") {
 
-    Teleport(std::vector<Slot>& grid_, std::mt19937& mt_) : shader("teleport"), grid(grid_), mt(mt_) {
-
-        MakeRectWithCoords(55.f / 72.f, 55.f / 72.f, { 255.f / 384.f, 313.f / 369.f }, { 310.f / 384.f, 368.f / 369.f }, VAO, VBO);
+        MakeRectWithCoords(55.f / 72.f, 55.f / 72.f, SouthWest(kSpriteTeleport), NorthEast(kSpriteTeleport), VAO, VBO);
 
         //int width, height;
         //texture = MakeTexture("teleport.png", width, height, false, true);
 
+        world_uniform = shader.GetUniform<glm::mat4>("world");
+
         shader.use();
         glm::mat4 world(1.f);
         world = glm::scale(world, glm::vec3(size, size, 1.f));
         shader.SetMat4("world", world);
         shader.SetMat4("projection", kProjection);
 
-        if (!soundBuffer.loadFromFile(SoundPath("waw.wav"))) {
-            std::cerr << "Teleport::Teleport: can't open file \"waw.wav\"\n";
-        }
-        sound.setBuffer(soundBuffer);
-        sound.setVolume(25.f);
-
     }
 
     ~Teleport() {
         glDeleteBuffers(1, &VBO);
-        glDeleteVertexArrays(1, &VAO);
+        render_state.DeleteVertexArray(VAO);
     }
 
 
     void Render() const {
 
+        PROFILE_SCOPE("Teleport::Render");
         shader.use();
 
-        glBindTexture(GL_TEXTURE_2D, atlas);
-        glBindVertexArray(VAO);
+        render_state.BindTexture(atlas);
+        render_state.BindVertexArray(VAO);
 
         for (const auto& x : teleports) {
             glm::mat4 world(1.f);
@@ -477,9 +469,9 @@ struct Teleport {
             ));
 
             world = glm::scale(world, glm::vec3(size, size, 1.f));
-            shader.SetMat4("world", world);
+            shader.Set(world_uniform, world);
 
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+            render_state.DrawArrays(GL_TRIANGLES, 0, 6);
         }
     }
 
@@ -487,22 +479,12 @@ struct Teleport {
 
         h = level.h;
         w = level.w;
-        teleports = std::move(level.teleports);
+        teleports = level.teleports;
 
     }
 
-    void RandomDestination(int& x, int& y) {
-        sound.play();
-        std::uniform_int_distribution dist(0, static_cast<int>(teleports.size() - 1));
-        while (true) {
-            int random_index = dist(mt);
-            const auto& pos = teleports[random_index];
-            if (pos.first != x || pos.second != y) {
-                x = pos.first;
-                y = pos.second;
-                break;
-            }
-        }
+    void PlaySound(Mixer& mixer) const {
+        mixer.Play(*soundClip, 25.f, SoundPriority::Low);
     }
 
     Teleport(const Teleport& other) = delete;
@@ -512,309 +494,75 @@ struct Teleport {
 
 };
 
+// Draws a player and plays its sounds, the state is owned by the Simulation
 struct Player {
 
-    enum class Name { Nik, Ste };
+    using Name = PlayerName;
     //static const char* const texture_array[2];
 
     const int size = 1;
 
-    unsigned int VBO;
-    unsigned int VAO;
-    //unsigned int texture;
-    Shader shader;
+    Point tex_a, tex_b;     // South-West and North-East corners in the texture atlas
+    float tex_step;         // distance between two frames in the texture atlas
     int h;
     int w;
 
-    int x, y;
-    int next_x, next_y;
-    float precise_x;
-    float precise_y;
-    float t = 0;
-    unsigned char direction;
-    bool just_hit;
-    bool just_teleported;
-    float time_after_hit;
-    static int lives;
-
-    const float speed = 4.5f;
-    const float hit_recover_time = 2.0f;
     const float blink_freq = 50.0f;
 
-    enum class State { Idle, Moving };
-    State state = State::Idle;
-
-    std::vector<Slot>& grid;
-    Teleport& teleport;
-
     Name name;
-    bool armed = false;
-    float weapon_t;
-    const float baseWeaponDuration = 8.f;
-    float weaponDuration;
-    const float weaponVanishingTime = 2.f;
-    bool weaponVanishing;
+    const PlayerState& state;
 
-    sf::SoundBuffer liscioBuffer;
-    sf::Sound liscio;
+    SoundClip liscioClip;
+    SoundClip gnamClip;
 
-    sf::SoundBuffer gnamBuffer;
-    sf::Sound gnam;
-
-    Player(Name name_, std::vector<Slot>& grid_, Teleport& teleport_) :
+    Player(Name name_, const PlayerState& state_) :
         name(name_),
-        shader("player"),
-        grid(grid_),
-        teleport(teleport_)
+        state(state_),
+        liscioClip("liscio.wav"),
+        gnamClip("gnam_ste.wav")
     {
 
-        Point a, b;
-        if (name == Name::Nik) {
-            a = { 0.f, 57.f / 368.f };
-            b = { 56.f / 384.f, 113.f / 369.f };
-        }
-        else {
-            a = { 0.f, 0.f };
-            b = { 56.f / 384.f, 56.f / 369.f };
-        }
-
-        MakeRectWithCoords(56.f / 72.f, 56.f / 72.f, a, b, VAO, VBO);
+        const SpriteRect& sprite = name == Name::Nik ? kSpriteNik : kSpriteSte;
+        tex_a = SouthWest(sprite);
+        tex_b = NorthEast(sprite);
+        tex_step = sprite.step;
 
         //int width, height;
         //texture = MakeTexture(texture_array[static_cast<int>(name)], width, height, false, true);
 
-        x = 0;
-        y = 0;
-        next_x = 0;
-        next_y = 0;
-
-        shader.use();
-        glm::mat4 world(1.f);
-        world = glm::translate(world, glm::vec3(
-            -w / 2.f + size / 2.f + size * (x * (1 - t) + next_x * t),
-            -h / 2.f + size / 2.f + size * (y * (1 - t) + next_y * t),
-            0.f)
-        );
-        world = glm::scale(world, glm::vec3(size, size, 1.f));
-        shader.SetMat4("world", world);
-        shader.SetMat4("projection", kProjection);
-
-        if (!liscioBuffer.loadFromFile(SoundPath("liscio.wav"))) {
-            std::cerr << "Player::Player: can't open file \"liscio.wav\"\n";
-        }
-        liscio.setBuffer(liscioBuffer);
-        liscio.setVolume(20);
-
-        if (name == Name::Nik) {
-            if (!gnamBuffer.loadFromFile(SoundPath("gnam_ste.wav"))) {
-                std::cerr << "Player::Player: can't open file \"gnam_ste.wav\"\n";
-            }
-        }
-        else {
-            if (!gnamBuffer.loadFromFile(SoundPath("gnam_ste.wav"))) {
-                std::cerr << "Player::Player: can't open file \"gnam_ste.wav\"\n";
-            }
-        }
-        gnam.setBuffer(gnamBuffer);
-        gnam.setVolume(1.f);
-
-    }
-
-    ~Player() {
-        glDeleteBuffers(1, &VBO);
-        glDeleteVertexArrays(1, &VAO);
     }
 
-    void FindNext(unsigned char wasd) {
-
-        unsigned char walls = grid[y * w + x].data & 15;
-
-        if ((wasd & 1) && !(walls & 1) && !grid[(y + 1) * w + x].Home()) {
-            next_x = x;
-            next_y = y + 1;
-            direction = 1;
-            state = State::Moving;
-        }
-        else if ((wasd & 2) && !(walls & 2) && !grid[y * w + (x - 1)].Home()) {
-            next_x = x - 1;
-            next_y = y;
-            direction = 2;
-            state = State::Moving;
-        }
-        else if ((wasd & 4) && !(walls & 4) && !grid[(y - 1) * w + x].Home()) {
-            next_x = x;
-            next_y = y - 1;
-            direction = 4;
-            state = State::Moving;
-        }
-        else if ((wasd & 8) && !(walls & 8) && !grid[y * w + (x + 1)].Home()) {
-            next_x = x + 1;
-            next_y = y;
-            direction = 8;
-            state = State::Moving;
-        }
-        else {
-            state = State::Idle;
-        }
+    void PlayGnam(Mixer& mixer) const {
+        mixer.Play(*gnamClip, 1.f, SoundPriority::Low);
     }
 
-    void GrabWeapon() {
-        weapon_t = 0;
-        weaponVanishing = false;
-        armed = true;
+    void PlayLiscio(Mixer& mixer) const {
+        mixer.Play(*liscioClip, 20.f, SoundPriority::Normal);
     }
 
-    void Update(float delta, unsigned int wasd, float other_x, float other_y, unsigned int& eaten, bool& weapon) {
-
-        // Update weapon
-        if (armed) {
-            weapon_t += delta;
-            if (weapon_t > weaponDuration) {
-                armed = false;
-                liscio.play();
-            }
-            else if (!weaponVanishing && (weaponDuration - weapon_t < weaponVanishingTime)) {
-                weaponVanishing = true;
-            }
-        }
-
-        if (just_hit) {
-            time_after_hit += delta;
-            if (time_after_hit > hit_recover_time) {
-                just_hit = false;
-            }
-        }
-
-        if (state == State::Moving) {
-            if (((direction >> 2) | ((direction << 2) & 15)) & wasd) {
-                direction = ((direction >> 2) | ((direction << 2) & 15));
-                std::swap(x, next_x);
-                std::swap(y, next_y);
-                t = 1.f - t;
-                grid[y * w + x].SetDirection(direction);
-            }
-
-            constexpr float otherDistMin = 0.5f;
-            if (isSte &&
-                (precise_x - other_x) * (precise_x - other_x) + (precise_y - other_y) * (precise_y - other_y) < otherDistMin &&
-                (direction == 1 && other_y > precise_y ||
-                    direction == 2 && other_x < precise_x ||
-                    direction == 4 && other_y < precise_y ||
-                    direction == 8 && other_x > precise_x)
-                ) {
-            }
-            else {
-                t += delta * speed;
-            }
-            if (t >= 1.f) {
-                x = next_x;
-                y = next_y;
-                if (grid[y * w + x].Teleport() && !just_teleported) {
-                    teleport.RandomDestination(x, y);
-                    next_x = x;
-                    next_y = y;
-                    just_teleported = true;
-                }
-                else {
-                    just_teleported = false;
-                }
-                t -= 1.f;
-                FindNext(wasd);
-                grid[y * w + x].SetDirection(direction);
-            }
-        }
-        else {
-            t = 0.f;
-            FindNext(wasd);
-            grid[y * w + x].SetDirection(direction);
-        }
+    void Draw(SpriteBatch& batch, float tick_alpha) const {
 
-        precise_x = (x * (1 - t) + next_x * t);
-        precise_y = (y * (1 - t) + next_y * t);
+        PROFILE_SCOPE("Player::Draw");
+        const float alpha = (!state.just_hit || sinf(state.time_after_hit * blink_freq) > -0.5) ? 1.f : 0.f;
 
-        // Eat crusts, pick up weapons
-        float dist_threshold = 0.2f;
-        if (t < dist_threshold) {
-            if (grid[y * w + x].Crust()) {
-                ++eaten;
-                gnam.play();
-                grid[y * w + x].RemoveCrust();
-            }
-            if (grid[y * w + x].Weapon()) {
-                weapon = true;
-                grid[y * w + x].RemoveWeapon();
-            }
-        }
-        if (t > 1 - dist_threshold) {
-            if (grid[next_y * w + next_x].Crust()) {
-                ++eaten;
-                gnam.play();
-                grid[next_y * w + next_x].RemoveCrust();
-            }
-            if (grid[next_y * w + next_x].Weapon()) {
-                weapon = true;
-                grid[next_y * w + next_x].RemoveWeapon();
-            }
+        float shiftX = 0;
+        if (state.moving) {
+            shiftX = (DirTo2Bit(state.direction) + 1) * tex_step;
         }
-    }
-
-    void Render() const {
-
-        if (!just_hit || sinf(time_after_hit * blink_freq) > -0.5) {
-            shader.use();
-
-            glm::mat4 world(1.f);
-            world = glm::translate(world, glm::vec3(
-                -w / 2.f + size / 2.f + size * precise_x,
-                -h / 2.f + size / 2.f + size * precise_y,
-                0.f)
-            );
-            world = glm::scale(world, glm::vec3(size, size, 1.f));
-            shader.SetMat4("world", world);
-
-            float shiftX = 0;
-            if (state == State::Moving) {
-                shiftX = ((DirTo2Bit(direction) + 1) * 57.f) / 384.f;
-            }
-            shader.SetFloat("shiftX", shiftX);
 
-            glBindTexture(GL_TEXTURE_2D, atlas);
-            glBindVertexArray(VAO);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
-        }
+        const Point pos = Interpolate(state.last_x, state.last_y, state.precise_x, state.precise_y, tick_alpha);
+        batch.Add(
+            -w / 2.f + size / 2.f + size * pos.x,
+            -h / 2.f + size / 2.f + size * pos.y,
+            size * 56.f / 72.f,
+            size * 56.f / 72.f,
+            tex_a, tex_b, shiftX, alpha
+        );
     }
 
-    void LoadLevel(const LevelDesc& level, int current_level) {
+    void LoadLevel(const LevelDesc& level) {
         h = level.h;
         w = level.w;
-        if (name == Name::Nik) {
-            x = level.nik_pos.first;
-            y = level.nik_pos.second;
-        }
-        else {
-            x = level.ste_pos.first;
-            y = level.ste_pos.second;
-        }
-        precise_x = x;
-        precise_y = y;
-        next_x = x;
-        next_y = y;
-        t = 0;
-        state = State::Idle;
-        just_hit = false;
-        just_teleported = false;
-        armed = false;
-        weaponDuration = baseWeaponDuration - baseWeaponDuration * current_level / 40.f;
-
-        shader.use();
-        glm::mat4 world(1.f);
-        world = glm::translate(world, glm::vec3(
-            -w / 2.f + size / 2.f + size * (x * (1 - t) + next_x * t),
-            -h / 2.f + size / 2.f + size * (y * (1 - t) + next_y * t),
-            0.f)
-        );
-        world = glm::scale(world, glm::vec3(size, size, 1.f));
-        shader.SetMat4("world", world);
     }
 
     Player(const Player& other) = delete;
@@ -832,18 +580,22 @@ struct Crust {
     unsigned int VAO;
     //unsigned int texture;
     Shader shader;
+    Uniform<glm::mat4> world_uniform;
     int h;
     int w;
+    mutable std::vector<glm::mat4> worlds;  // Reused by Render
 
-    std::vector<Slot>& grid;
+    const std::vector<Slot>& grid;
 
-    Crust(std::vector<Slot>& grid_) : shader("crust"), grid(grid_) {
+    Crust(const std::vector<Slot>& grid_) : shader("crust"), grid(grid_) {
 
-        MakeRectWithCoords(16.f / 72.f, 32.f / 72.f, { 260.f / 384.f, 278.f / 369.f }, { 276.f / 384.f, 310.f / 369.f }, VAO, VBO);
+        MakeRectWithCoords(16.f / 72.f, 32.f / 72.f, SouthWest(kSpriteCrust), NorthEast(kSpriteCrust), VAO, VBO);
 
         //int width, height;
         //texture = MakeTexture("crust.png", width, height, false, true);
 
+        world_uniform = shader.GetUniform<glm::mat4>("world");
+
         shader.use();
         glm::mat4 world(1.f);
         world = glm::scale(world, glm::vec3(size, size, 1.f));
@@ -854,41 +606,22 @@ struct Crust {
 
     ~Crust() {
         glDeleteBuffers(1, &VBO);
-        glDeleteVertexArrays(1, &VAO);
+        render_state.DeleteVertexArray(VAO);
     }
 
 
     void Render() const {
 
+        PROFILE_SCOPE("Crust::Render");
         shader.use();
 
-        glBindTexture(GL_TEXTURE_2D, atlas);
-        glBindVertexArray(VAO);
-
-        for (int x = 0; x < w; ++x) {
-            for (int y = 0; y < h; ++y) {
-
-                if (grid[y * w + x].Crust()) {
-
-                    const float angle = grid[y * w + x].angle;
+        render_state.BindTexture(atlas);
+        render_state.BindVertexArray(VAO);
 
-                    glm::mat4 world(1.f);
-                    world = glm::translate(world, glm::vec3(
-                        -w / 2.f + size / 2.f + size * x,
-                        -h / 2.f + size / 2.f + size * y,
-                        0.f
-                    ));
-
-                    world = glm::scale(world, glm::vec3(size, size, 1.f));
-                    world = glm::rotate(world, angle, glm::vec3(0.f, 0.f, 1.f));
-                    shader.SetMat4("world", world);
-
-                    glDrawArrays(GL_TRIANGLES, 0, 6);
-
-                }
-
-
-            }
+        BuildCrustMatrices(grid, h, w, static_cast<float>(size), worlds);
+        for (const auto& world : worlds) {
+            shader.Set(world_uniform, world);
+            render_state.DrawArrays(GL_TRIANGLES, 0, 6);
         }
 
     }
@@ -913,19 +646,18 @@ struct Tile {
 
     unsigned int VBO;
     unsigned int VAO;
-    unsigned int texture;
     Shader shader;
+    Uniform<glm::mat4> world_uniform;
     int h;
     int w;
 
     std::vector<std::pair<int, int>> pos;
 
-    Tile(const char* name) : shader("tile") {
+    Tile(const SpriteRect& sprite) : shader("tile") {
 
-        MakeRect(1.f, 1.f, VAO, VBO);
+        MakeRectWithCoords(1.f, 1.f, SouthWest(sprite), NorthEast(sprite), VAO, VBO);
 
-        int width, height;
-        texture = MakeTexture((std::string(name) + ".png").c_str(), width, height, false, true);
+        world_uniform = shader.GetUniform<glm::mat4>("world");
 
         shader.use();
         glm::mat4 world(1.f);
@@ -937,16 +669,17 @@ struct Tile {
 
     ~Tile() {
         glDeleteBuffers(1, &VBO);
-        glDeleteVertexArrays(1, &VAO);
+        render_state.DeleteVertexArray(VAO);
     }
 
 
     void Render() const {
 
+        PROFILE_SCOPE("Tile::Render");
         shader.use();
 
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glBindVertexArray(VAO);
+        render_state.BindTexture(atlas);
+        render_state.BindVertexArray(VAO);
 
         for (const auto& x : pos) {
             glm::mat4 world(1.f);
@@ -957,9 +690,9 @@ struct Tile {
             ));
 
             world = glm::scale(world, glm::vec3(size, size, 1.f));
-            shader.SetMat4("world", world);
+            shader.Set(world_uniform, world);
 
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+            render_state.DrawArrays(GL_TRIANGLES, 0, 6);
         }
 
     }
@@ -987,64 +720,59 @@ struct Weapon {
     unsigned int VAO;
     //unsigned int texture;
     Shader shader;
+    Uniform<glm::mat4> world_uniform;
     int h;
     int w;
     const float duration = 3.f;
     const float blink_freq = 50.0f;
-    sf::SoundBuffer soundBuffer;
-    sf::Sound sound;
+    SoundClip soundClip;
 
-    std::vector<Slot>& grid;
-    const Player& nik;
-    const Player& ste;
+    const Simulation& sim;
 
 
-    Weapon(std::vector<Slot>& grid_, const Player& nik_, const Player& ste_) :
+    Weapon(const Simulation& sim_) :
         shader("sword"),
-        grid(grid_),
-        nik(nik_),
-        ste(ste_)
+        soundClip("stab.wav"),
+        sim(sim_)
     {
 
-        MakeRectWithCoords(30.f / 72.f, 44.f / 72.f, { 279.f / 384.f, 266.f / 369.f }, { 309.f / 384.f, 310.f / 369.f }, VAO, VBO);
+        MakeRectWithCoords(30.f / 72.f, 44.f / 72.f, SouthWest(kSpriteWeapon), NorthEast(kSpriteWeapon), VAO, VBO);
 
         //int width, height;
         //texture = MakeTexture("sword.png", width, height, false, true);
 
+        world_uniform = shader.GetUniform<glm::mat4>("world");
+
         shader.use();
         glm::mat4 world(1.f);
         world = glm::scale(world, glm::vec3(size, size, 1.f));
         shader.SetMat4("world", world);
         shader.SetMat4("projection", kProjection);
 
-        if (!soundBuffer.loadFromFile(SoundPath("stab.wav"))) {
-            std::cerr << "Weapon::Weapon: can't open file \"stab.wav\"\n";
-        }
-        sound.setBuffer(soundBuffer);
-        sound.setVolume(10.f);
-
     }
 
     ~Weapon() {
         glDeleteBuffers(1, &VBO);
-        glDeleteVertexArrays(1, &VAO);
+        render_state.DeleteVertexArray(VAO);
     }
 
-    void PlaySound() {
-        sound.play();
+    void PlaySound(Mixer& mixer) const {
+        mixer.Play(*soundClip, 10.f, SoundPriority::Normal);
     }
 
+    // Weapons lying in the maze
     void Render() const {
 
+        PROFILE_SCOPE("Weapon::Render");
         shader.use();
 
-        glBindTexture(GL_TEXTURE_2D, atlas);
-        glBindVertexArray(VAO);
+        render_state.BindTexture(atlas);
+        render_state.BindVertexArray(VAO);
 
         for (int x = 0; x < w; ++x) {
             for (int y = 0; y < h; ++y) {
 
-                if (grid[y * w + x].Weapon()) {
+                if (sim.grid[y * w + x].Weapon()) {
 
                     glm::mat4 world(1.f);
                     world = glm::translate(world, glm::vec3(
@@ -1054,9 +782,9 @@ struct Weapon {
                     ));
 
                     world = glm::scale(world, glm::vec3(size, size, 1.f));
-                    shader.SetMat4("world", world);
+                    shader.Set(world_uniform, world);
 
-                    glDrawArrays(GL_TRIANGLES, 0, 6);
+                    render_state.DrawArrays(GL_TRIANGLES, 0, 6);
 
                 }
 
@@ -1064,37 +792,28 @@ struct Weapon {
             }
         }
 
-        constexpr float smallWeaponScale = 1.f;
-        if (nik.armed && (!nik.weaponVanishing || sinf(nik.weapon_t * blink_freq) > -0.2)) {
-
-            glm::mat4 world(1.f);
-            world = glm::translate(world, glm::vec3(
-                -w / 2.f + size / 2.f + size * nik.precise_x + size / 3.f,
-                -h / 2.f + size / 2.f + size * nik.precise_y - size / 8.f,
-                0.f
-            ));
-
-            world = glm::scale(world, glm::vec3(size * smallWeaponScale, size * smallWeaponScale, 1.f));
-            shader.SetMat4("world", world);
-
-            glDrawArrays(GL_TRIANGLES, 0, 6);
-
-        }
-
-        if (ste.armed && (!ste.weaponVanishing || sinf(ste.weapon_t * blink_freq) > -0.2)) {
-
-            glm::mat4 world(1.f);
-            world = glm::translate(world, glm::vec3(
-                -w / 2.f + size / 2.f + size * ste.precise_x + size / 3.f,
-                -h / 2.f + size / 2.f + size * ste.precise_y - size / 8.f,
-                0.f
-            ));
+    }
 
-            world = glm::scale(world, glm::vec3(size * smallWeaponScale, size * smallWeaponScale, 1.f));
-            shader.SetMat4("world", world);
+    // Weapons held by the players
+    void Draw(SpriteBatch& batch, float tick_alpha) const {
 
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+        PROFILE_SCOPE("Weapon::Draw");
+        constexpr float smallWeaponScale = 1.f;
+        const Point a = SouthWest(kSpriteWeapon);
+        const Point b = NorthEast(kSpriteWeapon);
 
+        for (int p = 0; p < (sim.two_players ? 2 : 1); ++p) {
+            const PlayerState& player = sim.players[p];
+            if (player.armed && (!player.weapon_vanishing || sinf(player.weapon_t * blink_freq) > -0.2)) {
+                const Point pos = Interpolate(player.last_x, player.last_y, player.precise_x, player.precise_y, tick_alpha);
+                batch.Add(
+                    -w / 2.f + size / 2.f + size * pos.x + size / 3.f,
+                    -h / 2.f + size / 2.f + size * pos.y - size / 8.f,
+                    size * smallWeaponScale * 30.f / 72.f,
+                    size * smallWeaponScale * 44.f / 72.f,
+                    a, b
+                );
+            }
         }
 
     }
@@ -1113,110 +832,44 @@ struct Weapon {
 
 };
 
+// Draws a ghost and plays its sounds, the state is owned by the Simulation
 struct Ghost {
 
-    enum class Color { Red, Yellow, Blue, Purple, Gray, Brown, Green };
-    enum class State { Chase, Scatter, Frightened, Home };
+    using Color = GhostColor;
 
     static const char* const texture_array[5];
-    static const float speed_array[5];
-    static const float y_array[5];
+    static const SpriteRect sprite_array[5];
     static const char* const sound_array[5];
     static const char* const hit_array[5];
 
     const int size = 1;
 
-    unsigned int VBO;
-    unsigned int VAO;
-    //unsigned int texture;
-    static Shader shader;
+    Point tex_a, tex_b;     // South-West and North-East corners in the texture atlas
+    float tex_step;         // distance between two frames in the texture atlas
     int h;
     int w;
 
-    int x, y;
-    int next_x, next_y;
-    float precise_x, precise_y;
-    int home_x, home_y;
-    float t = 0;
-    const float baseSpeed;
-    float speed;
-    unsigned char direction;
     Color color;
-    State state;
-    int target_x;
-    int target_y;
-    int scatter_x;
-    int scatter_y;
-    float state_t;
-    float scatter_duration = 0.f;
-    float chase_duration = 10.f;
-    float frightened_duration = 5.f;
-    float home_duration = 4.f;
-    bool just_teleported;
-
-    std::vector<Slot>& grid;
-    Teleport& teleport;
+    const GhostState& state;
 
-    std::mt19937& mt;
+    SoundClip soundClip;
+    SoundClip hitSoundClip;
 
-    const Player& nik;
-    const Player& ste;
-
-    sf::SoundBuffer soundBuffer;
-    sf::Sound sound;
-
-    sf::SoundBuffer hitSoundBuffer;
-    sf::Sound hitSound;
-
-    Ghost(Color color_, std::vector<Slot>& grid_, Teleport& teleport_, std::mt19937& mt_, const Player& nik_, const Player& ste_) :
+    Ghost(Color color_, const GhostState& state_) :
         color(color_),
-        state(State::Home),
-        baseSpeed(speed_array[static_cast<int>(color_)] * 2.f),
-        grid(grid_),
-        mt(mt_),
-        teleport(teleport_),
-        nik(nik_),
-        ste(ste_)
+        state(state_),
+        soundClip(sound_array[static_cast<int>(color_)]),
+        hitSoundClip(hit_array[static_cast<int>(color_)])
     {
 
-        Point a, b;
-        a = { 0.f, y_array[static_cast<int>(color)] / 369.f };
-        b = { 50.f / 384.f, (y_array[static_cast<int>(color)] + 50.f) / 369.f };
-
-        MakeRectWithCoords(50.f / 72.f, 50.f / 72.f, a, b, VAO, VBO);
+        const SpriteRect& sprite = sprite_array[static_cast<int>(color)];
+        tex_a = SouthWest(sprite);
+        tex_b = NorthEast(sprite);
+        tex_step = sprite.step;
 
         //int width, height;
         //texture = MakeTexture(texture_array[static_cast<int>(color)], width, height, false, true);
 
-        x = 4;
-        y = 4;
-        next_x = 3;
-        next_y = 4;
-        direction = 2;  // A
-
-        shader.use();
-        glm::mat4 world(1.f);
-        world = glm::translate(world, glm::vec3(
-            -w / 2.f + size / 2.f + size * (x * (1 - t) + next_x * t),
-            -h / 2.f + size / 2.f + size * (y * (1 - t) + next_y * t),
-            0.f)
-        );
-        world = glm::scale(world, glm::vec3(size, size, 1.f));
-        shader.SetMat4("world", world);
-        shader.SetMat4("projection", kProjection);
-
-        if (!soundBuffer.loadFromFile(SoundPath(sound_array[static_cast<int>(color)]))) {
-            std::cerr << "Ghost::Ghost: can't open file \"" << sound_array[static_cast<int>(color)] << "\"\n";
-        }
-        sound.setBuffer(soundBuffer);
-        sound.setVolume(25);
-
-        if (!hitSoundBuffer.loadFromFile(SoundPath(hit_array[static_cast<int>(color)]))) {
-            std::cerr << "Ghost::Ghost: can't open file \"" << hit_array[static_cast<int>(color)] << "\"\n";
-        }
-        hitSound.setBuffer(hitSoundBuffer);
-        hitSound.setVolume(25);
-
     }
 
     Ghost(const Ghost& other) = delete;
@@ -1225,518 +878,50 @@ struct Ghost {
 
     Ghost(Ghost&& other) :
         size(other.size),
-        VBO(other.VBO),
-        VAO(other.VAO),
-        //texture(other.texture),
+        tex_a(other.tex_a),
+        tex_b(other.tex_b),
+        tex_step(other.tex_step),
         h(other.h),
         w(other.w),
-        x(other.x),
-        y(other.y),
-        next_x(other.next_x),
-        next_y(other.next_y),
-        precise_x(other.precise_x),
-        precise_y(other.precise_y),
-        home_x(other.home_x),
-        home_y(other.home_y),
-        t(other.t),
-        speed(other.speed),
-        direction(other.direction),
         color(other.color),
         state(other.state),
-        target_x(other.target_x),
-        target_y(other.target_y),
-        scatter_x(other.scatter_x),
-        scatter_y(other.scatter_y),
-        state_t(other.state_t),
-        scatter_duration(other.scatter_duration),
-        chase_duration(other.chase_duration),
-        frightened_duration(other.frightened_duration),
-        home_duration(other.home_duration),
-        just_teleported(other.just_teleported),
-        grid(other.grid),
-        teleport(other.teleport),
-        mt(other.mt),
-        nik(other.nik),
-        ste(other.ste),
-        soundBuffer(std::move(other.soundBuffer)),
-        sound(std::move(other.sound)),
-        hitSoundBuffer(std::move(other.hitSoundBuffer)),
-        hitSound(std::move(other.sound)),
-        baseSpeed(other.baseSpeed)
-    {
-        other.VAO = -1;
-        other.VBO = -1;
-        // TODO: check this trick
-
-        sound.setBuffer(soundBuffer);
-        hitSound.setBuffer(hitSoundBuffer);
-    }
-
-    ~Ghost() {
-        glDeleteBuffers(1, &VBO);
-        glDeleteVertexArrays(1, &VAO);
-    }
-
-    void DirToNext(unsigned char direction, int& next_x_ref, int& next_y_ref) {
-        if (direction & 1) {
-            next_x_ref = x;
-            next_y_ref = y + 1;
-        }
-        else if (direction & 2) {
-            next_x_ref = x - 1;
-            next_y_ref = y;
-        }
-        else if (direction & 4) {
-            next_x_ref = x;
-            next_y_ref = y - 1;
-        }
-        else {
-            next_x_ref = x + 1;
-            next_y_ref = y;
-        }
-    }
-
-    // Update current direction based on target tile
-    void TargetTileDirection(unsigned char possible_dirs) {
-
-        float min_dist = std::numeric_limits<float>::max();
-        unsigned char min_direction = 16;
-
-        for (unsigned char i = 1; i < 16; i <<= 1) {
-            if (possible_dirs & i) {
-                int next_x, next_y;
-                DirToNext(i, next_x, next_y);
-                const float dist = (next_x - target_x) * (next_x - target_x) + (next_y - target_y) * (next_y - target_y);
-                if (dist < min_dist) {
-                    min_dist = dist;
-                    min_direction = i;
-                }
-            }
-        }
-
-        direction = min_direction;
+        soundClip(std::move(other.soundClip)),
+        hitSoundClip(std::move(other.hitSoundClip))
+    {}
 
+    // distance from the nearest player, so that the closest ghosts are heard first
+    void PlaySound(Mixer& mixer, float distance) const {
+        mixer.Play(*soundClip, 25.f, SoundPriority::High, distance);
     }
 
-    void ApproachNearest(unsigned char possible_dirs_without_back) {
-        float min_dist = std::numeric_limits<float>::max();
-        unsigned char min_direction = 16;
-
-        for (unsigned char i = 1; i < 16; i <<= 1) {
-            if (possible_dirs_without_back & i) {
-                int next_x, next_y;
-                DirToNext(i, next_x, next_y);
-                const float nik_dist = (next_x - nik.precise_x) * (next_x - nik.precise_x) + (next_y - nik.precise_y) * (next_y - nik.precise_y);
-                if (nik_dist < min_dist) {
-                    min_dist = nik_dist;
-                    min_direction = i;
-                }
-                if (isSte) {
-                    const float ste_dist = (next_x - ste.precise_x) * (next_x - ste.precise_x) + (next_y - ste.precise_y) * (next_y - ste.precise_y);
-                    if (ste_dist < min_dist) {
-                        min_dist = ste_dist;
-                        min_direction = i;
-                    }
-                }
-            }
-        }
-
-        direction = min_direction;
+    void PlayHitSound(Mixer& mixer, float distance) const {
+        mixer.Play(*hitSoundClip, 25.f, SoundPriority::Normal, distance);
     }
 
-    // Update current direction with a random one
-    void RandomDirection(unsigned char possible_dirs_without_back, unsigned char n_dirs) {
-        std::uniform_int_distribution dist(0, n_dirs - 1);
-        int random_int = dist(mt);
-
-        int i;
-        for (i = 0; i < 4; ++i) {
-            if (!(possible_dirs_without_back & (1 << i))) {
-                continue;
-            }
-            if (random_int == 0) {
-                break;
-            }
-            random_int--;
-        }
-
-        direction = (1 << i);
-    }
-
-    void SetNewDir(float player_x, float player_y, unsigned char player_dir, float red_x, float red_y) {
-
-        //if (y * w + x < 0 || y * w + x >= grid.size()) {
-        //    std::cerr << "Jemel color " << static_cast<int>(color) << " is in cell (" << y << ", " << x << ")\n";
-        //    return;
-        //}
-
-        const unsigned char walls = grid[y * w + x].data & 15;
-
-        unsigned char possible_dirs = ~walls & 15;
-
-        const unsigned char backward_dir = (direction >> 2) | ((direction << 2) & 15);
-
-        if (state == State::Home) {
-            // Remove directions outside of home
-            if (possible_dirs & 1) {
-                const int next_x = x;
-                const int next_y = y + 1;
-                if (!grid[next_y * w + next_x].Home())
-                    possible_dirs &= ~1;
-            }
-            if (possible_dirs & 2) {
-                const int next_x = x - 1;
-                const int next_y = y;
-                if (!grid[next_y * w + next_x].Home())
-                    possible_dirs &= ~2;
-            }
-            if (possible_dirs & 4) {
-                const int next_x = x;
-                const int next_y = y - 1;
-                if (!grid[next_y * w + next_x].Home())
-                    possible_dirs &= ~4;
-            }
-            if (possible_dirs & 8) {
-                const int next_x = x + 1;
-                const int next_y = y;
-                if (!grid[next_y * w + next_x].Home())
-                    possible_dirs &= ~8;
-            }
-        }
-
-        const unsigned char possible_dirs_without_back = possible_dirs & ~backward_dir;
-        if (possible_dirs_without_back == 0) {
-            direction = backward_dir;
-        }
-        else {
-            const int n_dirs = std::bitset<8>(possible_dirs_without_back).count();
-            if (n_dirs == 1) {
-                direction = possible_dirs_without_back;
-            }
-            else {
-                if (state == State::Frightened || state == State::Home) {
-                    std::uniform_int_distribution dist(0, n_dirs - 1);
-                    int random_int = dist(mt);
-
-                    int i;
-                    for (i = 0; i < 4; ++i) {
-                        if (!(possible_dirs_without_back & (1 << i))) {
-                            continue;
-                        }
-                        if (random_int == 0) {
-                            break;
-                        }
-                        random_int--;
-                    }
-
-                    direction = (1 << i);
-                }
-                else if (state == State::Scatter) {
-                    // Approach scatter tile
-                    TargetTileDirection(possible_dirs_without_back);
-                }
-                else if (state == State::Chase) {
-                    // Determine target tile and approach it
-
-                    if (color == Color::Yellow) {
-
-                        //if (y * w + x < 0 || y * w + x >= grid.size()) {
-                        //    std::cerr << "Jemel yellow is in cell (" << y << ", " << x << ")\n";
-                        //    return;
-                        //}
-
-                        unsigned char player_trace = grid[y * w + x].Direction();
-                        if (player_trace & possible_dirs_without_back) {
-                            direction = player_trace & possible_dirs_without_back;
-                        }
-                        else {
-                            RandomDirection(possible_dirs_without_back, n_dirs);
-                        }
-                        return;
-                    }
-
-                    else if (color == Color::Blue) {
-
-                        //if (y * w + x < 0 || y * w + x >= grid.size()) {
-                        //    std::cerr << "Jemel blue is in cell (" << y << ", " << x << ")\n";
-                        //    return;
-                        //}
-
-                        unsigned char player_trace = grid[y * w + x].Direction();
-                        if (player_trace & possible_dirs_without_back) {
-                            direction = player_trace & possible_dirs_without_back;
-                        }
-                        else {
-                            ApproachNearest(possible_dirs_without_back);
-                        }
-
-                        return;
-                    }
-
-                    else if (color == Color::Purple) {
-                        RandomDirection(possible_dirs_without_back, n_dirs);
-                        return;
-                    }
-
-                    else if (color == Color::Red) {
-                        ApproachNearest(possible_dirs_without_back);
-                        return;
-                    }
-
-                    else if (color == Color::Brown) {
-                        // Legacy
-                        if (player_dir & 1) {
-                            target_x = player_x;
-                            target_y = player_y + 4;
-                        }
-                        else if (player_dir & 2) {
-                            target_x = player_x - 4;
-                            target_y = player_y;
-                        }
-                        else if (player_dir & 4) {
-                            target_x = player_x;
-                            target_y = player_y - 4;
-                        }
-                        else {
-                            target_x = player_x + 4;
-                            target_y = player_y;
-                        }
-                    }
-                    else if (color == Color::Gray) {
-                        // Legacy
-                        int player_front_two_x, player_front_two_y;
-                        if (player_dir & 1) {
-                            player_front_two_x = player_x;
-                            player_front_two_y = player_y + 2;
-                        }
-                        else if (player_dir & 2) {
-                            player_front_two_x = player_x - 2;
-                            player_front_two_y = player_y;
-                        }
-                        else if (player_dir & 4) {
-                            player_front_two_x = player_x;
-                            player_front_two_y = player_y - 2;
-                        }
-                        else {
-                            player_front_two_x = player_x + 2;
-                            player_front_two_y = player_y;
-                        }
-                        // Double the vector from red to the position two tiles in front of the player
-                        target_x = 2 * player_front_two_x - red_x;
-                        target_y = 2 * player_front_two_y - red_y;
-                    }
-                    else if (color == Color::Green) {
-                        // Legacy
-                        const float dist = (precise_x - player_x) * (precise_x - player_x) + (precise_y - player_y) * (precise_y - player_y);
-                        if (dist > 6.f) { // TODO remove magic number
-                            target_x = player_x;
-                            target_y = player_y;
-                        }
-                        else {
-                            target_x = scatter_x;
-                            target_y = scatter_y;
-                        }
-                    }
-
-                    TargetTileDirection(possible_dirs_without_back);
-                }
-            }
-        }
-    }
-
-    void SetNextXY() {
-        if (direction & 1) {
-            next_x = x;
-            next_y = y + 1;
-        }
-        else if (direction & 2) {
-            next_x = x - 1;
-            next_y = y;
-        }
-        else if (direction & 4) {
-            next_x = x;
-            next_y = y - 1;
-        }
-        else {
-            next_x = x + 1;
-            next_y = y;
-        }
-    }
-
-    void Update(float delta, float red_x, float red_y, bool& hitNik, bool& hitSte) {
-
-        state_t += delta;
-        if (state == State::Chase) {
-            // Scatter mode does not exist anymore
-            //if (state_t >= chase_duration) {
-            //    state = State::Scatter;
-            //    target_x = scatter_x;
-            //    target_y = scatter_y;
-            //    state_t = 0;
-            //}
-        }
-        else if (state == State::Scatter) {
-            if (state_t >= scatter_duration) {
-                state = State::Chase;
-                state_t = 0;
-            }
-        }
-        else if (state == State::Frightened) {
-            if (state_t >= frightened_duration) {
-                state = State::Chase;
-                state_t = 0;
-            }
-        }
-        else if (state == State::Home) {
-            if (state_t >= home_duration) {
-                state = State::Chase;
-                state_t = 0;
-            }
-        }
-
-        t += delta * speed;
-        if (t >= 1.f) {
-            x = next_x;
-            y = next_y;
-            //if (y * w + x < 0 || y * w + x >= grid.size()) {
-            //    std::cerr << "Jemel color " << static_cast<int>(color) << " is in cell (" << y << ", " << x << ")\n";
-            //    return;
-            //}
-            if (grid[y * w + x].Teleport() && !just_teleported) {
-                teleport.RandomDestination(x, y);
-                next_x = x;
-                next_y = y;
-                just_teleported = true;
-            }
-            else {
-                just_teleported = false;
-            }
-            t -= 1.f;
-            SetNewDir(nik.precise_x, nik.precise_y, nik.direction, red_x, red_y);
-            SetNextXY();
-        }
-
-        precise_x = x * (1 - t) + next_x * t;
-        precise_y = y * (1 - t) + next_y * t;
-
-        // Check collision with player
-        constexpr float threshold = 0.1;
-        float squaredDistNik = (precise_x - nik.precise_x) * (precise_x - nik.precise_x) + (precise_y - nik.precise_y) * (precise_y - nik.precise_y);
-        if (squaredDistNik < threshold) {
-            hitNik = true;
-            if (!nik.armed && !nik.just_hit) {
-                sound.play();
-            }
-        }
-
-        if (isSte) {
-            float squaredDistSte = (precise_x - ste.precise_x) * (precise_x - ste.precise_x) + (precise_y - ste.precise_y) * (precise_y - ste.precise_y);
-            if (squaredDistSte < threshold) {
-                hitSte = true;
-                if (!ste.armed && !ste.just_hit) {
-                    sound.play();
-                }
-            }
-        }
-
-    }
-
-    void Killed() {
-        x = home_x;
-        y = home_y;
-        next_x = x;
-        next_y = y;
-        state = State::Home;
-        state_t = 0;
-    }
-
-    void Frighten() {
-        state = State::Frightened;
-        state_t = 0;
-        std::swap(x, next_x);
-        std::swap(y, next_y);
-        direction = ((direction >> 2) | ((direction << 2) & 15));
-        t = 1 - t;
-    }
-
-    void Render() const {
-        shader.use();
-
-        glm::mat4 world(1.f);
-        world = glm::translate(world, glm::vec3(
-            -w / 2.f + size / 2.f + size * precise_x,
-            -h / 2.f + size / 2.f + size * precise_y,
-            0.f)
+    void Draw(SpriteBatch& batch, float tick_alpha) const {
+        float shiftX = (DirTo2Bit(state.direction) + 1) * tex_step;
+        const Point pos = Interpolate(state.last_x, state.last_y, state.precise_x, state.precise_y, tick_alpha);
+        batch.Add(
+            -w / 2.f + size / 2.f + size * pos.x,
+            -h / 2.f + size / 2.f + size * pos.y,
+            size * 50.f / 72.f,
+            size * 50.f / 72.f,
+            tex_a, tex_b, shiftX
         );
-        world = glm::scale(world, glm::vec3(size, size, 1.f));
-        shader.SetMat4("world", world);
-
-        float shiftX = ((DirTo2Bit(direction) + 1) * 51.f) / 384.f;
-        shader.SetFloat("shiftX", shiftX);
-
-        glBindTexture(GL_TEXTURE_2D, atlas);
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
     }
 
-    void LoadLevel(const LevelDesc& level, int current_level) {
+    void LoadLevel(const LevelDesc& level) {
         h = level.h;
         w = level.w;
-        home_x = level.home.front().first;
-        home_y = level.home.front().second;
-        x = home_x;
-        y = home_y;
-        next_x = x;
-        next_y = y;
-        precise_x = x;
-        precise_y = y;
-        t = 0;
-        state = State::Home;
-        t = 0;
-        just_teleported = false;
-        if (color == Color::Red) {
-            scatter_x = -1;
-            scatter_y = -1;
-        }
-        else if (color == Color::Yellow) {
-            scatter_x = w;
-            scatter_y = -1;
-        }
-        else if (color == Color::Blue) {
-            scatter_x = -1;
-            scatter_y = h;
-        }
-        else if (color == Color::Purple) {
-            scatter_x = w;
-            scatter_y = h;
-        }
-        target_x = scatter_x;
-        target_y = scatter_y;
-        state_t = 0;
-        speed = baseSpeed + baseSpeed * current_level / 40.f;   // magic number
-
-        shader.use();
-        glm::mat4 world(1.f);
-        world = glm::translate(world, glm::vec3(
-            -w / 2.f + size / 2.f + size * (x * (1 - t) + next_x * t),
-            -h / 2.f + size / 2.f + size * (y * (1 - t) + next_y * t),
-            0.f)
-        );
-        world = glm::scale(world, glm::vec3(size, size, 1.f));
-        shader.SetMat4("world", world);
     }
 
 };
 
 //const char* const Ghost::texture_array[5] = { "ghost_red.png", "ghost_yellow.png" , "ghost_blue.png" , "ghost_brown.png", "ghost_purple.png" };
-const float Ghost::speed_array[5] = { 1.3f, 1.7f, 1.5f, 1.9f, 1.6f };
-const float Ghost::y_array[5] = { 216.f, 267.f, 318.f, 114.f, 165.f };
+const SpriteRect Ghost::sprite_array[5] = { kSpriteGhostRed, kSpriteGhostYellow, kSpriteGhostBlue, kSpriteGhostBrown, kSpriteGhostPurple };
 const char* const Ghost::sound_array[5] = { "numeri.wav", "bam.wav", "buffon.wav", "headshot.wav", "numeri.wav" };
 const char* const Ghost::hit_array[5] = { "barbani.wav", "berta.wav", "onesto.wav", "berta.wav", "barbani.wav" };
-Shader Ghost::shader;
 
 //const char* const Player::texture_array[2] = { "nik.png", "ste.png" };
 
-int Player::lives;
-
 #endif // NIKMAN_ENTITY_H
\ No newline at end of file
@@ -0,0 +1,118 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_FRAME_ARENA_H
+#define NIKMAN_FRAME_ARENA_H
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+// Bump allocator for data that lives for a single frame: allocating moves a pointer,
+// freeing does nothing, and Reset, at the end of the frame, releases everything at
+// once. When a frame needs more than the current block, the extra blocks come from
+// the heap, and at Reset they are replaced by a single block large enough for the
+// whole frame, so that the next frames don't allocate anymore. Used by the main
+// thread only.
+struct FrameArena {
+
+    static constexpr size_t kInitialCapacity = 64 << 10;
+
+    std::unique_ptr<unsigned char[]> block;
+    size_t capacity = 0;
+    size_t used = 0;
+    std::vector<std::unique_ptr<unsigned char[]>> overflow;    // Blocks taken during this frame
+    size_t overflow_bytes = 0;
+    size_t peak = 0;    // Largest frame so far
+
+    FrameArena(size_t capacity_ = kInitialCapacity) : block(new unsigned char[capacity_]), capacity(capacity_) {}
+
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        const size_t begin = (used + alignment - 1) & ~(alignment - 1);
+        if (begin + size <= capacity) {
+            used = begin + size;
+            return block.get() + begin;
+        }
+        // new[] only guarantees the default alignment
+        overflow.emplace_back(new unsigned char[size + alignment]);
+        overflow_bytes += size + alignment;
+        const uintptr_t p = reinterpret_cast<uintptr_t>(overflow.back().get());
+        return reinterpret_cast<void*>((p + alignment - 1) & ~(uintptr_t(alignment) - 1));
+    }
+
+    // Everything allocated since the last Reset is gone
+    void Reset() {
+        peak = std::max(peak, used + overflow_bytes);
+        if (!overflow.empty()) {
+            overflow.clear();
+            capacity = std::max(capacity * 2, peak);
+            block.reset(new unsigned char[capacity]);
+        }
+        used = 0;
+        overflow_bytes = 0;
+    }
+
+    FrameArena(const FrameArena& other) = delete;
+    FrameArena(FrameArena&& other) = delete;
+    FrameArena& operator=(const FrameArena& other) = delete;
+    FrameArena& operator=(FrameArena&& other) = delete;
+
+};
+
+static FrameArena frame_arena;
+
+// Standard allocator on frame_arena, for containers that don't outlive the frame
+template <typename T>
+struct FrameAllocator {
+
+    using value_type = T;
+
+    FrameAllocator() = default;
+
+    template <typename U>
+    FrameAllocator(const FrameAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(frame_arena.Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    // Everything is freed at once, with the frame
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(const FrameAllocator<U>&) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const FrameAllocator<U>&) const {
+        return false;
+    }
+
+};
+
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+#endif // NIKMAN_FRAME_ARENA_H
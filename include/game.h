@@ -26,22 +26,36 @@
 #include <vector>
 #include <string>
 #include <random>
+#include <algorithm>
+#include <limits>
 
 #include "entity.h"
+#include "tilemap.h"
 #include "level.h"
 #include "utility.h"
 #include "ui.h"
+#include "simulation.h"
+#include "thread_pool.h"
+#include "replay.h"
+#include "rewind.h"
+#include "profiler.h"
+#include "gpu_timer.h"
 
 enum class GameState { MainMenu, Game, End, Over, Pause, Transition };
 
+// Timed on the GPU, in the order of GpuTimer names in Game
+enum class RenderPass { TileMap, Map, Tiles, Walls, Teleports, Crusts, Weapons, Sprites, UI };
+
 
 struct Game {
 
     std::vector<std::string> level_filenames;
     int current_level = 0;
 
-    static const std::vector<Ghost::Color> ghost_colors;
+    const std::vector<Ghost::Color> ghost_colors;
 
+    ThreadPool pool;
+    Simulation sim;
     Sfondo sfondo;
     Map map;
     Tile mud;
@@ -52,7 +66,9 @@ struct Game {
     Player ste;
     Wall wall;
     Teleport teleport;
+    TileMap tilemap;
     std::vector<Ghost> ghosts;
+    SpriteBatch sprites;
     UI ui;
     GameState state;
     unsigned int prev_wasd = 0;
@@ -60,262 +76,174 @@ struct Game {
     int pause_menu_selected = 0;
     const float kTransitionDuration = 1.f;
     float transition_t;
-    int score = 0;
-
-    static constexpr int crustScore = 1;
-    static constexpr int weaponScore = 5;
-    static constexpr int killScore = 10;
-    static constexpr int lifePrice = 500;
+    static constexpr float kTickDuration = 1.f / 120.f;
+    static constexpr float kMaxFrameDuration = 0.25f;   // Longer frames slow the game down instead of piling up ticks
+    float tick_accumulator = 0.f;                       // Time not simulated yet
+    Replay replay;                                      // Being recorded, or played back
+    ReplayCursor replay_cursor;
+    bool recording = false;
+    bool playback = false;
+    static constexpr float kReplayKeyframePeriod = 5.f; // Seconds
+    static constexpr float kReplaySeekStep = 5.f;       // Seconds, with Left and Right during playback
+    SimSnapshot quick_save;                             // F5 saves, F9 restores
+    static constexpr char* const kQuickSaveFilename = "quicksave.nks";
+    static constexpr float kRewindSeconds = 60.f;
+    static constexpr uint32_t kRewindStride = 30;       // Ticks between saves, the others are simulated again
+    static constexpr size_t kRewindCapacity = 4 << 20;  // Bytes
+    static constexpr float kRewindSpeed = 2.f;          // Seconds gone back per second with Backspace held
+    RewindBuffer rewind;
+    bool rewinding = false;
+    SimSnapshot rewind_snapshot;                        // Where rewinding stopped, for the replay
+    bool tilemap_mode = true;   // Draw the maze with TileMap instead of the single entities
+    GpuTimer gpu_timer{ "TileMap", "Map", "Tiles", "Walls", "Teleports", "Crusts", "Weapons", "Sprites", "UI" };
+    bool gpu_overlay = false;                           // F11 shows the GPU times
+    bool gpu_timing = false;                            // Even without the overlay, for the timedemo
+    static constexpr int kGpuOverlayPeriod = 30;        // Frames between overlay updates
+    LevelPrefetcher prefetcher;
 
     std::random_device rd;
-    std::mt19937 mt;
-
-    sf::SoundBuffer gameOverBuffer;
-    sf::Sound gameOver;
 
-    sf::SoundBuffer endLevelBuffer;
-    sf::Sound endLevel;
-
-    sf::SoundBuffer grabWeaponBuffer;
-    sf::Sound grabWeapon;
-
-    sf::SoundBuffer winBuffer;
-    sf::Sound win;
+    SoundClip gameOverClip;
+    SoundClip endLevelClip;
+    SoundClip grabWeaponClip;
+    SoundClip winClip;
+    Mixer mixer;                // After the SoundClips, so that its voices are destroyed first
 
     sf::Music music;
 
-    Game() :
+    // With record, everything played is kept in replay, to be saved at the end
+    Game(const std::vector<Ghost::Color>& roster, bool record = false) :
+        ghost_colors(roster),
         state(GameState::MainMenu),
-        mt(rd()),
+        sim(ghost_colors, &pool),
         map(),
-        mud("mud"),
-        home("home"),
+        mud(kSpriteMud),
+        home(kSpriteHome),
         wall(),
-        crust(map.grid),
-        teleport(map.grid, mt),
-        nik(Player::Name::Nik, map.grid, teleport),
-        ste(Player::Name::Ste, map.grid, teleport),
-        weapon(map.grid, nik, ste)
+        crust(sim.grid),
+        teleport(),
+        tilemap(sim.grid),
+        nik(Player::Name::Nik, sim.players[0]),
+        ste(Player::Name::Ste, sim.players[1]),
+        weapon(sim),
+        rewind(kRewindSeconds, kTickDuration, kRewindStride, kRewindCapacity),
+        gameOverClip("arato.wav"),
+        endLevelClip("concettualmente.wav"),
+        grabWeaponClip("nooo.wav"),
+        winClip("luna.wav")
     {
         level_filenames = LoadLevelsList();
 
-        Ghost::shader = Shader("ghost");
-        for (const auto color : ghost_colors) {
-            ghosts.emplace_back(color, map.grid, teleport, mt, nik, ste);
+        for (int i = 0; i < ghost_colors.size(); ++i) {
+            ghosts.emplace_back(ghost_colors[i], sim.ghosts[i]);
         }
 
-        LoadLevel(level_filenames[current_level].c_str(), mt);
-
-        ui.panel_map.at("main_menu").first.writings[main_menu_selected].highlighted = true;
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        recording = record;
+        if (recording) {
+            replay.Start(kTickDuration, static_cast<uint32_t>(kReplayKeyframePeriod / kTickDuration), level_filenames, ghost_colors);
+        }
 
+        NewGame(false);
+        LoadLevel(level_filenames[current_level].c_str());
 
-        if (!gameOverBuffer.loadFromFile(SoundPath("arato.wav"))) {
-            std::cerr << "Game::Game: can't open file \"arato.wav\"\n";
-        }
-        gameOver.setBuffer(gameOverBuffer);
-        gameOver.setVolume(20.f);
+        ui.panel_map.at("main_menu").first.writings[main_menu_selected].highlighted = true;
 
-        if (!grabWeaponBuffer.loadFromFile(SoundPath("nooo.wav"))) {
-            std::cerr << "Game::Game: can't open file \"nooo.wav\"\n";
+        // A name and a time for each pass
+        Panel gpu(20, 1000, 320, ui.font.h_space * static_cast<int>(gpu_timer.passes.size()));
+        for (int i = 0; i < gpu_timer.passes.size(); ++i) {
+            char str[32];
+            GpuOverlayTime(gpu_timer.passes[i], str, sizeof(str));
+            gpu.AddWriting(gpu_timer.passes[i].name, 0, -ui.font.h_space * i, ui.font);
+            gpu.AddWriting(str, 160, -ui.font.h_space * i, ui.font, true);
         }
-        grabWeapon.setBuffer(grabWeaponBuffer);
+        ui.AddPanel("gpu", std::move(gpu), false);
 
-        if (!endLevelBuffer.loadFromFile(SoundPath("concettualmente.wav"))) {
-            std::cerr << "Game::Game: can't open file \"concettualmente.wav\"\n";
-        }
-        endLevel.setBuffer(endLevelBuffer);
-        endLevel.setVolume(25.f);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-        if (!winBuffer.loadFromFile(SoundPath("luna.wav"))) {
-            std::cerr << "Game::Game: can't open file \"luna.wav\"\n";
-        }
-        win.setBuffer(winBuffer);
-        win.setVolume(5.f);
+        // Both players share the buffer, and many crusts may be eaten in a row
+        mixer.SetCap(*nik.gnamClip, 2);
 
-        if (!music.openFromFile(SoundPath("music.wav"))) {
+        if (!OpenMusic(music, "music.wav")) {
             std::cerr << "Game::Game: can't open file \"music.wav\"\n";
         }
         music.setVolume(5.f);
 
     }
 
-    ~Game() {
-        Ghost::shader.Release();
-    }
-
     // wasd is a bitmapped value containing the keys pressed
-    // 0  1  2  3  4   5     6     7      8      9    
-    // W  A  S  D  Up  Left  Down  Right  Enter  Esc  
+    // 0  1  2  3  4   5     6     7      8      9    10  11  12
+    // W  A  S  D  Up  Left  Down  Right  Enter  Esc  F5  F9  Backspace
     void Update(float delta, unsigned wasd, bool& stop_game) {
 
         if (state == GameState::Game) {
 
-            int scoreDelta = 0;
-
+            PROFILE_SCOPE("Game::Update Game");
             if ((wasd & 512) && !(prev_wasd & 512)) {
                 state = GameState::Pause;
                 ui.panel_map.at("pause").second = true;
                 pause_menu_selected = 0;
+                for (auto& writing : ui.panel_map.at("pause").first.writings) {
+                    writing.highlighted = false;
+                }
                 ui.panel_map.at("pause").first.writings[pause_menu_selected].highlighted = true;
-                ui.panel_map.at("pause").first.writings[(pause_menu_selected + 1) % 2].highlighted = false;
                 prev_wasd = wasd;
                 music.pause();
                 return;
             }
 
-            unsigned int eaten = 0;
-            bool grabWeaponNik = false;
-            bool grabWeaponSte = false;
-
-            unsigned int wasdNik = wasd >> 4;
-            if (!isSte) {
-                wasdNik |= wasd;
-            }
-            nik.Update(delta, wasdNik, ste.precise_x, ste.precise_y, eaten, grabWeaponNik);
-
-            if (isSte) {
-                ste.Update(delta, wasd, nik.precise_x, nik.precise_y, eaten, grabWeaponSte);
-            }
-
-            scoreDelta += eaten * crustScore;
-            scoreDelta += (grabWeaponNik + grabWeaponSte) * weaponScore;
-
-            bool hitNik = false;
-            bool hitSte = false;
-            for (auto& ghost : ghosts) {
-                bool collisionNik = false;
-                bool collisionSte = false;
-                ghost.Update(delta, ghosts[0].precise_x, ghosts[0].precise_y, collisionNik, collisionSte);
-                if (collisionNik) {
-                    if (nik.armed) {
-                        ghost.Killed();
-                        scoreDelta += killScore;
-                        weapon.PlaySound();
-                        ghost.hitSound.play();
-                    }
-                    else {
-                        hitNik = true;
-                    }
-                }
-
-                if (isSte && collisionSte) {
-                    if (ste.armed) {
-                        ghost.Killed();
-                        scoreDelta += killScore;
-                        weapon.PlaySound();
-                        ghost.hitSound.play();
-                    }
-                    else {
-                        hitSte = true;
-                    }
+            if (!playback && (wasd & 4096)) {
+                const float seconds = std::min(delta, kMaxFrameDuration) * kRewindSpeed;
+                if (rewind.Rewind(std::max<uint64_t>(1, static_cast<uint64_t>(seconds / kTickDuration)), sim) > 0) {
+                    StateRestored();
                 }
+                rewinding = true;
+                prev_wasd = wasd;
+                return;
             }
-
-            if (hitNik && !nik.just_hit) {
-                nik.just_hit = true;
-                nik.time_after_hit = 0;
-                nik.lives--;
+            if (rewinding) {
+                // The replay goes on from where rewinding stopped
+                rewinding = false;
+                if (recording) {
+                    sim.Save(rewind_snapshot);
+                    replay.RecordRestore(rewind_snapshot);
+                }
             }
 
-            if (hitSte && !ste.just_hit) {
-                ste.just_hit = true;
-                ste.time_after_hit = 0;
-                ste.lives--;
+            if (!playback && (wasd & 1024) && !(prev_wasd & 1024)) {
+                QuickSave();
             }
-
-            if(hitNik || hitSte) {
-                char str[] = "Lives: 00";
-                snprintf(str + 7, 3, "%d", nik.lives);
-                ui.panel_map.at("game_ui").first.writings[0].Update(str);
-                //std::cerr << "Updated lives\n";
-
-                if (nik.lives <= 0) {
-                    // Game over :(
-                    music.stop();
-                    gameOver.play();
-                    state = GameState::Over;
-                    char strScore[] = "Score: 0   ";
-                    snprintf(strScore + 7, 5, "%d", score);
-                    ui.panel_map.at("game_over").first.writings[1].Update(strScore);
-
-                    ui.panel_map.at("game_over").second = true;
-                    ui.panel_map.at("game_ui").second = false;
-                }
+            else if (!playback && (wasd & 2048) && !(prev_wasd & 2048)) {
+                QuickLoad();
             }
 
-            map.remaining_crusts -= eaten;
-            if (map.remaining_crusts <= 0) { // || (wasd == 2 + 4 + 8 && prev_wasd != 2 + 4 + 8)) {
-                // Fine livello!
-                current_level++;
-                music.stop();
-                if (current_level == level_filenames.size()) {
-                    win.play();
-                    state = GameState::End;                    
-                    char strScore[] = "Score: 0   ";
-                    snprintf(strScore + 7, 5, "%d", score);
-                    ui.panel_map.at("end_game").first.writings[1].Update(strScore);
-
-                    ui.panel_map.at("end_game").second = true;
-                    ui.panel_map.at("game_ui").second = false;                    
-                }
-                else {
-                    endLevel.play();
-                    LoadLevel(level_filenames[current_level].c_str(), mt);
-                    char str[] = "Stage xx";
-                    snprintf(str + 6, 3, "%2d", current_level + 1);
-                    ui.panel_map.at("transition").first.writings[0].Update(str);
-                    state = GameState::Transition;
-                    transition_t = 0;
-                    ui.panel_map.at("transition").second = true;
-                }
+            if (playback && (wasd & 32) && !(prev_wasd & 32)) {
+                SeekPlayback(replay_cursor.tick * replay.tick_duration - kReplaySeekStep);
             }
-
-            if (grabWeaponNik) {
-                nik.GrabWeapon();
-                grabWeapon.play();
-                for (auto& ghost : ghosts) {
-                    ghost.Frighten();
-                }
+            else if (playback && (wasd & 128) && !(prev_wasd & 128)) {
+                SeekPlayback(replay_cursor.tick * replay.tick_duration + kReplaySeekStep);
             }
 
-            if (grabWeaponSte) {
-                ste.GrabWeapon();
-                grabWeapon.play();
-                for (auto& ghost : ghosts) {
-                    ghost.Frighten();
-                }
+            // The simulation advances by fixed ticks, whatever the frame rate, so that
+            // a long frame can't move anything through a wall or a ghost
+            const float tick_duration = TickDuration();
+            tick_accumulator = std::min(tick_accumulator + delta, kMaxFrameDuration);
+            while (state == GameState::Game && tick_accumulator >= tick_duration) {
+                tick_accumulator -= tick_duration;
+                Tick(wasd);
             }
+            mixer.Submit();
 
             prev_wasd = wasd;
-
-            if (scoreDelta) {
-                if ((score + scoreDelta) / lifePrice > score / lifePrice) {
-                    nik.lives++;
-                    char str[] = "Lives: 00";
-                    snprintf(str + 7, 3, "%d", nik.lives);
-                    ui.panel_map.at("game_ui").first.writings[0].Update(str);
-                }
-                score += scoreDelta;
-                char strScore[] = "Score: 0   ";
-                snprintf(strScore + 7, 5, "%d", score);
-                ui.panel_map.at("game_ui").first.writings[1].Update(strScore);
-            }
         }
         else if (state == GameState::MainMenu) {
+            PROFILE_SCOPE("Game::Update MainMenu");
             if ((wasd & 256) && !(prev_wasd & 256)) {
                 if (main_menu_selected < 2) {
                     // New game
-                    if (main_menu_selected == 0) {
-                        isSte = false;
-                    }
-                    else {
-                        isSte = true;
-                    }
-                    nik.lives = 3;
+                    playback = false;
+                    NewGame(main_menu_selected == 1);
                     current_level = 0;
-                    score = 0;
-                    LoadLevel(level_filenames[current_level].c_str(), mt);
+                    LoadLevel(level_filenames[current_level].c_str());
                     ui.panel_map.at("game_ui").second = true;
                     ui.panel_map.at("main_menu").second = false;
                     state = GameState::Transition;
@@ -326,7 +254,7 @@ struct Game {
                     transition_t = 0;
 
                     char strLives[] = "Lives: 00";
-                    snprintf(strLives + 7, 3, "%d", nik.lives);
+                    snprintf(strLives + 7, 3, "%d", sim.lives);
                     ui.panel_map.at("game_ui").first.writings[0].Update(strLives);
 
                     char strScore[] = "Score: 0   ";
@@ -353,6 +281,7 @@ struct Game {
             prev_wasd = wasd;
         }
         else if (state == GameState::End) {
+            PROFILE_SCOPE("Game::Update End");
             if ((wasd & 256) && !(prev_wasd & 256)) {
                 state = GameState::MainMenu;
                 ui.panel_map.at("main_menu").second = true;
@@ -361,6 +290,7 @@ struct Game {
             prev_wasd = wasd;
         }
         else if (state == GameState::Over) {
+            PROFILE_SCOPE("Game::Update Over");
             if ((wasd & 256) && !(prev_wasd & 256)) {
                 state = GameState::MainMenu;
                 ui.panel_map.at("main_menu").second = true;
@@ -369,6 +299,7 @@ struct Game {
             prev_wasd = wasd;
         }
         else if (state == GameState::Pause) {
+            PROFILE_SCOPE("Game::Update Pause");
             if ((wasd & 256) && !(prev_wasd & 256)) {
                 if (pause_menu_selected == 0) {
                     // Resume
@@ -380,6 +311,20 @@ struct Game {
                     return;
                 }
                 else if (pause_menu_selected == 1) {
+                    // Restart level
+                    if (playback) {
+                        SeekPlayback(0.f);
+                    }
+                    else {
+                        RestartLevel();
+                    }
+                    state = GameState::Game;
+                    ui.panel_map.at("pause").second = false;
+                    prev_wasd = wasd;
+                    music.play();
+                    return;
+                }
+                else if (pause_menu_selected == 2) {
                     // Back to menu
                     state = GameState::MainMenu;
                     ui.panel_map.at("main_menu").second = true;
@@ -400,17 +345,18 @@ struct Game {
             }
             else if ((wasd & 16) && !(prev_wasd & 16)) {
                 ui.panel_map.at("pause").first.writings[pause_menu_selected].highlighted = false;
-                pause_menu_selected = (pause_menu_selected + (2 - 1)) & 1;  // -1 e poi %2
+                pause_menu_selected = (pause_menu_selected + (3 - 1)) % 3;  // -1 e poi %3
                 ui.panel_map.at("pause").first.writings[pause_menu_selected].highlighted = true;
             }
             else if ((wasd & 64) && !(prev_wasd & 64)) {
                 ui.panel_map.at("pause").first.writings[pause_menu_selected].highlighted = false;
-                pause_menu_selected = (pause_menu_selected + 1) & 1;  // +1 e poi %2
+                pause_menu_selected = (pause_menu_selected + 1) % 3;  // +1 e poi %3
                 ui.panel_map.at("pause").first.writings[pause_menu_selected].highlighted = true;
             }
             prev_wasd = wasd;
         }
         else if (state == GameState::Transition) {
+            PROFILE_SCOPE("Game::Update Transition");
             transition_t += delta;
             if (transition_t >= kTransitionDuration) {
                 state = GameState::Game;
@@ -423,56 +369,365 @@ struct Game {
 
     }
 
+    // A single step of the simulation, with its sounds and UI updates
+    void Tick(unsigned int wasd) {
+
+        PROFILE_SCOPE("Game::Tick");
+        const int prev_lives = sim.lives;
+        const int prev_score = sim.score;
+        if (playback) {
+            if (!replay.Step(replay_cursor, sim, [this](int level) { LoadReplayLevel(level); }, [this]() { StateRestored(); })) {
+                StopPlayback();
+                return;
+            }
+        }
+        else {
+            if (recording) {
+                replay.RecordTick(wasd, sim);
+            }
+            rewind.Record(wasd, sim);
+            sim.Tick(kTickDuration, wasd);
+        }
+
+        if (tilemap_mode) {
+            for (const int cell : sim.changed_cells) {
+                tilemap.Refresh(cell % sim.w, cell / sim.w);
+            }
+        }
+
+        PROFILE_SCOPE("Game::PlayEvents");
+        for (const auto& event : sim.events) {
+            if (event.type == SimEvent::Type::CrustEaten) {
+                (event.index == 0 ? nik : ste).PlayGnam(mixer);
+            }
+            else if (event.type == SimEvent::Type::WeaponExpired) {
+                (event.index == 0 ? nik : ste).PlayLiscio(mixer);
+            }
+            else if (event.type == SimEvent::Type::WeaponGrabbed) {
+                mixer.Play(*grabWeaponClip, 100.f, SoundPriority::High);
+            }
+            else if (event.type == SimEvent::Type::Teleported) {
+                teleport.PlaySound(mixer);
+            }
+            else if (event.type == SimEvent::Type::PlayerCaught) {
+                ghosts[event.index].PlaySound(mixer, PlayerDistance(sim.ghosts[event.index]));
+            }
+            else if (event.type == SimEvent::Type::GhostKilled) {
+                weapon.PlaySound(mixer);
+                ghosts[event.index].PlayHitSound(mixer, PlayerDistance(sim.ghosts[event.index]));
+            }
+            else if (event.type == SimEvent::Type::LevelCompleted && playback) {
+                mixer.Play(*endLevelClip, 25.f, SoundPriority::Critical);
+            }
+            else if (event.type == SimEvent::Type::GameOver && playback) {
+                mixer.Play(*gameOverClip, 20.f, SoundPriority::Critical);
+            }
+        }
+
+        if (sim.lives != prev_lives) {
+            char str[] = "Lives: 00";
+            snprintf(str + 7, 3, "%d", sim.lives);
+            ui.panel_map.at("game_ui").first.writings[0].Update(str);
+        }
+
+        if (sim.score != prev_score) {
+            char strScore[] = "Score: 0   ";
+            snprintf(strScore + 7, 5, "%d", sim.score);
+            ui.panel_map.at("game_ui").first.writings[1].Update(strScore);
+        }
+
+        if (playback) {
+            // The replay goes on by itself, with the next level or a new game
+            return;
+        }
+
+        if (sim.state == Simulation::State::LevelCompleted) { // || (wasd == 2 + 4 + 8 && prev_wasd != 2 + 4 + 8)) {
+            // Fine livello!
+            current_level++;
+            music.stop();
+            if (current_level == level_filenames.size()) {
+                mixer.Play(*winClip, 5.f, SoundPriority::Critical);
+                state = GameState::End;                    
+                char strScore[] = "Score: 0   ";
+                snprintf(strScore + 7, 5, "%d", sim.score);
+                ui.panel_map.at("end_game").first.writings[1].Update(strScore);
+
+                ui.panel_map.at("end_game").second = true;
+                ui.panel_map.at("game_ui").second = false;                    
+            }
+            else {
+                mixer.Play(*endLevelClip, 25.f, SoundPriority::Critical);
+                LoadLevel(level_filenames[current_level].c_str());
+                char str[] = "Stage xx";
+                snprintf(str + 6, 3, "%2d", current_level + 1);
+                ui.panel_map.at("transition").first.writings[0].Update(str);
+                state = GameState::Transition;
+                transition_t = 0;
+                ui.panel_map.at("transition").second = true;
+            }
+        }
+        else if (sim.state == Simulation::State::GameOver) {
+            // Game over :(
+            music.stop();
+            mixer.Play(*gameOverClip, 20.f, SoundPriority::Critical);
+            state = GameState::Over;
+            char strScore[] = "Score: 0   ";
+            snprintf(strScore + 7, 5, "%d", sim.score);
+            ui.panel_map.at("game_over").first.writings[1].Update(strScore);
+
+            ui.panel_map.at("game_over").second = true;
+            ui.panel_map.at("game_ui").second = false;
+        }
+    }
+
+    float TickDuration() const {
+        return playback ? replay.tick_duration : kTickDuration;
+    }
+
+    void NewGame(bool two_players) {
+        NewGame(two_players, (static_cast<uint64_t>(rd()) << 32) | rd());
+    }
+
+    void NewGame(bool two_players, uint64_t seed) {
+        sim.NewGame(two_players, seed);
+        if (recording) {
+            replay.RecordNewGame(two_players, seed);
+        }
+    }
+
+    // Plays a replay saved with --record, from seek seconds on
+    bool StartPlayback(const char* filename, float seek) {
+
+        if (!replay.Read(filename)) {
+            return false;
+        }
+        if (replay.roster != ghost_colors) {
+            std::cerr << "Error in Game::StartPlayback: the replay has different ghosts (see --roster).\n";
+            return false;
+        }
+
+        level_filenames = replay.level_filenames;
+        recording = false;
+        playback = true;
+        replay_cursor = ReplayCursor();
+        SeekPlayback(seek);
+
+        state = GameState::Game;
+        ui.panel_map.at("main_menu").second = false;
+        ui.panel_map.at("game_ui").second = true;
+        music.play();
+        return true;
+    }
+
+    void StopPlayback() {
+        playback = false;
+        music.stop();
+        state = GameState::MainMenu;
+        ui.panel_map.at("main_menu").second = true;
+        ui.panel_map.at("game_ui").second = false;
+    }
+
+    void SeekPlayback(float seconds) {
+
+        const uint64_t tick = std::min(static_cast<uint64_t>(std::max(0.f, seconds) / replay.tick_duration), replay.ticks);
+        replay.Seek(replay_cursor, tick, sim, [this](int level) { LoadReplayLevel(level); }, []() {});
+        StateRestored();
+    }
+
+    // Back to the start of the current level, as it was when first entered
+    void RestartLevel() {
+        sim.RestartLevel();
+        if (recording) {
+            replay.RecordRestore(sim.level_start);
+        }
+        rewind.Reset(sim);
+        StateRestored();
+    }
+
+    void QuickSave() {
+        sim.Save(quick_save);
+        quick_save.Write(kQuickSaveFilename);
+    }
+
+    // Restores the last quick save, from this session or else from file
+    void QuickLoad() {
+        if (quick_save.Empty() && !quick_save.Read(kQuickSaveFilename)) {
+            return;
+        }
+        const int level = quick_save.Level();
+        if (level < 0 || level >= level_filenames.size()) {
+            std::cerr << "Error in Game::QuickLoad: invalid level.\n";
+            return;
+        }
+        if (level != current_level) {
+            current_level = level;
+            LoadLevel(level_filenames[current_level].c_str());
+        }
+        if (!sim.Restore(quick_save)) {
+            return;
+        }
+        if (recording) {
+            replay.RecordRestore(quick_save);
+        }
+        rewind.Reset(sim);
+        StateRestored();
+    }
+
+    // Cells between the ghost and the nearest player
+    float PlayerDistance(const GhostState& ghost) const {
+        float distance = std::numeric_limits<float>::max();
+        for (int p = 0; p < (sim.two_players ? 2 : 1); ++p) {
+            distance = std::min(distance, hypotf(ghost.precise_x - sim.players[p].precise_x, ghost.precise_y - sim.players[p].precise_y));
+        }
+        return distance;
+    }
+
+    // After the simulation state has been replaced as a whole
+    void StateRestored() {
+        tilemap.Upload();
+        tick_accumulator = 0.f;
+
+        char str[] = "Lives: 00";
+        snprintf(str + 7, 3, "%d", sim.lives);
+        ui.panel_map.at("game_ui").first.writings[0].Update(str);
+        char strScore[] = "Score: 0   ";
+        snprintf(strScore + 7, 5, "%d", sim.score);
+        ui.panel_map.at("game_ui").first.writings[1].Update(strScore);
+    }
+
+    void LoadReplayLevel(int level) {
+        current_level = level;
+        LoadLevel(level_filenames[current_level].c_str());
+    }
+
     void Render() {
 
+        PROFILE_SCOPE("Game::Render");
+        gpu_timer.enabled = gpu_overlay || gpu_timing || profiler.Enabled();
+        gpu_timer.BeginFrame();
         if (state == GameState::Game || state == GameState::Pause || state == GameState::Transition) {
-            map.Render();
-            mud.Render();
-            home.Render();
-            wall.Render();
-            teleport.Render();
-            crust.Render();
-            nik.Render();
-            if (isSte) ste.Render();
-            weapon.Render();
-            for (const auto& ghost : ghosts) {
-                ghost.Render();
+            if (tilemap_mode) {
+                auto zone = TimePass(RenderPass::TileMap);
+                tilemap.Render();
+            }
+            else {
+                {
+                    auto zone = TimePass(RenderPass::Map);
+                    map.Render();
+                }
+                {
+                    auto zone = TimePass(RenderPass::Tiles);
+                    mud.Render();
+                    home.Render();
+                }
+                {
+                    auto zone = TimePass(RenderPass::Walls);
+                    wall.Render();
+                }
+                {
+                    auto zone = TimePass(RenderPass::Teleports);
+                    teleport.Render();
+                }
+                {
+                    auto zone = TimePass(RenderPass::Crusts);
+                    crust.Render();
+                }
+            }
+            if (!tilemap_mode) {
+                auto zone = TimePass(RenderPass::Weapons);
+                weapon.Render();
             }
+            const float tick_alpha = tick_accumulator / TickDuration();
+            nik.Draw(sprites, tick_alpha);
+            if (sim.two_players) ste.Draw(sprites, tick_alpha);
+            weapon.Draw(sprites, tick_alpha);
+            {
+                // A zone for each ghost would fill the ring in a few seconds
+                PROFILE_SCOPE("Ghost::Draw");
+                for (const auto& ghost : ghosts) {
+                    ghost.Draw(sprites, tick_alpha);
+                }
+            }
+            // Players, held weapons and ghosts are drawn here, all together
+            auto zone = TimePass(RenderPass::Sprites);
+            sprites.Flush();
         }
         else if (state == GameState::MainMenu) {
             sfondo.Render();
         }
 
+        if (gpu_overlay && gpu_timer.frame % kGpuOverlayPeriod == 0) {
+            auto& writings = ui.panel_map.at("gpu").first.writings;
+            for (int i = 0; i < gpu_timer.passes.size(); ++i) {
+                char str[32];
+                GpuOverlayTime(gpu_timer.passes[i], str, sizeof(str));
+                writings[i * 2 + 1].Update(str);
+            }
+        }
+
+        auto zone = TimePass(RenderPass::UI);
         ui.Render();
     }
 
-    void LoadLevel(const char* filename, std::mt19937& mt) {
+    GpuZone TimePass(RenderPass pass) {
+        return GpuZone(gpu_timer, static_cast<int>(pass));
+    }
 
-        LevelDesc level = ReadLevelDesc((std::filesystem::path(kLevelRoot) / std::filesystem::path(filename)).string().c_str());
+    // Always as long, since the writing can't grow
+    static void GpuOverlayTime(const GpuTimer::Pass& pass, char* str, size_t size) {
+        snprintf(str, size, "%7.3f ms", std::min(pass.Average(), 999.));
+    }
 
-        map.LoadLevel(level, mt);
+    void ToggleGpuOverlay() {
+        gpu_overlay = !gpu_overlay;
+        ui.panel_map.at("gpu").second = gpu_overlay;
+        if (gpu_overlay) {
+            gpu_timer.Reset();
+        }
+    }
+
+    // Plays level from its start, skipping menus and transitions, with a new game of a
+    // single player and a fixed seed, for the timedemo
+    void StartTimedemo(const LevelDesc& level, uint64_t seed) {
+        NewGame(false, seed);
+        LoadLevel(level);
+        StateRestored();
+        state = GameState::Game;
+        ui.panel_map.at("main_menu").second = false;
+        ui.panel_map.at("game_ui").second = true;
+    }
+
+    void LoadLevel(const char* filename) {
+        LoadLevel(prefetcher.Take(filename, !tilemap_mode));
+
+        // After the last level the next one to be played is the first, from the main menu
+        prefetcher.Prefetch(level_filenames[(current_level + 1) % level_filenames.size()], !tilemap_mode);
+    }
+
+    void LoadLevel(const LevelDesc& level) {
+
+        PROFILE_SCOPE("Game::LoadLevel");
+        sim.LoadLevel(level, current_level);
+        if (recording) {
+            replay.RecordLoadLevel(current_level);
+        }
+        rewind.Reset(sim);
+        map.LoadLevel(level);
+        tilemap.LoadLevel(level);
         mud.LoadLevel(level, level.mud);
         home.LoadLevel(level, level.home);
         wall.LoadLevel(level);
         teleport.LoadLevel(level);
-        nik.LoadLevel(level, current_level);
-        if(isSte) ste.LoadLevel(level, current_level);
+        nik.LoadLevel(level);
+        ste.LoadLevel(level);
         crust.LoadLevel(level);
         weapon.LoadLevel(level);
         for (auto& ghost : ghosts) {
-            ghost.LoadLevel(level, current_level);
-        }        
-
+            ghost.LoadLevel(level);
+        }
+        tick_accumulator = 0.f;
     }
 
 };
 
-const std::vector<Ghost::Color> Game::ghost_colors = { Ghost::Color::Red, Ghost::Color::Yellow, Ghost::Color::Blue, Ghost::Color::Purple };
-//const std::vector<Ghost::Color> Game::ghost_colors = { Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, 
-//Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Yellow, Ghost::Color::Blue, Ghost::Color::Blue, Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue,Ghost::Color::Blue, Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red,Ghost::Color::Red, };
-//const std::vector<Ghost::Color> Game::ghost_colors = { Ghost::Color::Red, Ghost::Color::Yellow, Ghost::Color::Blue, Ghost::Color::Purple };
-//const std::vector<Ghost::Color> Game::ghost_colors = { Ghost::Color::Red, Ghost::Color::Purple };
-//const std::vector<Ghost::Color> Game::ghost_colors = { Ghost::Color::Blue };
-
-
 #endif // NIKMAN_GAME_H
\ No newline at end of file
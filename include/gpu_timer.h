@@ -0,0 +1,174 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_GPU_TIMER_H
+#define NIKMAN_GPU_TIMER_H
+
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+
+#include <glad/glad.h>
+
+#include "profiler.h"
+
+// GL_TIME_ELAPSED queries around a fixed set of render passes. Each pass has a ring
+// of kGpuTimerLatency queries, and a result is only read once the GPU reports it as
+// available, so the CPU never waits: results arrive a few frames late, and are
+// dropped if they take longer than the ring. Queries can't be nested, so the passes
+// of a frame must follow one another.
+static constexpr int kGpuTimerLatency = 4;     // Frames
+static constexpr int kGpuTimerWindow = 60;     // Samples in the rolling average
+
+struct GpuTimer {
+
+    struct Pass {
+        const char* name;
+        unsigned int queries[kGpuTimerLatency] = {};
+        bool issued[kGpuTimerLatency] = {};
+        double samples[kGpuTimerWindow] = {};   // Milliseconds, ring
+        int n_samples = 0;
+        double total = 0;                       // Of every sample since Reset
+        long long n_total = 0;
+
+        double Average() const {
+            const int n = std::min(n_samples, kGpuTimerWindow);
+            double sum = 0;
+            for (int i = 0; i < n; ++i) {
+                sum += samples[i];
+            }
+            return n > 0 ? sum / n : 0.;
+        }
+    };
+
+    std::vector<Pass> passes;
+    unsigned long long frame = 0;
+    int active = -1;
+    bool enabled = false;
+
+    // names must be string literals, the pass given to Begin is their index
+    GpuTimer(std::initializer_list<const char*> names) {
+        for (const char* name : names) {
+            passes.push_back(Pass{ name });
+        }
+    }
+
+    ~GpuTimer() {
+        for (auto& pass : passes) {
+            if (pass.queries[0] != 0) {
+                glDeleteQueries(kGpuTimerLatency, pass.queries);
+            }
+        }
+    }
+
+    // Reads the results that are ready, to be called once per frame before any pass
+    void BeginFrame() {
+        ++frame;
+        for (auto& pass : passes) {
+            for (int i = 0; i < kGpuTimerLatency; ++i) {
+                if (pass.issued[i]) {
+                    Collect(pass, i);
+                }
+            }
+        }
+    }
+
+    void Begin(int index) {
+        if (!enabled) {
+            return;
+        }
+        Pass& pass = passes[index];
+        if (pass.queries[0] == 0) {
+            glGenQueries(kGpuTimerLatency, pass.queries);
+        }
+        const int slot = static_cast<int>(frame % kGpuTimerLatency);
+        // Still not available after a whole ring of frames: the query is reused
+        pass.issued[slot] = false;
+        glBeginQuery(GL_TIME_ELAPSED, pass.queries[slot]);
+        active = index;
+    }
+
+    void End() {
+        if (active < 0) {
+            return;
+        }
+        glEndQuery(GL_TIME_ELAPSED);
+        passes[active].issued[frame % kGpuTimerLatency] = true;
+        active = -1;
+    }
+
+    void Reset() {
+        for (auto& pass : passes) {
+            pass.n_samples = 0;
+            pass.total = 0;
+            pass.n_total = 0;
+        }
+    }
+
+    void Collect(Pass& pass, int slot) {
+        GLint available = 0;
+        glGetQueryObjectiv(pass.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            return;
+        }
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(pass.queries[slot], GL_QUERY_RESULT, &ns);
+        pass.issued[slot] = false;
+
+        const double ms = ns / 1e6;
+        pass.samples[pass.n_samples % kGpuTimerWindow] = ms;
+        pass.n_samples++;
+        pass.total += ms;
+        pass.n_total++;
+        if (profiler.Enabled()) {
+            profiler.RecordCounter("GPU ms", pass.name, ms);
+        }
+    }
+
+    GpuTimer(const GpuTimer& other) = delete;
+    GpuTimer(GpuTimer&& other) = delete;
+    GpuTimer& operator=(const GpuTimer& other) = delete;
+    GpuTimer& operator=(GpuTimer&& other) = delete;
+
+};
+
+// Times the rest of the enclosing block as the given pass
+struct GpuZone {
+
+    GpuTimer& timer;
+
+    GpuZone(GpuTimer& timer_, int index) : timer(timer_) {
+        timer.Begin(index);
+    }
+
+    ~GpuZone() {
+        timer.End();
+    }
+
+    GpuZone(const GpuZone& other) = delete;
+    GpuZone(GpuZone&& other) = delete;
+    GpuZone& operator=(const GpuZone& other) = delete;
+    GpuZone& operator=(GpuZone&& other) = delete;
+
+};
+
+#endif // NIKMAN_GPU_TIMER_H
@@ -0,0 +1,77 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_JUNCTION_GRAPH_H
+#define NIKMAN_JUNCTION_GRAPH_H
+
+#include <vector>
+#include <bitset>
+
+#include "level.h"
+#include "slot.h"
+#include "common.h"
+
+// Precomputed moves of the ghosts outside home. Most cells are corridors or dead
+// ends, where the direction only depends on the walls and the incoming direction:
+// there SetNewDir is replaced by a table lookup. Only junctions, where a ghost has
+// a real choice, are left to it.
+struct JunctionGraph {
+
+    int h = 0;
+    int w = 0;
+
+    // Direction forced by cell and incoming direction (DirTo2Bit), 0 at junctions
+    std::vector<unsigned char> forced;
+
+    void LoadLevel(const LevelDesc& level) {
+        h = level.h;
+        w = level.w;
+        forced.resize(h * w * 4);
+
+        for (int cell = 0; cell < h * w; ++cell) {
+            const unsigned char possible_dirs = ~level.cells[cell] & 15;
+            for (unsigned char i = 0; i < 4; ++i) {
+                const unsigned char direction = 1 << i;
+                const unsigned char backward_dir = (direction >> 2) | ((direction << 2) & 15);
+                const unsigned char possible_dirs_without_back = possible_dirs & ~backward_dir;
+                unsigned char& f = forced[cell * 4 + i];
+                if (possible_dirs_without_back == 0) {
+                    f = backward_dir;
+                }
+                else if (std::bitset<8>(possible_dirs_without_back).count() == 1) {
+                    f = possible_dirs_without_back;
+                }
+                else {
+                    f = 0;
+                }
+            }
+        }
+    }
+
+    // Direction to take in cell when coming with direction, or 0 if there is a choice
+    unsigned char Forced(int cell, unsigned char direction) const {
+        return forced[cell * 4 + DirTo2Bit(direction)];
+    }
+
+};
+
+#endif // NIKMAN_JUNCTION_GRAPH_H
@@ -26,6 +26,17 @@
 #include <vector>
 #include <fstream>
 #include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <future>
+#include <filesystem>
+#include <random>
+#include <algorithm>
+
+#include "common.h"
+#include "mapped_file.h"
+#include "profiler.h"
 
 
 struct LevelDesc {
@@ -43,7 +54,315 @@ struct LevelDesc {
     std::vector<std::pair<int, int>> empty;
     std::vector<std::pair<int, int>> teleports;
 
+    // Slot::data of each cell (walls and features), row by row from the bottom.
+    // Built from the lists above by BuildCells, or read as is from compiled levels
+    std::vector<unsigned short> cells;
+    int crusts = 0;
+
+};
+
+// Compiled levels are made of a CompiledLevelHeader, the teleports as (x, y) int32_t
+// pairs and the cells as uint16_t, so that loading one is a copy of the grid
+static constexpr char kCompiledLevelMagic[4] = { 'N', 'K', 'L', 'V' };
+static constexpr uint32_t kCompiledLevelVersion = 2;
+static constexpr char* const kCompiledLevelExtension = ".nkl";
+
+struct CompiledLevelHeader {
+    char magic[4];
+    uint32_t version;
+    int32_t h;
+    int32_t w;
+    uint64_t hash;      // CompiledLevelHash of the header and of everything following it
+    int32_t nik_x;
+    int32_t nik_y;
+    int32_t ste_x;
+    int32_t ste_y;
+    int32_t home_x;     // Ghosts spawn
+    int32_t home_y;
+    int32_t crusts;
+    uint32_t n_teleports;
 };
+static_assert(sizeof(CompiledLevelHeader) == 56, "CompiledLevelHeader must have no padding");
+
+// HashBytes of the header, with a null hash, followed by the payload
+uint64_t CompiledLevelHash(CompiledLevelHeader header, const unsigned char* payload, size_t size) {
+    header.hash = 0;
+    return HashBytes(payload, size, HashBytes(&header, sizeof(header)));
+}
+
+// Scatters the lists of a LevelDesc into its cells, using the Slot::data bits
+void BuildCells(LevelDesc& level) {
+
+    const int h = level.h;
+    const int w = level.w;
+    auto& cells = level.cells;
+
+    cells.assign(h * w, 16);    // Just a crust
+
+    auto SetFeature = [&](const std::vector<std::pair<int, int>>& positions, unsigned short flag) {
+        for (const auto& x : positions) {
+            cells[x.first + x.second * w] = (cells[x.first + x.second * w] & ~16) | flag;
+        }
+    };
+    SetFeature(level.home, 64);
+    SetFeature(level.weapons, 32);
+    SetFeature(level.mud, 4096);
+    SetFeature(level.empty, 0);
+    SetFeature(level.teleports, 128);
+    cells[level.nik_pos.first + level.nik_pos.second * w] &= ~16;
+    cells[level.ste_pos.first + level.ste_pos.second * w] &= ~16;
+
+    for (const auto& pos : level.ver_walls) {
+        if (pos.first > 0) {
+            cells[pos.first - 1 + pos.second * w] |= (1 << 3);
+        }
+        if (pos.first < w) {
+            cells[pos.first + pos.second * w] |= (1 << 1);
+        }
+    }
+    for (const auto& pos : level.hor_walls) {
+        if (pos.second > 0) {
+            cells[pos.first + (pos.second - 1) * w] |= (1 << 0);
+        }
+        if (pos.second < h) {
+            cells[pos.first + pos.second * w] |= (1 << 2);
+        }
+    }
+
+    level.crusts = 0;
+    for (unsigned short c : cells) {
+        level.crusts += (c >> 4) & 1;
+    }
+}
+
+// Random maze of h x w cells (at least 4 x 4), with the features needed to play it.
+// A depth-first backtracker carves a perfect maze through every cell around a ghost
+// home of 3 x 2 cells in the center, whose only exit is on top. Only mt() is used, not
+// the std distributions, so that a seed gives the same maze with every standard library
+LevelDesc GenerateLevel(int h, int w, std::mt19937& mt) {
+
+    LevelDesc level;
+
+    level.h = h;
+    level.w = w;
+
+    std::vector<bool> hor_walls((h + 1) * w, true);
+    std::vector<bool> ver_walls(h * (w + 1), true);
+
+#define DOWN(x, y) (hor_walls[(y) * w + (x)])
+#define UP(x, y) (hor_walls[((y) + 1) * w + (x)])
+#define LEFT(x, y) (ver_walls[(y) * (w + 1) + (x)])
+#define RIGHT(x, y) (ver_walls[(y) * (w + 1) + (x) + 1])
+
+    std::vector<bool> visited(h * w, false);
+
+    // Home cells are open to each other, and left out of the maze
+    const int home_x = w / 2 - 1;
+    const int home_y = h / 2 - 1;
+    for (int y = home_y; y < home_y + 2; ++y) {
+        for (int x = home_x; x < home_x + 3; ++x) {
+            visited[y * w + x] = true;
+            level.home.emplace_back(x, y);
+            if (x > home_x) {
+                LEFT(x, y) = false;
+            }
+            if (y > home_y) {
+                DOWN(x, y) = false;
+            }
+        }
+    }
+    UP(home_x + 1, home_y + 1) = false;
+
+    // The maze grows from the cell outside the exit, with the current path on a stack
+    std::vector<std::pair<int, int>> path = { { home_x + 1, home_y + 2 } };
+    visited[(home_y + 2) * w + home_x + 1] = true;
+    while (!path.empty()) {
+
+        const int x = path.back().first;
+        const int y = path.back().second;
+
+        // Unvisited neighbours, as in Slot: w a s d
+        int dirs[4];
+        int n_dirs = 0;
+        if (y + 1 < h && !visited[(y + 1) * w + x]) dirs[n_dirs++] = 0;
+        if (x > 0 && !visited[y * w + x - 1]) dirs[n_dirs++] = 1;
+        if (y > 0 && !visited[(y - 1) * w + x]) dirs[n_dirs++] = 2;
+        if (x + 1 < w && !visited[y * w + x + 1]) dirs[n_dirs++] = 3;
+        if (n_dirs == 0) {
+            path.pop_back();
+            continue;
+        }
+
+        const int dir = dirs[mt() % n_dirs];
+        int next_x = x;
+        int next_y = y;
+        if (dir == 0) {
+            UP(x, y) = false;
+            ++next_y;
+        }
+        else if (dir == 1) {
+            LEFT(x, y) = false;
+            --next_x;
+        }
+        else if (dir == 2) {
+            DOWN(x, y) = false;
+            --next_y;
+        }
+        else {
+            RIGHT(x, y) = false;
+            ++next_x;
+        }
+        visited[next_y * w + next_x] = true;
+        path.emplace_back(next_x, next_y);
+    }
+
+    // Make level desc 
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w + 1; ++x) {
+            if (ver_walls[y * (w + 1) + x]) {
+                level.ver_walls.emplace_back(x, y);
+            }
+        }
+    }
+    for (int y = 0; y < h + 1; ++y) {
+        for (int x = 0; x < w; ++x) {
+            if (hor_walls[y * w + x]) {
+                level.hor_walls.emplace_back(x, y);
+            }
+        }
+    }
+
+    // Players in the bottom corners and weapons in the top corners
+    level.nik_pos = { 0, 0 };
+    level.ste_pos = { w - 1, 0 };
+    level.weapons.emplace_back(0, h - 1);
+    level.weapons.emplace_back(w - 1, h - 1);
+
+    BuildCells(level);
+
+    return level;
+
+#undef DOWN
+#undef UP
+#undef LEFT
+#undef RIGHT
+}
+
+// Whether every cell can be reached from the spawn of Nik. The level must be closed by its
+// border walls, as the generated and the parsed ones are
+bool LevelConnected(const LevelDesc& level) {
+
+    const int w = level.w;
+    std::vector<bool> reached(level.cells.size(), false);
+    std::vector<int> queue = { level.nik_pos.first + level.nik_pos.second * w };
+    reached[queue.front()] = true;
+    for (size_t i = 0; i < queue.size(); ++i) {
+        const int cell = queue[i];
+        const unsigned short walls = level.cells[cell] & 15;
+        const int neighbours[4] = { cell + w, cell - 1, cell - w, cell + 1 };    // w a s d
+        for (int dir = 0; dir < 4; ++dir) {
+            if (!(walls & (1 << dir)) && !reached[neighbours[dir]]) {
+                reached[neighbours[dir]] = true;
+                queue.push_back(neighbours[dir]);
+            }
+        }
+    }
+    return queue.size() == level.cells.size();
+}
+
+// Rebuilds the walls, home, weapons and mud lists from the cells, in the same
+// order as ReadLevelDesc. Only the legacy renderers need them
+void ExpandCells(LevelDesc& level) {
+
+    const int h = level.h;
+    const int w = level.w;
+
+    level.ver_walls.clear();
+    level.hor_walls.clear();
+    level.home.clear();
+    level.weapons.clear();
+    level.mud.clear();
+
+    for (int y = h - 1; y >= 0; --y) {
+        for (int x = 0; x < w; ++x) {
+            unsigned short c = level.cells[x + y * w];
+            if (x > 0 && (c & 2)) level.ver_walls.emplace_back(x, y);
+            if (c & 32) level.weapons.emplace_back(x, y);
+            if (c & 64) level.home.emplace_back(x, y);
+            if (c & 4096) level.mud.emplace_back(x, y);
+        }
+        if (y > 0) {
+            for (int x = 0; x < w; ++x) {
+                if (level.cells[x + y * w] & 4) level.hor_walls.emplace_back(x, y);
+            }
+        }
+    }
+
+    for (int x = 0; x < w; ++x) {
+        level.hor_walls.emplace_back(x, 0);
+        level.hor_walls.emplace_back(x, h);
+    }
+    for (int y = 0; y < h; ++y) {
+        level.ver_walls.emplace_back(0, y);
+        level.ver_walls.emplace_back(w, y);
+    }
+}
+
+// Writes level in the text format read by ReadLevelDesc, from its cells
+bool WriteLevelDesc(const LevelDesc& level, const char* filename) {
+
+    std::ofstream os(filename, std::ios::binary);
+    if (!os.is_open()) {
+        std::cerr << "Error in WriteLevelDesc: can't open filename.\n";
+        return false;
+    }
+
+    const int h = level.h;
+    const int w = level.w;
+
+    auto Letter = [&](int x, int y) {
+        const unsigned short c = level.cells[x + y * w];
+        if (level.nik_pos == std::make_pair(x, y)) return 'n';
+        if (level.ste_pos == std::make_pair(x, y)) return 's';
+        if (c & 128) return 't';
+        if (c & 32) return 'w';
+        if (c & 64) return 'h';
+        if (c & 4096) return 'm';
+        if (!(c & 16)) return 'e';
+        return ' ';
+    };
+
+    std::string line;
+    auto BorderLine = [&]() {
+        line.clear();
+        for (int x = 0; x < w; ++x) {
+            line += "+---";
+        }
+        line += "+\n";
+        os << line;
+    };
+
+    BorderLine();
+    for (int y = h - 1; y >= 0; --y) {
+        line = "| ";
+        for (int x = 0; x < w - 1; ++x) {
+            line += Letter(x, y);
+            line += (level.cells[x + y * w] & 8) ? " | " : "   ";
+        }
+        line += Letter(w - 1, y);
+        line += " |\n";
+        if (y > 0) {
+            for (int x = 0; x < w; ++x) {
+                line += (level.cells[x + y * w] & 4) ? "+---" : "+   ";
+            }
+            line += "+\n";
+        }
+        os << line;
+    }
+    BorderLine();
+
+    return os.good();
+}
 
 LevelDesc ReadLevelDesc(const char* filename) {
 
@@ -76,7 +395,7 @@ LevelDesc ReadLevelDesc(const char* filename) {
         return true;
     };
 
-    std::ifstream is(filename);
+    AssetStream is(filename);
     if (!is.is_open()) {
         std::cerr << "Error in ReadLevelDesc: can't open filename.\n";
         return level;
@@ -215,10 +534,179 @@ LevelDesc ReadLevelDesc(const char* filename) {
         level.ver_walls.emplace_back(w, y);
     }
 
+    BuildCells(level);
+
     return level;
 
 #undef EXPECT_CHAR
 #undef INVALID_FORMAT
 }
 
+bool WriteCompiledLevel(const LevelDesc& level, const char* filename) {
+
+    if (level.h < 1 || level.w < 1 || level.cells.size() != static_cast<size_t>(level.h) * level.w) {
+        std::cerr << "Error in WriteCompiledLevel: invalid level.\n";
+        return false;
+    }
+
+    std::vector<unsigned char> payload(level.teleports.size() * 2 * sizeof(int32_t) + level.cells.size() * sizeof(uint16_t));
+    unsigned char* p = payload.data();
+    for (const auto& x : level.teleports) {
+        int32_t pos[2] = { x.first, x.second };
+        memcpy(p, pos, sizeof(pos));
+        p += sizeof(pos);
+    }
+    memcpy(p, level.cells.data(), level.cells.size() * sizeof(uint16_t));
+
+    CompiledLevelHeader header;
+    memcpy(header.magic, kCompiledLevelMagic, sizeof(header.magic));
+    header.version = kCompiledLevelVersion;
+    header.h = level.h;
+    header.w = level.w;
+    header.nik_x = level.nik_pos.first;
+    header.nik_y = level.nik_pos.second;
+    header.ste_x = level.ste_pos.first;
+    header.ste_y = level.ste_pos.second;
+    header.home_x = level.home.empty() ? 0 : level.home.front().first;
+    header.home_y = level.home.empty() ? 0 : level.home.front().second;
+    header.crusts = level.crusts;
+    header.n_teleports = static_cast<uint32_t>(level.teleports.size());
+    header.hash = CompiledLevelHash(header, payload.data(), payload.size());
+
+    std::ofstream os(filename, std::ios::binary);
+    if (!os.is_open()) {
+        std::cerr << "Error in WriteCompiledLevel: can't open filename.\n";
+        return false;
+    }
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    os.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+    return true;
+}
+
+// Whether the spawns and the teleports are inside the level, and the level is closed by
+// its border, so that the Simulation can index the grid with any position it reaches
+bool ValidCompiledLevel(const LevelDesc& level) {
+
+    auto Inside = [&](const std::pair<int, int>& pos) {
+        return pos.first >= 0 && pos.first < level.w && pos.second >= 0 && pos.second < level.h;
+    };
+    if (!Inside(level.nik_pos) || !Inside(level.ste_pos) || !Inside(level.home.front())) {
+        return false;
+    }
+    // A single teleport would have nowhere to send to
+    if (level.teleports.size() == 1 || !std::all_of(level.teleports.begin(), level.teleports.end(), Inside)) {
+        return false;
+    }
+
+    // Walls as set by BuildCells: 4 on row 0, 1 on row h - 1, 2 on column 0, 8 on column w - 1
+    for (int x = 0; x < level.w; ++x) {
+        if (!(level.cells[x] & 4) || !(level.cells[x + (level.h - 1) * level.w] & 1)) {
+            return false;
+        }
+    }
+    for (int y = 0; y < level.h; ++y) {
+        if (!(level.cells[y * level.w] & 2) || !(level.cells[level.w - 1 + y * level.w] & 8)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Loads a level written by WriteCompiledLevel. Only cells, spawns and teleports
+// are filled: call ExpandCells for the other lists
+LevelDesc ReadCompiledLevel(const char* filename) {
+
+#define INVALID_FORMAT    { std::cerr << "Error in ReadCompiledLevel: invalid format.\n";  return level; }
+
+    LevelDesc level;
+
+    const AssetFile asset(filename);
+    if (!asset.Valid()) {
+        std::cerr << "Error in ReadCompiledLevel: can't open filename.\n";
+        return level;
+    }
+    const AssetView& file = asset.view;
+
+    CompiledLevelHeader header;
+    if (file.size < sizeof(header)) INVALID_FORMAT
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, kCompiledLevelMagic, sizeof(header.magic)) != 0 || header.version != kCompiledLevelVersion) INVALID_FORMAT
+    if (header.h < 1 || header.w < 1) INVALID_FORMAT
+
+    const size_t teleports_size = static_cast<size_t>(header.n_teleports) * 2 * sizeof(int32_t);
+    const size_t cells_size = static_cast<size_t>(header.h) * header.w * sizeof(uint16_t);
+    if (file.size != sizeof(header) + teleports_size + cells_size) INVALID_FORMAT
+
+    const unsigned char* payload = file.data + sizeof(header);
+    if (CompiledLevelHash(header, payload, teleports_size + cells_size) != header.hash) INVALID_FORMAT
+
+    level.h = header.h;
+    level.w = header.w;
+    level.nik_pos = std::make_pair(header.nik_x, header.nik_y);
+    level.ste_pos = std::make_pair(header.ste_x, header.ste_y);
+    level.home.emplace_back(header.home_x, header.home_y);
+    level.crusts = header.crusts;
+
+    level.teleports.resize(header.n_teleports);
+    for (uint32_t i = 0; i < header.n_teleports; ++i) {
+        int32_t pos[2];
+        memcpy(pos, payload + i * sizeof(pos), sizeof(pos));
+        level.teleports[i] = std::make_pair(pos[0], pos[1]);
+    }
+
+    level.cells.resize(static_cast<size_t>(header.h) * header.w);
+    memcpy(level.cells.data(), payload + teleports_size, cells_size);
+
+    if (!ValidCompiledLevel(level)) {
+        level.cells.clear();
+        INVALID_FORMAT
+    }
+
+    return level;
+
+#undef INVALID_FORMAT
+}
+
+// Reads a level from kLevelRoot, choosing the format from the extension.
+// With expand, the lists needed by the legacy renderers are always filled
+LevelDesc LoadLevelDesc(const std::string& filename, bool expand) {
+
+    PROFILE_SCOPE("LoadLevelDesc");
+    const std::string path = JoinPath(kLevelRoot, filename.c_str());
+    const size_t n_extension = strlen(kCompiledLevelExtension);
+    const bool compiled = path.size() >= n_extension && path.compare(path.size() - n_extension, n_extension, kCompiledLevelExtension) == 0;
+    LevelDesc level = compiled ? ReadCompiledLevel(path.c_str()) : ReadLevelDesc(path.c_str());
+    if (expand && level.ver_walls.empty() && !level.cells.empty()) {
+        ExpandCells(level);
+    }
+    return level;
+}
+
+// Reads the next level on a worker thread while the current one is played,
+// so that switching level only has to swap in the prepared LevelDesc
+struct LevelPrefetcher {
+
+    std::future<LevelDesc> pending;
+    std::string pending_filename;
+    bool pending_expand = false;
+
+    void Prefetch(const std::string& filename, bool expand) {
+        if (pending.valid() && pending_filename == filename && pending_expand == expand) {
+            return;
+        }
+        pending_filename = filename;
+        pending_expand = expand;
+        pending = std::async(std::launch::async, LoadLevelDesc, filename, expand);
+    }
+
+    // Returns the prefetched level if it matches, otherwise reads it now
+    LevelDesc Take(const std::string& filename, bool expand) {
+        if (pending.valid() && pending_filename == filename && pending_expand == expand) {
+            return pending.get();
+        }
+        return LoadLevelDesc(filename, expand);
+    }
+
+};
+
 #endif // NIKMAN_LEVEL_H
\ No newline at end of file
@@ -0,0 +1,135 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_MAPPED_FILE_H
+#define NIKMAN_MAPPED_FILE_H
+
+#include <cstddef>
+#include <iostream>
+
+#if defined _WIN32
+#if !defined NOMINMAX
+#define NOMINMAX
+#endif
+#if !defined WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#undef near
+#undef far
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file
+struct MappedFile {
+
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+#if defined _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int fd = -1;
+#endif
+
+    MappedFile(const char* filename) {
+
+#if defined _WIN32
+        file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+            std::cerr << "Error in MappedFile: can't open " << filename << ".\n";
+            return;
+        }
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+            return;
+        }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) {
+            std::cerr << "Error in MappedFile: can't map " << filename << ".\n";
+            return;
+        }
+        const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (view == NULL) {
+            std::cerr << "Error in MappedFile: can't map " << filename << ".\n";
+            return;
+        }
+        data = static_cast<const unsigned char*>(view);
+        size = static_cast<size_t>(file_size.QuadPart);
+#else
+        fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Error in MappedFile: can't open " << filename << ".\n";
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            return;
+        }
+        void* view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view == MAP_FAILED) {
+            std::cerr << "Error in MappedFile: can't map " << filename << ".\n";
+            return;
+        }
+        data = static_cast<const unsigned char*>(view);
+        size = static_cast<size_t>(st.st_size);
+#endif
+    }
+
+    ~MappedFile() {
+#if defined _WIN32
+        if (data != nullptr) {
+            UnmapViewOfFile(data);
+        }
+        if (mapping != NULL) {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+#else
+        if (data != nullptr) {
+            munmap(const_cast<unsigned char*>(data), size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
+    }
+
+    bool Valid() const {
+        return data != nullptr;
+    }
+
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile(MappedFile&& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
+    MappedFile& operator=(MappedFile&& other) = delete;
+
+};
+
+#endif // NIKMAN_MAPPED_FILE_H
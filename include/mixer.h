@@ -0,0 +1,165 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_MIXER_H
+#define NIKMAN_MIXER_H
+
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include <SFML/Audio.hpp>
+
+#include "profiler.h"
+
+enum class SoundPriority {
+    Low,        // Frequent and short, like eating a crust
+    Normal,
+    High,       // Someone caught or hit
+    Critical,   // Level completed, game over, victory
+};
+
+// All the sounds of the game, but the music, play on a fixed pool of voices, so that
+// their number stays the same however many ghosts there are. Play only queues the
+// request: Submit starts the queued sounds at once, the most important first, stealing
+// the voice of a lower priority (or farther) sound when none is free. Each buffer plays
+// on at most cap voices: more requests for it restart the one that has played longest
+struct Mixer {
+
+    static constexpr int kVoices = 16;      // OpenAL implementations may give as few as 32 sources
+    static constexpr int kDefaultCap = 4;
+
+    struct Request {
+        const sf::SoundBuffer* buffer;
+        float volume;
+        SoundPriority priority;
+        float distance;                     // From the nearest player, in cells
+    };
+
+    struct Voice {
+        sf::Sound sound;
+        const sf::SoundBuffer* buffer = nullptr;
+        SoundPriority priority = SoundPriority::Low;
+        float distance = 0.f;
+
+        bool Playing() const {
+            return buffer != nullptr && sound.getStatus() == sf::Sound::Playing;
+        }
+    };
+
+    Voice voices[kVoices];
+    std::vector<Request> requests;
+    std::map<const sf::SoundBuffer*, int> caps;
+
+    Mixer() {}
+
+    Mixer(const Mixer& other) = delete;
+    Mixer(Mixer&& other) = delete;
+    Mixer& operator=(const Mixer& other) = delete;
+    Mixer& operator=(Mixer&& other) = delete;
+
+    // A cap of 0 drops every request for the buffer
+    void SetCap(const sf::SoundBuffer& buffer, int cap) {
+        caps[&buffer] = cap;
+    }
+
+    int Cap(const sf::SoundBuffer* buffer) const {
+        auto it = caps.find(buffer);
+        return it != caps.end() ? it->second : kDefaultCap;
+    }
+
+    void Play(const sf::SoundBuffer& buffer, float volume, SoundPriority priority, float distance = 0.f) {
+        requests.push_back({ &buffer, volume, priority, distance });
+    }
+
+    // Whether a sound with priority and distance may take the voice of the other
+    static bool Precedes(SoundPriority priority, float distance, SoundPriority other_priority, float other_distance) {
+        if (priority != other_priority) {
+            return priority > other_priority;
+        }
+        return distance < other_distance;
+    }
+
+    void Start(Voice& voice, const Request& request) {
+        voice.sound.setBuffer(*request.buffer);
+        voice.buffer = request.buffer;
+        voice.sound.setVolume(request.volume);
+        voice.priority = request.priority;
+        voice.distance = request.distance;
+        voice.sound.play();
+    }
+
+    // Starts the sounds requested since the last call, to be called once per update
+    void Submit() {
+
+        if (requests.empty()) {
+            return;
+        }
+        PROFILE_SCOPE("Mixer::Submit");
+
+        std::stable_sort(requests.begin(), requests.end(), [](const Request& a, const Request& b) {
+            return Precedes(a.priority, a.distance, b.priority, b.distance);
+        });
+
+        for (const Request& request : requests) {
+
+            // A buffer already on all the voices it may have restarts the oldest of them
+            Voice* oldest = nullptr;
+            int playing = 0;
+            for (Voice& voice : voices) {
+                if (voice.buffer == request.buffer && voice.Playing()) {
+                    ++playing;
+                    if (oldest == nullptr || voice.sound.getPlayingOffset() > oldest->sound.getPlayingOffset()) {
+                        oldest = &voice;
+                    }
+                }
+            }
+            if (playing >= Cap(request.buffer)) {
+                // Unless it was started by this same Submit, or the cap is 0 and the sound is muted
+                if (oldest != nullptr && oldest->sound.getPlayingOffset() > sf::Time::Zero) {
+                    Start(*oldest, request);
+                }
+                continue;
+            }
+
+            // A free voice, or else the least important one
+            Voice* target = nullptr;
+            for (Voice& voice : voices) {
+                if (!voice.Playing()) {
+                    target = &voice;
+                    break;
+                }
+                if (target == nullptr || Precedes(target->priority, target->distance, voice.priority, voice.distance)) {
+                    target = &voice;
+                }
+            }
+            if (!target->Playing() || Precedes(request.priority, request.distance, target->priority, target->distance)) {
+                Start(*target, request);
+            }
+        }
+
+        requests.clear();
+    }
+
+};
+
+#endif // NIKMAN_MIXER_H
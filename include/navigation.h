@@ -0,0 +1,182 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_NAVIGATION_H
+#define NIKMAN_NAVIGATION_H
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "level.h"
+#include "slot.h"
+
+// Shortest path distances from each player to every cell, following the same
+// walls as the ghosts. A field is computed again only when its player changes
+// cell, so that any number of ghosts can sample it in O(1).
+struct Navigation {
+
+    static constexpr int kUnreachable = std::numeric_limits<int>::max() / 2;
+
+    struct Field {
+        std::vector<int> distance;
+        int source = -1;
+    };
+
+    int h = 0;
+    int w = 0;
+
+    const std::vector<Slot>& grid;
+    std::vector<int> teleports;                         // Cell indices
+    Field fields[2];                                    // Indexed by Player::Name
+    std::vector<int> queue;
+    std::vector<std::pair<int, int>> teleport_sources;  // (distance, cell)
+
+    Navigation(const std::vector<Slot>& grid_) : grid(grid_) {}
+
+    void LoadLevel(const LevelDesc& level) {
+        h = level.h;
+        w = level.w;
+        teleports.clear();
+        for (const auto& x : level.teleports) {
+            teleports.push_back(x.first + x.second * w);
+        }
+        for (auto& field : fields) {
+            field.distance.resize(h * w);
+            field.source = -1;
+        }
+        queue.resize(h * w + teleports.size());
+    }
+
+    void Update(int player, int cell) {
+        Field& field = fields[player];
+        if (cell != field.source) {
+            field.source = cell;
+            Compute(field);
+        }
+    }
+
+    // Number of moves a ghost needs to reach the player from cell (x, y)
+    int Distance(int player, int x, int y) const {
+        const Field& field = fields[player];
+        if (field.source < 0 || x < 0 || x >= w || y < 0 || y >= h) {
+            return kUnreachable;
+        }
+        return field.distance[y * w + x];
+    }
+
+    // Breadth-first search from the player cell. A ghost stepping on a teleport is
+    // sent to one of the others at random, so teleports are not walked through:
+    // their distance is one more than the farthest destination (a pessimistic
+    // estimate), and a second pass spreads those distances to the other cells.
+    void Compute(Field& field) {
+
+        std::vector<int>& distance = field.distance;
+        std::fill(distance.begin(), distance.end(), kUnreachable);
+
+        size_t head = 0;
+        size_t tail = 0;
+
+        auto Relax = [&](int cell, bool update_teleports) {
+            const int d = distance[cell] + 1;
+            const unsigned char walls = grid[cell].Walls();
+            const int next[4] = { cell + w, cell - 1, cell - w, cell + 1 };    // w a s d
+            for (int i = 0; i < 4; ++i) {
+                if (walls & (1 << i)) {
+                    continue;
+                }
+                const int n = next[i];
+                if (grid[n].Teleport() && n != field.source) {
+                    if (update_teleports && d < distance[n]) {
+                        distance[n] = d;
+                    }
+                }
+                else if (d < distance[n]) {
+                    distance[n] = d;
+                    queue[tail++] = n;
+                }
+            }
+        };
+
+        distance[field.source] = 0;
+        queue[tail++] = field.source;
+        while (head < tail) {
+            Relax(queue[head++], true);
+        }
+
+        if (teleports.size() < 2) {
+            return;
+        }
+
+        // The two farthest teleports, so that each one can exclude itself
+        int first = -1;
+        int second = -1;
+        for (int cell : teleports) {
+            if (first < 0 || distance[cell] > distance[first]) {
+                second = first;
+                first = cell;
+            }
+            else if (second < 0 || distance[cell] > distance[second]) {
+                second = cell;
+            }
+        }
+        const int first_distance = distance[first];
+        const int second_distance = distance[second];
+
+        teleport_sources.clear();
+        for (int cell : teleports) {
+            if (cell == field.source) {
+                continue;
+            }
+            // One move to step on it, one spent on the destination
+            const int farthest = cell == first ? second_distance : first_distance;
+            distance[cell] = farthest >= kUnreachable ? kUnreachable : farthest + 2;
+            if (distance[cell] < kUnreachable) {
+                teleport_sources.emplace_back(distance[cell], cell);
+            }
+        }
+        std::sort(teleport_sources.begin(), teleport_sources.end());
+
+        // Distances are not uniform anymore: teleports join the queue in order
+        head = 0;
+        tail = 0;
+        size_t next_source = 0;
+        while (true) {
+            while (next_source < teleport_sources.size() &&
+                (head == tail || teleport_sources[next_source].first <= distance[queue[head]])) {
+                queue[tail++] = teleport_sources[next_source++].second;
+            }
+            if (head == tail) {
+                break;
+            }
+            Relax(queue[head++], false);
+        }
+    }
+
+    Navigation(const Navigation& other) = delete;
+    Navigation(Navigation&& other) = delete;
+    Navigation& operator=(const Navigation& other) = delete;
+    Navigation& operator=(Navigation&& other) = delete;
+
+};
+
+#endif // NIKMAN_NAVIGATION_H
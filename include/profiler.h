@@ -0,0 +1,240 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_PROFILER_H
+#define NIKMAN_PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+
+#include "allocation_tracker.h"
+
+// Scoped CPU timing zones, written as Chrome trace events (chrome://tracing, Perfetto).
+// Each thread records into its own ring of the last kProfilerEvents zones: the owning
+// thread is its only writer, and publishes a zone by advancing an atomic counter, so
+// recording never takes a lock. While the profiler is off a zone costs a relaxed load.
+//
+// PROFILE_SCOPE("name") times the rest of the enclosing block. Only the pointer to the
+// name is kept, so it must be a string literal. Defining NIKMAN_NO_PROFILER compiles
+// every zone out. Values measured elsewhere, such as GPU times, can be added as
+// counters, shown as a graph with a series for each name. With NIKMAN_TRACK_ALLOCATIONS
+// each zone also has the heap allocations made by its thread while it was open.
+
+static constexpr size_t kProfilerEvents = 1 << 16;     // Per thread
+
+struct ProfilerEvent {
+    const char* name;
+    int64_t begin;  // Nanoseconds since the Profiler was created
+    int64_t end;
+    const char* counter = nullptr;  // Graph this is a sample of, or a zone if null
+    double value = 0;
+    AllocationCounts allocations;
+};
+
+struct ProfilerThread {
+    std::vector<ProfilerEvent> events;      // Ring, written by the owning thread only
+    std::atomic<uint64_t> written{ 0 };     // Events ever recorded
+    int id;
+    std::string name;
+    bool retired = false;                   // Its thread has exited, guarded by Profiler::mutex
+
+    ProfilerThread(int id_) : events(kProfilerEvents), id(id_) {}
+};
+
+struct Profiler {
+
+    std::atomic<bool> enabled{ false };
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Buffers are never released, so that a thread that has exited can still be dumped,
+    // but they are handed over to new threads: std::async starts one for every call
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ProfilerThread>> threads;
+
+    int64_t Now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool Enabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    void SetEnabled(bool enabled_) {
+        enabled.store(enabled_, std::memory_order_relaxed);
+    }
+
+    // The buffer of the calling thread, taken the first time
+    ProfilerThread& Thread() {
+        struct Owner {
+            Profiler* profiler = nullptr;
+            ProfilerThread* thread = nullptr;
+            ~Owner() {
+                if (thread != nullptr) {
+                    std::lock_guard<std::mutex> lock(profiler->mutex);
+                    thread->retired = true;
+                }
+            }
+        };
+        thread_local Owner owner;
+        if (owner.thread == nullptr) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& thread : threads) {
+                if (thread->retired) {
+                    thread->retired = false;
+                    thread->name.clear();
+                    owner.thread = thread.get();
+                    break;
+                }
+            }
+            if (owner.thread == nullptr) {
+                threads.push_back(std::make_unique<ProfilerThread>(static_cast<int>(threads.size()) + 1));
+                owner.thread = threads.back().get();
+            }
+            owner.profiler = this;
+        }
+        return *owner.thread;
+    }
+
+    // Shown by the trace viewer, to be called once when the thread starts
+    void SetThreadName(const std::string& name) {
+        ProfilerThread& thread = Thread();
+        std::lock_guard<std::mutex> lock(mutex);
+        thread.name = name;
+    }
+
+    void Record(const char* name, int64_t begin, int64_t end, AllocationCounts allocations = {}) {
+        ProfilerThread& thread = Thread();
+        const uint64_t n = thread.written.load(std::memory_order_relaxed);
+        thread.events[n % kProfilerEvents] = { name, begin, end, nullptr, 0., allocations };
+        thread.written.store(n + 1, std::memory_order_release);
+    }
+
+    void RecordCounter(const char* counter, const char* name, double value) {
+        ProfilerThread& thread = Thread();
+        const uint64_t n = thread.written.load(std::memory_order_relaxed);
+        const int64_t now = Now();
+        thread.events[n % kProfilerEvents] = { name, now, now, counter, value, {} };
+        thread.written.store(n + 1, std::memory_order_release);
+    }
+
+    // Writes every zone still in the rings, while the other threads keep recording.
+    // A slot is copied without locking, so the events whose slots were rewritten during
+    // the copy, or may be being rewritten at its end (the slot of the next event, before
+    // written is bumped), are left out: the others are exported as they were recorded
+    bool WriteTrace(const char* filename) {
+        std::ofstream os(filename);
+        if (!os.is_open()) {
+            std::cerr << "Error in Profiler::WriteTrace: can't open " << filename << ".\n";
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        os << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Nikman\"}}";
+        std::vector<ProfilerEvent> events;
+        for (const auto& thread : threads) {
+            const uint64_t end = thread->written.load(std::memory_order_acquire);
+            uint64_t begin = end > kProfilerEvents ? end - kProfilerEvents : 0;
+            events.clear();
+            for (uint64_t i = begin; i < end; ++i) {
+                events.push_back(thread->events[i % kProfilerEvents]);
+            }
+            const uint64_t after = thread->written.load(std::memory_order_acquire);
+            // Slots up to after % kProfilerEvents included have been, or are being, reused
+            const uint64_t skip = after + 1 > kProfilerEvents + begin ? after + 1 - kProfilerEvents - begin : 0;
+
+            if (!thread->name.empty()) {
+                os << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->id << ",\"args\":{\"name\":\"" << thread->name << "\"}}";
+            }
+            for (size_t i = static_cast<size_t>(std::min<uint64_t>(skip, events.size())); i < events.size(); ++i) {
+                const ProfilerEvent& e = events[i];
+                if (e.counter != nullptr) {
+                    os << ",\n{\"name\":\"" << e.counter << "\",\"ph\":\"C\",\"pid\":1,\"tid\":" << thread->id
+                        << ",\"ts\":" << e.begin / 1000 << "." << e.begin / 100 % 10
+                        << ",\"args\":{\"" << e.name << "\":" << e.value << "}}";
+                    continue;
+                }
+                os << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id
+                    << ",\"ts\":" << e.begin / 1000 << "." << e.begin / 100 % 10
+                    << ",\"dur\":" << (e.end - e.begin) / 1000 << "." << (e.end - e.begin) / 100 % 10;
+                if (e.allocations.count > 0) {
+                    os << ",\"args\":{\"allocations\":" << e.allocations.count << ",\"bytes\":" << e.allocations.bytes << "}";
+                }
+                os << "}";
+            }
+        }
+        os << "\n]}\n";
+
+        if (!os.good()) {
+            std::cerr << "Error in Profiler::WriteTrace: can't write " << filename << ".\n";
+            return false;
+        }
+        return true;
+    }
+
+};
+
+static Profiler profiler;
+
+struct ProfileZone {
+
+    const char* name;
+    int64_t begin;  // Negative if the profiler was off when the zone started
+    AllocationCounts allocations;
+
+    explicit ProfileZone(const char* name_) : name(name_), begin(-1) {
+        if (profiler.Enabled()) {
+            begin = profiler.Now();
+            allocations = ThreadAllocations();
+        }
+    }
+
+    ~ProfileZone() {
+        if (begin >= 0) {
+            profiler.Record(name, begin, profiler.Now(), ThreadAllocations() - allocations);
+        }
+    }
+
+    ProfileZone(const ProfileZone& other) = delete;
+    ProfileZone(ProfileZone&& other) = delete;
+    ProfileZone& operator=(const ProfileZone& other) = delete;
+    ProfileZone& operator=(ProfileZone&& other) = delete;
+
+};
+
+#define NIKMAN_PROFILE_CONCAT_(a, b) a##b
+#define NIKMAN_PROFILE_CONCAT(a, b) NIKMAN_PROFILE_CONCAT_(a, b)
+
+#if defined NIKMAN_NO_PROFILER
+#define PROFILE_SCOPE(name)
+#else
+#define PROFILE_SCOPE(name) ProfileZone NIKMAN_PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#endif
+
+#endif // NIKMAN_PROFILER_H
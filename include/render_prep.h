@@ -0,0 +1,114 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_RENDER_PREP_H
+#define NIKMAN_RENDER_PREP_H
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "slot.h"
+
+// CPU side of the rendering: what is computed every frame or level before it is
+// handed to GL. It needs no GL context, so that NikmanBench can measure it.
+
+// Angle of the crust of a cell. A hash of the cell, so that it needs neither memory
+// in the grid nor random numbers from the Simulation
+constexpr float CrustAngle(int cell) {
+    uint32_t x = static_cast<uint32_t>(cell) * 0x9E3779B9u;
+    x ^= x >> 16;
+    x *= 0x85EBCA6Bu;
+    x ^= x >> 13;
+    return (x >> 8) * (2.f * 3.14159f / 16777216.f);
+}
+
+// World matrices of the crusts left in grid, column by column, for Crust::Render
+void BuildCrustMatrices(const std::vector<Slot>& grid, int h, int w, float size, std::vector<glm::mat4>& worlds) {
+
+    worlds.clear();
+    for (int x = 0; x < w; ++x) {
+        for (int y = 0; y < h; ++y) {
+
+            if (grid[y * w + x].Crust()) {
+
+                const float angle = CrustAngle(y * w + x);
+
+                glm::mat4 world(1.f);
+                world = glm::translate(world, glm::vec3(
+                    -w / 2.f + size / 2.f + size * x,
+                    -h / 2.f + size / 2.f + size * y,
+                    0.f
+                ));
+
+                world = glm::scale(world, glm::vec3(size, size, 1.f));
+                world = glm::rotate(world, angle, glm::vec3(0.f, 0.f, 1.f));
+                worlds.push_back(world);
+
+            }
+
+        }
+    }
+}
+
+// World matrices of the vertical and then the horizontal walls, for Wall::Render
+void BuildWallMatrices(const std::vector<std::pair<int, int>>& ver_positions, const std::vector<std::pair<int, int>>& hor_positions,
+    float h, float w, float size, std::vector<glm::mat4>& worlds) {
+
+    worlds.clear();
+    glm::mat4 world;
+    for (const auto& pos : ver_positions) {
+        world = glm::mat4(1.f);
+        world = glm::translate(world, glm::vec3(
+            -w / 2 + pos.first * size,
+            -h / 2 + size / 2 + pos.second * size,
+            0.f)
+        );
+        world = glm::scale(world, glm::vec3(size, size, 1.f));
+        worlds.push_back(world);
+    }
+
+    for (const auto& pos : hor_positions) {
+        world = glm::mat4(1.f);
+        world = glm::translate(world, glm::vec3(
+            -w / 2 + size / 2 + pos.first * size,
+            -h / 2 + pos.second * size,
+            0.f)
+        );
+        world = glm::scale(world, glm::vec3(size, size, 1.f));
+        world = glm::rotate(world, glm::radians(90.f), glm::vec3(0.f, 0.f, 1.f));
+        worlds.push_back(world);
+    }
+}
+
+// CrustAngle of each of the n cells of a level, as uploaded by TileMap
+void BuildCrustAngles(int n, std::vector<float>& angles) {
+    angles.resize(n);
+    for (int i = 0; i < n; ++i) {
+        angles[i] = CrustAngle(i);
+    }
+}
+
+#endif // NIKMAN_RENDER_PREP_H
@@ -0,0 +1,142 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_RENDER_STATE_H
+#define NIKMAN_RENDER_STATE_H
+
+#include <glad/glad.h>
+
+// Thin shadow of the GL state touched by the game: redundant program, texture,
+// vertex array and blend changes are skipped, and everything is counted so that
+// the cost of a frame can be inspected.
+struct RenderState {
+
+    static constexpr int kTextureUnits = 8;
+
+    struct Stats {
+        unsigned int state_changes = 0;
+        unsigned int skipped_changes = 0;
+        unsigned int draw_calls = 0;
+    };
+
+    unsigned int program = 0;
+    unsigned int vertex_array = 0;
+    unsigned int active_unit = 0;
+    unsigned int textures[kTextureUnits] = {};
+    bool blend = false;
+
+    Stats frame;        // Current frame
+    Stats last_frame;   // Last completed frame
+
+    void BeginFrame() {
+        last_frame = frame;
+        frame = Stats();
+    }
+
+    void UseProgram(unsigned int program_) {
+        if (program == program_) {
+            ++frame.skipped_changes;
+            return;
+        }
+        glUseProgram(program_);
+        program = program_;
+        ++frame.state_changes;
+    }
+
+    void BindVertexArray(unsigned int vertex_array_) {
+        if (vertex_array == vertex_array_) {
+            ++frame.skipped_changes;
+            return;
+        }
+        glBindVertexArray(vertex_array_);
+        vertex_array = vertex_array_;
+        ++frame.state_changes;
+    }
+
+    // Binds a GL_TEXTURE_2D, leaving unit 0 active, which is what the rest of the code expects
+    void BindTexture(unsigned int texture, unsigned int unit = 0) {
+        if (textures[unit] == texture) {
+            ++frame.skipped_changes;
+            return;
+        }
+        if (active_unit != unit) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+        }
+        glBindTexture(GL_TEXTURE_2D, texture);
+        if (unit != 0) {
+            glActiveTexture(GL_TEXTURE0);
+        }
+        active_unit = 0;
+        textures[unit] = texture;
+        ++frame.state_changes;
+    }
+
+    void SetBlend(bool enabled) {
+        if (blend == enabled) {
+            ++frame.skipped_changes;
+            return;
+        }
+        if (enabled) {
+            glEnable(GL_BLEND);
+        }
+        else {
+            glDisable(GL_BLEND);
+        }
+        blend = enabled;
+        ++frame.state_changes;
+    }
+
+    void DrawArrays(GLenum mode, GLint first, GLsizei count) {
+        glDrawArrays(mode, first, count);
+        ++frame.draw_calls;
+    }
+
+    // GL reuses deleted names, so they must be forgotten here as well
+
+    void DeleteProgram(unsigned int program_) {
+        glDeleteProgram(program_);
+        if (program == program_) {
+            program = 0;
+        }
+    }
+
+    void DeleteVertexArray(unsigned int vertex_array_) {
+        glDeleteVertexArrays(1, &vertex_array_);
+        if (vertex_array == vertex_array_) {
+            vertex_array = 0;
+        }
+    }
+
+    void DeleteTexture(unsigned int texture) {
+        glDeleteTextures(1, &texture);
+        for (auto& x : textures) {
+            if (x == texture) {
+                x = 0;
+            }
+        }
+    }
+
+};
+
+static RenderState render_state;
+
+#endif // NIKMAN_RENDER_STATE_H
@@ -0,0 +1,367 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_REPLAY_H
+#define NIKMAN_REPLAY_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "common.h"
+#include "mapped_file.h"
+#include "simulation.h"
+
+// A replay is the list of commands given to a Simulation (new game, load level, restore
+// of a snapshot, and the input of every tick, run-length encoded), plus keyframes of
+// the whole state every keyframe_interval ticks. The simulation is deterministic, so
+// running the commands again reproduces the session, and seeking starts from the
+// nearest keyframe.
+//
+// File layout: ReplayHeader, level filenames (uint32_t length and characters), ghost
+// colors (uint8_t), commands, restored snapshots (uint32_t size and SimSnapshot data),
+// and keyframes (ReplayKeyframeHeader and SimSnapshot data).
+
+static constexpr char kReplayMagic[4] = { 'N', 'K', 'R', 'P' };
+static constexpr uint32_t kReplayVersion = 4;
+
+struct ReplayCommand {
+    enum Type : uint32_t { NewGame, LoadLevel, Ticks, Restore };
+    uint32_t type;
+    uint32_t count;     // Ticks: how many in a row with the same input. LoadLevel: level index. NewGame: number of players. Restore: snapshot index
+    uint64_t value;     // Ticks: wasd. NewGame: seed
+};
+static_assert(sizeof(ReplayCommand) == 16, "ReplayCommand must have no padding");
+
+struct ReplayHeader {
+    char magic[4];
+    uint32_t version;
+    float tick_duration;
+    uint32_t keyframe_interval;
+    uint64_t ticks;
+    uint64_t end_checksum;      // Simulation::Checksum after the last command
+    uint32_t n_levels;
+    uint32_t n_ghosts;
+    uint32_t n_commands;
+    uint32_t n_snapshots;
+    uint32_t n_keyframes;
+    uint32_t padding;
+};
+static_assert(sizeof(ReplayHeader) == 56, "ReplayHeader must have no padding");
+
+struct ReplayKeyframeHeader {
+    uint64_t tick;          // Ticks played before the keyframe
+    uint32_t command;       // Command of the next tick
+    uint32_t offset;        // Ticks of that command already played
+    uint32_t level;         // To be loaded before the snapshot
+    uint32_t size;          // Of the snapshot
+    uint64_t checksum;
+};
+static_assert(sizeof(ReplayKeyframeHeader) == 32, "ReplayKeyframeHeader must have no padding");
+
+struct ReplayKeyframe {
+    ReplayKeyframeHeader header;
+    SimSnapshot snapshot;
+};
+
+// Position in a replay while playing it
+struct ReplayCursor {
+    size_t command = 0;
+    uint32_t offset = 0;
+    uint64_t tick = 0;
+    size_t keyframe = 0;    // Next one to be checked
+};
+
+struct Replay {
+
+    float tick_duration = 0.f;
+    uint32_t keyframe_interval = 0;
+    uint64_t ticks = 0;
+    uint64_t end_checksum = 0;
+    std::vector<std::string> level_filenames;
+    std::vector<GhostColor> roster;
+    std::vector<ReplayCommand> commands;
+    std::vector<SimSnapshot> snapshots;     // Restored during the session
+    std::vector<ReplayKeyframe> keyframes;
+
+    // Recording
+
+    void Start(float tick_duration_, uint32_t keyframe_interval_, const std::vector<std::string>& level_filenames_, const std::vector<GhostColor>& roster_) {
+        tick_duration = tick_duration_;
+        keyframe_interval = keyframe_interval_;
+        ticks = 0;
+        end_checksum = 0;
+        level_filenames = level_filenames_;
+        roster = roster_;
+        commands.clear();
+        snapshots.clear();
+        keyframes.clear();
+    }
+
+    void RecordNewGame(bool two_players, uint64_t seed) {
+        commands.push_back({ ReplayCommand::NewGame, two_players ? 2u : 1u, seed });
+    }
+
+    void RecordLoadLevel(int level) {
+        commands.push_back({ ReplayCommand::LoadLevel, static_cast<uint32_t>(level), 0 });
+    }
+
+    // To be called after sim.Restore, with the same snapshot
+    void RecordRestore(const SimSnapshot& snapshot) {
+        commands.push_back({ ReplayCommand::Restore, static_cast<uint32_t>(snapshots.size()), 0 });
+        snapshots.push_back(snapshot);
+    }
+
+    // To be called before sim.Tick, with the same input
+    void RecordTick(unsigned int wasd, const Simulation& sim) {
+        wasd &= 255;    // The simulation ignores the other keys
+        if (!commands.empty() && commands.back().type == ReplayCommand::Ticks && commands.back().value == wasd) {
+            commands.back().count++;
+        }
+        else {
+            commands.push_back({ ReplayCommand::Ticks, 1, wasd });
+        }
+        if (ticks % keyframe_interval == 0) {
+            ReplayKeyframe keyframe;
+            keyframe.header.tick = ticks;
+            keyframe.header.command = static_cast<uint32_t>(commands.size() - 1);
+            keyframe.header.offset = commands.back().count - 1;
+            keyframe.header.level = sim.level_index;
+            keyframe.header.checksum = sim.Checksum();
+            sim.Save(keyframe.snapshot);
+            keyframe.header.size = static_cast<uint32_t>(keyframe.snapshot.size);
+            keyframes.push_back(std::move(keyframe));
+        }
+        ticks++;
+    }
+
+    void Finish(const Simulation& sim) {
+        end_checksum = sim.Checksum();
+    }
+
+    bool Write(const char* filename) const {
+
+        std::ofstream os(filename, std::ios::binary);
+        if (!os.is_open()) {
+            std::cerr << "Error in Replay::Write: can't open filename.\n";
+            return false;
+        }
+
+        ReplayHeader header;
+        memcpy(header.magic, kReplayMagic, sizeof(header.magic));
+        header.version = kReplayVersion;
+        header.tick_duration = tick_duration;
+        header.keyframe_interval = keyframe_interval;
+        header.ticks = ticks;
+        header.end_checksum = end_checksum;
+        header.n_levels = static_cast<uint32_t>(level_filenames.size());
+        header.n_ghosts = static_cast<uint32_t>(roster.size());
+        header.n_commands = static_cast<uint32_t>(commands.size());
+        header.n_snapshots = static_cast<uint32_t>(snapshots.size());
+        header.n_keyframes = static_cast<uint32_t>(keyframes.size());
+        header.padding = 0;
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        for (const auto& level_filename : level_filenames) {
+            const uint32_t length = static_cast<uint32_t>(level_filename.size());
+            os.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            os.write(level_filename.data(), length);
+        }
+        for (const auto color : roster) {
+            const uint8_t c = static_cast<uint8_t>(color);
+            os.write(reinterpret_cast<const char*>(&c), sizeof(c));
+        }
+        os.write(reinterpret_cast<const char*>(commands.data()), commands.size() * sizeof(ReplayCommand));
+        for (const auto& snapshot : snapshots) {
+            const uint32_t size = static_cast<uint32_t>(snapshot.size);
+            os.write(reinterpret_cast<const char*>(&size), sizeof(size));
+            os.write(reinterpret_cast<const char*>(snapshot.data.data()), snapshot.size);
+        }
+        for (const auto& keyframe : keyframes) {
+            os.write(reinterpret_cast<const char*>(&keyframe.header), sizeof(keyframe.header));
+            os.write(reinterpret_cast<const char*>(keyframe.snapshot.data.data()), keyframe.snapshot.size);
+        }
+
+        return os.good();
+    }
+
+    bool Read(const char* filename) {
+
+#define INVALID_FORMAT    { std::cerr << "Error in Replay::Read: invalid format.\n";  return false; }
+
+        MappedFile file(filename);
+        if (!file.Valid()) {
+            std::cerr << "Error in Replay::Read: can't open filename.\n";
+            return false;
+        }
+
+        size_t pos = 0;
+        auto Get = [&](void* dst, size_t size) {
+            if (file.size - pos < size) {
+                return false;
+            }
+            memcpy(dst, file.data + pos, size);
+            pos += size;
+            return true;
+        };
+
+        ReplayHeader header;
+        if (!Get(&header, sizeof(header))) INVALID_FORMAT
+        if (memcmp(header.magic, kReplayMagic, sizeof(header.magic)) != 0 || header.version != kReplayVersion) INVALID_FORMAT
+        if (header.keyframe_interval == 0) INVALID_FORMAT
+
+        tick_duration = header.tick_duration;
+        keyframe_interval = header.keyframe_interval;
+        ticks = header.ticks;
+        end_checksum = header.end_checksum;
+
+        level_filenames.resize(header.n_levels);
+        for (auto& level_filename : level_filenames) {
+            uint32_t length;
+            if (!Get(&length, sizeof(length)) || file.size - pos < length) INVALID_FORMAT
+            level_filename.assign(reinterpret_cast<const char*>(file.data + pos), length);
+            pos += length;
+        }
+
+        roster.resize(header.n_ghosts);
+        for (auto& color : roster) {
+            uint8_t c;
+            if (!Get(&c, sizeof(c)) || c > static_cast<uint8_t>(GhostColor::Green)) INVALID_FORMAT
+            color = static_cast<GhostColor>(c);
+        }
+
+        if ((file.size - pos) / sizeof(ReplayCommand) < header.n_commands) INVALID_FORMAT
+        commands.resize(header.n_commands);
+        Get(commands.data(), commands.size() * sizeof(ReplayCommand));
+
+        snapshots.resize(header.n_snapshots);
+        for (auto& snapshot : snapshots) {
+            uint32_t size;
+            if (!Get(&size, sizeof(size)) || file.size - pos < size) INVALID_FORMAT
+            snapshot.data.resize(size);
+            snapshot.size = size;
+            Get(snapshot.data.data(), size);
+        }
+        for (const auto& command : commands) {
+            if (command.type == ReplayCommand::Restore && command.count >= snapshots.size()) INVALID_FORMAT
+            if (command.type == ReplayCommand::LoadLevel && command.count >= header.n_levels) INVALID_FORMAT
+        }
+
+        keyframes.resize(header.n_keyframes);
+        for (auto& keyframe : keyframes) {
+            if (!Get(&keyframe.header, sizeof(keyframe.header)) || file.size - pos < keyframe.header.size) INVALID_FORMAT
+            if (keyframe.header.command >= commands.size() || commands[keyframe.header.command].type != ReplayCommand::Ticks) INVALID_FORMAT
+            if (keyframe.header.level >= header.n_levels) INVALID_FORMAT
+            keyframe.snapshot.data.resize(keyframe.header.size);
+            keyframe.snapshot.size = keyframe.header.size;
+            Get(keyframe.snapshot.data.data(), keyframe.header.size);
+        }
+
+        if (pos != file.size) INVALID_FORMAT
+
+        return true;
+
+#undef INVALID_FORMAT
+    }
+
+    // Playback
+
+    // Runs the commands up to the next tick included. load_level(index) must load the
+    // level into the simulation, and into whatever else depends on it. restored() is
+    // called after a snapshot has replaced the whole state of the simulation, so that
+    // what depends on it (the grid, the lives, the score) is refreshed as a whole.
+    // Returns false when there are no more ticks
+    template <typename LoadLevel, typename Restored>
+    bool Step(ReplayCursor& cursor, Simulation& sim, LoadLevel&& load_level, Restored&& restored) const {
+        while (cursor.command < commands.size()) {
+            const ReplayCommand& command = commands[cursor.command];
+            if (command.type == ReplayCommand::NewGame) {
+                sim.NewGame(command.count == 2, command.value);
+                cursor.command++;
+            }
+            else if (command.type == ReplayCommand::LoadLevel) {
+                load_level(static_cast<int>(command.count));
+                cursor.command++;
+            }
+            else if (command.type == ReplayCommand::Restore) {
+                if (sim.Restore(snapshots[command.count])) {
+                    restored();
+                }
+                cursor.command++;
+            }
+            else {
+                if (cursor.keyframe < keyframes.size() && keyframes[cursor.keyframe].header.tick == cursor.tick) {
+                    if (keyframes[cursor.keyframe].header.checksum != sim.Checksum()) {
+                        std::cerr << "Error in Replay::Step: desync at tick " << cursor.tick << ".\n";
+                    }
+                    cursor.keyframe++;
+                }
+                sim.Tick(tick_duration, static_cast<unsigned int>(command.value));
+                cursor.tick++;
+                if (++cursor.offset == command.count) {
+                    cursor.command++;
+                    cursor.offset = 0;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Moves to tick, restoring the last keyframe before it unless it is quicker to
+    // go on from the current position. Returns false if the replay is shorter.
+    // restored() is not called for the keyframe: the whole state has to be refreshed
+    // after seeking anyway
+    template <typename LoadLevel, typename Restored>
+    bool Seek(ReplayCursor& cursor, uint64_t tick, Simulation& sim, LoadLevel&& load_level, Restored&& restored) const {
+        size_t best = keyframes.size();
+        for (size_t i = 0; i < keyframes.size() && keyframes[i].header.tick <= tick; ++i) {
+            best = i;
+        }
+        if (best < keyframes.size() && (cursor.tick > tick || keyframes[best].header.tick > cursor.tick)) {
+            const ReplayKeyframe& keyframe = keyframes[best];
+            load_level(static_cast<int>(keyframe.header.level));
+            if (!sim.Restore(keyframe.snapshot)) {
+                return false;
+            }
+            cursor.command = keyframe.header.command;
+            cursor.offset = keyframe.header.offset;
+            cursor.tick = keyframe.header.tick;
+            cursor.keyframe = best;
+        }
+        else if (cursor.tick > tick) {
+            cursor = ReplayCursor();
+        }
+        while (cursor.tick < tick) {
+            if (!Step(cursor, sim, load_level, restored)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+};
+
+#endif // NIKMAN_REPLAY_H
@@ -0,0 +1,260 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_REWIND_H
+#define NIKMAN_REWIND_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include "simulation.h"
+
+// The last seconds of play of a Simulation, to go back in time. Every stride ticks the
+// state is saved, and only its difference from the previous save is kept: the two
+// snapshots are XORed, so that unchanged bytes (most of the grid, ghosts standing
+// still) become zeros, and the zeros are run-length encoded. Besides, the input of
+// every tick is kept, so that any tick can be reached by restoring the save just
+// before it and simulating the few ticks left.
+//
+// Deltas are kept in a ring of bytes of fixed capacity, and the oldest ones are
+// dropped to make room: the history is as long as the memory allows, up to seconds.
+// Nothing is allocated after construction.
+//
+// Encoded delta: a sequence of (zero bytes to skip, varint) (literal length, varint)
+// and the literal bytes, to be XORed with the newer snapshot to get the older one.
+struct RewindBuffer {
+
+    struct Entry {
+        uint64_t tick;      // Of the older snapshot, the one restored by the delta
+        size_t offset;      // In bytes
+        size_t size;
+    };
+
+    static constexpr size_t kMinZeroRun = 4;    // Shorter runs of zeros are kept in the literals
+
+    float tick_duration;
+    uint32_t stride;
+    uint64_t max_ticks;
+
+    std::vector<unsigned char> bytes;
+    std::vector<Entry> entries;         // Ring, from the oldest one
+    size_t first_entry = 0;
+    size_t n_entries = 0;
+    std::vector<unsigned char> inputs;  // Ring, indexed by tick
+    std::vector<unsigned char> delta;   // Scratch for the encoding
+
+    SimSnapshot head;                   // Last save
+    SimSnapshot current;
+    uint64_t head_tick = 0;
+    uint64_t tick = 0;                  // Of the simulation, since the last Reset
+
+    RewindBuffer(float seconds, float tick_duration_, uint32_t stride_, size_t capacity) :
+        tick_duration(tick_duration_),
+        stride(stride_),
+        max_ticks(static_cast<uint64_t>(seconds / tick_duration_)),
+        bytes(capacity),
+        entries(static_cast<size_t>(max_ticks / stride_ + 1)),
+        inputs(static_cast<size_t>(max_ticks + stride_))
+    {}
+
+    // Forgets the history, to be called whenever the state of sim is replaced
+    void Reset(const Simulation& sim) {
+        n_entries = 0;
+        first_entry = 0;
+        sim.Save(head);
+        head_tick = 0;
+        tick = 0;
+    }
+
+    // To be called before sim.Tick, with the same input
+    void Record(unsigned int wasd, const Simulation& sim) {
+
+        if (tick - head_tick == stride) {
+            sim.Save(current);
+            if (current.size != head.size || current.Level() != head.Level()) {
+                // A different level was loaded, nothing before can be restored
+                Reset(sim);
+            }
+            else {
+                Push(Encode(current, head));
+                std::swap(head, current);
+                head_tick = tick;
+            }
+        }
+
+        inputs[tick % inputs.size()] = static_cast<unsigned char>(wasd & 255);
+        tick++;
+    }
+
+    uint64_t OldestTick() const {
+        return n_entries > 0 ? entries[first_entry].tick : head_tick;
+    }
+
+    // Goes back by ticks, or less if the history is shorter, and drops what comes
+    // after. Returns the ticks actually gone back
+    uint64_t Rewind(uint64_t ticks, Simulation& sim) {
+
+        const uint64_t target = std::max(tick - std::min(ticks, tick), OldestTick());
+        if (target == tick) {
+            return 0;
+        }
+
+        while (head_tick > target) {
+            const Entry& entry = entries[(first_entry + n_entries - 1) % entries.size()];
+            Decode(bytes.data() + entry.offset, entry.size, head);
+            head_tick = entry.tick;
+            n_entries--;
+        }
+
+        sim.Restore(head);
+        for (uint64_t t = head_tick; t < target; ++t) {
+            sim.Tick(tick_duration, inputs[t % inputs.size()]);
+        }
+
+        const uint64_t rewound = tick - target;
+        tick = target;
+        return rewound;
+    }
+
+    double Seconds() const {
+        return (tick - OldestTick()) * tick_duration;
+    }
+
+    size_t BytesUsed() const {
+        size_t used = 0;
+        for (size_t i = 0; i < n_entries; ++i) {
+            used += entries[(first_entry + i) % entries.size()].size;
+        }
+        return used;
+    }
+
+    static void PutVarint(unsigned char*& out, size_t value) {
+        while (value >= 128) {
+            *out++ = static_cast<unsigned char>(value | 128);
+            value >>= 7;
+        }
+        *out++ = static_cast<unsigned char>(value);
+    }
+
+    static size_t GetVarint(const unsigned char*& in) {
+        size_t value = 0;
+        for (int shift = 0; ; shift += 7) {
+            const unsigned char byte = *in++;
+            value |= static_cast<size_t>(byte & 127) << shift;
+            if (!(byte & 128)) {
+                return value;
+            }
+        }
+    }
+
+    // Returns the size of the delta, written in delta
+    size_t Encode(const SimSnapshot& newer, const SimSnapshot& older) {
+
+        const unsigned char* a = newer.data.data();
+        const unsigned char* b = older.data.data();
+        const size_t n = newer.size;
+
+        // At worst a single literal, preceded by two varints
+        if (delta.size() < n + 20) {
+            delta.resize(n + 20);
+        }
+        unsigned char* out = delta.data();
+
+        size_t i = 0;
+        while (i < n) {
+            const size_t zeros_start = i;
+            while (i < n && a[i] == b[i]) {
+                ++i;
+            }
+            if (i == n) {
+                break;
+            }
+            const size_t literal_start = i;
+            size_t literal_end = i;
+            while (i < n && i - literal_end < kMinZeroRun) {
+                if (a[i] != b[i]) {
+                    literal_end = i + 1;
+                }
+                ++i;
+            }
+            PutVarint(out, literal_start - zeros_start);
+            PutVarint(out, literal_end - literal_start);
+            for (size_t j = literal_start; j < literal_end; ++j) {
+                *out++ = a[j] ^ b[j];
+            }
+            i = literal_end;
+        }
+
+        return out - delta.data();
+    }
+
+    static void Decode(const unsigned char* in, size_t size, SimSnapshot& snapshot) {
+        const unsigned char* end = in + size;
+        unsigned char* p = snapshot.data.data();
+        while (in < end) {
+            p += GetVarint(in);
+            const size_t literal = GetVarint(in);
+            for (size_t j = 0; j < literal; ++j) {
+                *p++ ^= *in++;
+            }
+        }
+    }
+
+    // Stores the delta just encoded, as the newest entry
+    void Push(size_t size) {
+
+        if (size > bytes.size()) {
+            // Doesn't fit at all: the history starts again from here
+            n_entries = 0;
+            return;
+        }
+
+        size_t offset = 0;
+        if (n_entries > 0) {
+            const Entry& last = entries[(first_entry + n_entries - 1) % entries.size()];
+            offset = last.offset + last.size;
+            if (offset + size > bytes.size()) {
+                offset = 0;
+            }
+        }
+
+        // Drops the oldest entries, if too many or in the way
+        while (n_entries > 0) {
+            const Entry& oldest = entries[first_entry];
+            const bool overlaps = oldest.offset < offset + size && offset < oldest.offset + oldest.size;
+            if (!overlaps && n_entries < entries.size() && tick - oldest.tick <= max_ticks) {
+                break;
+            }
+            first_entry = (first_entry + 1) % entries.size();
+            n_entries--;
+        }
+
+        memcpy(bytes.data() + offset, delta.data(), size);
+        entries[(first_entry + n_entries) % entries.size()] = { head_tick, offset, size };
+        n_entries++;
+    }
+
+};
+
+#endif // NIKMAN_REWIND_H
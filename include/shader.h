@@ -25,36 +25,64 @@
 
 #include <filesystem>
 #include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 
 #include <glad/glad.h>
 
 #include "utility.h"
+#include "render_state.h"
+#include "profiler.h"
 
 enum class ShaderType { Vertex, Fragment, Geometry, None };
 
-//! Creates a shader from a file
+ShaderType DeduceShaderType(const char* filename) {
+    int len = strlen(filename);
+    if (strcmp(filename + len - 5, ".vert") == 0)
+        return ShaderType::Vertex;
+    else if (strcmp(filename + len - 5, ".frag") == 0)
+        return ShaderType::Fragment;
+    else if (strcmp(filename + len - 5, ".geom") == 0)
+        return ShaderType::Geometry;
+    std::cerr << "Error! Unknown shader type.\n";
+    return ShaderType::None;
+}
+
+//! Reads the source code of a shader
 /*!
-  \param filename file containing the shader source code
-  \param type Shader type, or ShaderType::None, in which case the type is deduced from file extension
-  \return the created shader id, or -1 in case of failure
+  \param filename file containing the shader source code, relative to kShaderRoot
+  \param source string filled with the source code
+  \return true on success
 */
-unsigned int CreateShader(const char* filename, ShaderType type = ShaderType::None) {
-
-    if (type == ShaderType::None) {
-        int len = strlen(filename);
-        if (strcmp(filename + len - 5, ".vert") == 0)
-            type = ShaderType::Vertex;
-        else if (strcmp(filename + len - 5, ".frag") == 0)
-            type = ShaderType::Fragment;
-        else if (strcmp(filename + len - 5, ".geom") == 0)
-            type = ShaderType::Geometry;
-        else {
-            std::cerr << "Error! Unknown shader type.\n";
-            return -1;
-        }
+bool ReadShaderSource(const char* filename, std::string& source) {
+    AssetStream is(JoinPath(kShaderRoot, filename), std::ios::binary);
+    if (!is.is_open()) {
+        std::cerr << "Error! Can't open shader source code.\n";
+        return false;
     }
+    is.seekg(0, std::ios_base::end);
+    int file_size = is.tellg();
+    is.seekg(0, std::ios_base::beg);
+    source.resize(file_size);
+    is.read(source.data(), file_size);
+    return true;
+}
+
+//! Creates a shader from its source code
+/*!
+  \param source shader source code
+  \param type Shader type
+  \param check whether to wait for the compilation and check its result; when false, errors
+  are reported later by the program link
+  \return the created shader id, or -1 in case of failure
+*/
+unsigned int CreateShaderFromSource(const std::string& source, ShaderType type, bool check = true) {
 
     unsigned int shader;
     GLenum shader_type;
@@ -78,27 +106,14 @@ unsigned int CreateShader(const char* filename, ShaderType type = ShaderType::No
 
     shader = glCreateShader(shader_type);
 
-    {
-        std::ifstream is(std::filesystem::path(kShaderRoot) / std::filesystem::path(filename), std::ios::binary);
-        if (!is.is_open()) {
-            glDeleteShader(shader);
-            std::cerr << "Error! Can't open shader source code.\n";
-            return -1;
-        }
+    const char* shader_source = source.c_str();
+    glShaderSource(shader, 1, &shader_source, NULL);
+    glCompileShader(shader);
 
-        char* shader_source;
-        is.seekg(0, std::ios_base::end);
-        int file_size = is.tellg();
-        is.seekg(0, std::ios_base::beg);
-        shader_source = new char[file_size + 1];
-        is.read(shader_source, file_size);
-        shader_source[file_size] = 0;
-        glShaderSource(shader, 1, &shader_source, NULL);
-        delete[] shader_source;
+    if (!check) {
+        return shader;
     }
 
-    glCompileShader(shader);
-
     int success;
     char infoLog[512];
     glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
@@ -114,44 +129,385 @@ unsigned int CreateShader(const char* filename, ShaderType type = ShaderType::No
     return shader;
 }
 
+//! Creates a shader from a file
+/*!
+  \param filename file containing the shader source code
+  \param type Shader type, or ShaderType::None, in which case the type is deduced from file extension
+  \return the created shader id, or -1 in case of failure
+*/
+unsigned int CreateShader(const char* filename, ShaderType type = ShaderType::None) {
 
-struct Shader {
+    if (type == ShaderType::None) {
+        type = DeduceShaderType(filename);
+        if (type == ShaderType::None) {
+            return -1;
+        }
+    }
 
-    unsigned int program = -1;
-    bool valid = false;
+    std::string source;
+    if (!ReadShaderSource(filename, source)) {
+        return -1;
+    }
 
-    Shader() {}
+    return CreateShaderFromSource(source, type);
+}
 
-    Shader(const char* vertex_file, const char* fragment_file, const char* geometry_file = nullptr) {
 
-        const unsigned int vertex = CreateShader(vertex_file);
-        const unsigned int fragment = CreateShader(fragment_file);
-        const unsigned int geometry = geometry_file != nullptr ? CreateShader(geometry_file) : -1;
+// Process-wide owner of the linked programs. Each shader pair is compiled once and
+// shared by every Shader using it; linked programs are also stored on disk with
+// glGetProgramBinary, so that the following runs can skip compilation entirely.
+struct ShaderRegistry {
+
+    // Not part of the GL 3.3 profile loaded by glad
+    static constexpr GLenum kProgramBinaryRetrievableHint = 0x8257;
+    static constexpr GLenum kNumProgramBinaryFormats = 0x87FE;
+    static constexpr GLenum kProgramBinaryLength = 0x8741;
+    static constexpr uint32_t kCacheMagic = 0x3253504E;    // "NPS2"
+
+    // Header of a cache file, followed by size bytes of program binary
+    struct CacheHeader {
+        uint32_t magic;
+        uint32_t format;
+        uint32_t size;
+    };
+
+    typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+    typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+    typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+    typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+
+    struct Entry {
+        unsigned int program;
+        int references;
+    };
+
+    // Program whose compilation has been started but not checked yet
+    struct Pending {
+        std::string key;
+        std::string cache_path;
+        unsigned int program;
+        std::vector<unsigned int> shaders;
+    };
+
+    std::map<std::string, Entry> programs;
+    std::string driver;
+    GetProgramBinaryProc get_program_binary = nullptr;
+    ProgramBinaryProc program_binary = nullptr;
+    ProgramParameteriProc program_parameteri = nullptr;
+    bool parallel_compile = false;
+    int cache_hits = 0;         // Programs loaded from the cache
+    int cache_misses = 0;       // Programs compiled, with the cache available
+
+    bool HasExtension(const char* name) const {
+        GLint n;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+        for (GLint i = 0; i < n; ++i) {
+            if (strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), name) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
 
-        program = glCreateProgram();
-        glAttachShader(program, vertex);
-        glAttachShader(program, fragment);
+    // Must be called once the GL context is current, with the same loader given to glad
+    void Init(GLADloadproc load) {
+
+        driver = std::string(reinterpret_cast<const char*>(glGetString(GL_VENDOR))) + '|' +
+            reinterpret_cast<const char*>(glGetString(GL_RENDERER)) + '|' +
+            reinterpret_cast<const char*>(glGetString(GL_VERSION));
+
+        GLint major, minor;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        if (major * 10 + minor >= 41 || HasExtension("GL_ARB_get_program_binary")) {
+            GLint formats = 0;
+            glGetIntegerv(kNumProgramBinaryFormats, &formats);
+            if (formats > 0) {
+                get_program_binary = reinterpret_cast<GetProgramBinaryProc>(load("glGetProgramBinary"));
+                program_binary = reinterpret_cast<ProgramBinaryProc>(load("glProgramBinary"));
+                program_parameteri = reinterpret_cast<ProgramParameteriProc>(load("glProgramParameteri"));
+            }
+        }
+        if (get_program_binary == nullptr || program_binary == nullptr || program_parameteri == nullptr) {
+            get_program_binary = nullptr;
+            program_binary = nullptr;
+            program_parameteri = nullptr;
+        }
+
+        // Let the driver compile on its own threads: compilations are started
+        // together by Preload, and only checked once all of them have been issued
+        MaxShaderCompilerThreadsProc max_threads = nullptr;
+        if (HasExtension("GL_KHR_parallel_shader_compile")) {
+            max_threads = reinterpret_cast<MaxShaderCompilerThreadsProc>(load("glMaxShaderCompilerThreadsKHR"));
+        }
+        else if (HasExtension("GL_ARB_parallel_shader_compile")) {
+            max_threads = reinterpret_cast<MaxShaderCompilerThreadsProc>(load("glMaxShaderCompilerThreadsARB"));
+        }
+        if (max_threads != nullptr) {
+            max_threads(0xFFFFFFFF);
+            parallel_compile = true;
+        }
+    }
+
+    static std::string Key(const char* vertex_file, const char* fragment_file, const char* geometry_file) {
+        std::string key = std::string(vertex_file) + '|' + fragment_file;
         if (geometry_file != nullptr) {
-            glAttachShader(program, geometry);
+            key += std::string("|") + geometry_file;
+        }
+        return key;
+    }
+
+    // Cache files, without GL: the whole file must be the header and the binary it announces
+    static bool ReadCacheFile(const std::string& path, GLenum& format, std::vector<char>& binary) {
+
+        std::ifstream is(path, std::ios::binary | std::ios::ate);
+        if (!is.is_open()) {
+            return false;
+        }
+        const std::streamoff file_size = is.tellg();
+        is.seekg(0);
+
+        CacheHeader header;
+        if (file_size < static_cast<std::streamoff>(sizeof(header)) || !is.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            return false;
+        }
+        if (header.magic != kCacheMagic || header.size == 0 || file_size != static_cast<std::streamoff>(sizeof(header) + header.size)) {
+            return false;
+        }
+        binary.resize(header.size);
+        if (!is.read(binary.data(), binary.size())) {
+            return false;
+        }
+        format = header.format;
+        return true;
+    }
+
+    static bool WriteCacheFile(const std::string& path, GLenum format, const std::vector<char>& binary) {
+        std::ofstream os(path, std::ios::binary);
+        if (!os.is_open()) {
+            return false;
         }
-        glLinkProgram(program);
+        const CacheHeader header = { kCacheMagic, format, static_cast<uint32_t>(binary.size()) };
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        os.write(binary.data(), binary.size());
+        return os.good();
+    }
+
+    bool LoadBinary(const std::string& path, unsigned int& program) const {
 
+        GLenum format;
+        std::vector<char> binary;
+        if (!ReadCacheFile(path, format, binary)) {
+            return false;
+        }
+
+        program = glCreateProgram();
+        program_binary(program, format, binary.data(), static_cast<GLsizei>(binary.size()));
         int success;
-        char infoLog[512];
         glGetProgramiv(program, GL_LINK_STATUS, &success);
         if (!success) {
-            glGetProgramInfoLog(program, 512, NULL, infoLog);
-            std::cerr << "Error! Shader program linking failed: " << infoLog << std::endl;
+            // Typically a driver update: compile again
             glDeleteProgram(program);
+            return false;
         }
+        return true;
+    }
 
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-        if (geometry_file != nullptr) {
-            glDeleteShader(geometry);
+    void SaveBinary(const std::string& path, unsigned int program) const {
+
+        GLint length = 0;
+        glGetProgramiv(program, kProgramBinaryLength, &length);
+        if (length <= 0) {
+            return;
+        }
+        std::vector<char> binary(length);
+        GLsizei written = 0;
+        GLenum format;
+        get_program_binary(program, length, &written, &format, binary.data());
+        binary.resize(written);
+
+        std::error_code ec;
+        std::filesystem::create_directories(kShaderCacheRoot, ec);
+        if (!WriteCacheFile(path, format, binary)) {
+            std::cerr << "ShaderRegistry::SaveBinary: can't write \"" << path << "\"\n";
         }
+    }
+
+    // Compiles (or loads from the cache) all the given programs at once.
+    // Each program is a list of 2 or 3 files: vertex, fragment and optionally geometry
+    void Preload(const std::vector<std::vector<std::string>>& files) {
+
+        std::vector<Pending> pending;
+
+        for (const auto& program_files : files) {
+
+            const char* geometry_file = program_files.size() > 2 ? program_files[2].c_str() : nullptr;
+            std::string key = Key(program_files[0].c_str(), program_files[1].c_str(), geometry_file);
+            if (programs.count(key)) {
+                continue;
+            }
+
+            std::vector<std::string> sources(program_files.size());
+            bool ok = true;
+            for (size_t i = 0; i < program_files.size(); ++i) {
+                ok = ok && ReadShaderSource(program_files[i].c_str(), sources[i]);
+            }
+            if (!ok) {
+                programs.emplace(key, Entry{ static_cast<unsigned int>(-1), 0 });
+                continue;
+            }
+
+            // The cache entry depends on both the sources and the driver which produced the binary
+            std::string cache_path;
+            if (program_binary != nullptr) {
+                uint64_t hash = HashBytes(driver.data(), driver.size());
+                for (const auto& source : sources) {
+                    hash = HashBytes(source.data(), source.size(), hash);
+                }
+                char name[32];
+                snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(hash));
+                cache_path = (std::filesystem::path(kShaderCacheRoot) / std::filesystem::path(name)).string();
+
+                unsigned int program;
+                if (LoadBinary(cache_path, program)) {
+                    programs.emplace(key, Entry{ program, 0 });
+                    cache_hits++;
+                    continue;
+                }
+                cache_misses++;
+            }
+
+            Pending p;
+            p.key = std::move(key);
+            p.cache_path = std::move(cache_path);
+            p.program = glCreateProgram();
+            for (size_t i = 0; i < program_files.size(); ++i) {
+                unsigned int shader = CreateShaderFromSource(sources[i], DeduceShaderType(program_files[i].c_str()), false);
+                glAttachShader(p.program, shader);
+                p.shaders.push_back(shader);
+            }
+            if (program_parameteri != nullptr) {
+                program_parameteri(p.program, kProgramBinaryRetrievableHint, GL_TRUE);
+            }
+            glLinkProgram(p.program);
+            pending.push_back(std::move(p));
+        }
+
+        // Only now wait for the results
+        for (auto& p : pending) {
+
+            int success;
+            char infoLog[512];
+            glGetProgramiv(p.program, GL_LINK_STATUS, &success);
+            if (!success) {
+                for (unsigned int shader : p.shaders) {
+                    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+                    if (!success) {
+                        glGetShaderInfoLog(shader, 512, NULL, infoLog);
+                        std::cerr << "Error! Shader compilation failed (" << p.key << "): " << infoLog << std::endl;
+                    }
+                }
+                glGetProgramInfoLog(p.program, 512, NULL, infoLog);
+                std::cerr << "Error! Shader program linking failed (" << p.key << "): " << infoLog << std::endl;
+                glDeleteProgram(p.program);
+                p.program = -1;
+            }
+            else if (get_program_binary != nullptr) {
+                SaveBinary(p.cache_path, p.program);
+            }
+
+            for (unsigned int shader : p.shaders) {
+                if (p.program != static_cast<unsigned int>(-1)) {
+                    glDetachShader(p.program, shader);
+                }
+                glDeleteShader(shader);
+            }
+
+            programs.emplace(p.key, Entry{ p.program, 0 });
+        }
+    }
+
+    // Starts all the programs found in kShaderRoot, or in the asset pack (a .vert with a matching .frag)
+    void PreloadAll() {
+
+        PROFILE_SCOPE("ShaderRegistry::PreloadAll");
+        const std::vector<std::string> names = ListAssets(kShaderRoot);
+        std::vector<std::vector<std::string>> files;
+        for (const auto& name : names) {
+            const auto path = std::filesystem::path(name);
+            if (path.extension() == ".vert") {
+                auto fragment = path;
+                fragment.replace_extension(".frag");
+                if (std::binary_search(names.begin(), names.end(), fragment.string())) {
+                    files.push_back({ name, fragment.string() });
+                }
+            }
+        }
+        Preload(files);
+    }
+
+    unsigned int Acquire(const char* vertex_file, const char* fragment_file, const char* geometry_file) {
+
+        std::string key = Key(vertex_file, fragment_file, geometry_file);
+        auto it = programs.find(key);
+        if (it == programs.end()) {
+            std::vector<std::string> program_files = { vertex_file, fragment_file };
+            if (geometry_file != nullptr) {
+                program_files.push_back(geometry_file);
+            }
+            Preload({ program_files });
+            it = programs.find(key);
+        }
+        ++it->second.references;
+        return it->second.program;
+    }
+
+    // Programs are kept until Clear, so that they can be acquired again without compiling
+    void Release(unsigned int program) {
+        for (auto& x : programs) {
+            if (x.second.program == program) {
+                --x.second.references;
+                return;
+            }
+        }
+    }
+
+    // Must be called before the GL context is destroyed
+    void Clear() {
+        for (const auto& x : programs) {
+            if (x.second.program != static_cast<unsigned int>(-1)) {
+                render_state.DeleteProgram(x.second.program);
+            }
+        }
+        programs.clear();
+    }
+
+};
+
+static ShaderRegistry shader_registry;
+
+
+// Uniform location resolved once, typed with the value it accepts
+template <typename T>
+struct Uniform {
+    int location = -1;
+};
+
+struct Shader {
 
-        valid = true;
+    unsigned int program = -1;
+    bool valid = false;
+    std::vector<std::pair<std::string, int>> uniforms;   // Active uniforms, resolved at link time
+
+    Shader() {}
+
+    Shader(const char* vertex_file, const char* fragment_file, const char* geometry_file = nullptr) {
+
+        program = shader_registry.Acquire(vertex_file, fragment_file, geometry_file);
+        valid = program != static_cast<unsigned int>(-1);
+        if (valid) {
+            CacheUniforms();
+        }
     }
 
     Shader(const char* prefix, bool geometry = false) : Shader(
@@ -166,18 +522,19 @@ struct Shader {
         Release();
         program = other.program;
         valid = other.valid;
+        uniforms = std::move(other.uniforms);
         other.program = -1;     // TODO check this trick
         other.valid = false;
         return *this;
     }
 
     void use() const {
-        glUseProgram(program);
+        render_state.UseProgram(program);
     }
 
     void Release() {
         if (valid) {
-            glDeleteProgram(program);
+            shader_registry.Release(program);
             valid = false;
         }
     }
@@ -186,16 +543,73 @@ struct Shader {
         Release();
     }
 
+    void CacheUniforms() {
+        int count;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        uniforms.clear();
+        for (int i = 0; i < count; ++i) {
+            char name[64];
+            GLsizei length;
+            GLint size;
+            GLenum type;
+            glGetActiveUniform(program, i, sizeof(name), &length, &size, &type, name);
+            uniforms.emplace_back(name, glGetUniformLocation(program, name));
+        }
+    }
+
+    // Location of an active uniform, or -1 (ignored by glUniform*) if the program does not use it
+    int Location(const char* key) const {
+        for (const auto& x : uniforms) {
+            if (x.first == key) {
+                return x.second;
+            }
+        }
+        return -1;
+    }
+
+    template <typename T>
+    Uniform<T> GetUniform(const char* key) const {
+        return { Location(key) };
+    }
+
+    void Set(Uniform<glm::mat4> uniform, const glm::mat4& value) const {
+        glUniformMatrix4fv(uniform.location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+
+    void Set(Uniform<glm::vec3> uniform, const glm::vec3& value) const {
+        glUniform3fv(uniform.location, 1, glm::value_ptr(value));
+    }
+
+    void Set(Uniform<glm::vec4> uniform, const glm::vec4& value) const {
+        glUniform4fv(uniform.location, 1, glm::value_ptr(value));
+    }
+
+    void Set(Uniform<float> uniform, float value) const {
+        glUniform1f(uniform.location, value);
+    }
+
+    void Set(Uniform<int> uniform, int value) const {
+        glUniform1i(uniform.location, value);
+    }
+
     void SetMat4(const char* key, const glm::mat4& value) const {
-        glUniformMatrix4fv(glGetUniformLocation(program, key), 1, GL_FALSE, glm::value_ptr(value));
+        Set(GetUniform<glm::mat4>(key), value);
     }
 
     void SetVec3(const char* key, const glm::vec3& value) const {
-        glUniform3fv(glGetUniformLocation(program, key), 1, glm::value_ptr(value));
+        Set(GetUniform<glm::vec3>(key), value);
     }
 
     void SetFloat(const char* key, float value) const {
-        glUniform1f(glGetUniformLocation(program, key), value);
+        Set(GetUniform<float>(key), value);
+    }
+
+    void SetInt(const char* key, int value) const {
+        Set(GetUniform<int>(key), value);
+    }
+
+    void SetVec4(const char* key, const glm::vec4& value) const {
+        Set(GetUniform<glm::vec4>(key), value);
     }
 
 };
@@ -0,0 +1,1079 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_SIMULATION_H
+#define NIKMAN_SIMULATION_H
+
+#include <vector>
+#include <bitset>
+#include <limits>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <fstream>
+
+#include "common.h"
+#include "level.h"
+#include "slot.h"
+#include "navigation.h"
+#include "junction_graph.h"
+#include "counter_rng.h"
+#include "thread_pool.h"
+#include "profiler.h"
+
+// Game logic without rendering and audio: grid, players, ghosts, teleports, scoring.
+// It holds no global state, so that several simulations can live in one process.
+// What the game has to play or redraw is reported by Tick as a list of events.
+
+enum class PlayerName { Nik, Ste };
+enum class GhostColor { Red, Yellow, Blue, Purple, Gray, Brown, Green };
+enum class GhostMode { Chase, Scatter, Frightened, Home };
+
+// Initials of the colors that can be drawn, in GhostColor order
+static constexpr char* const kRosterInitials = "RYBPG";
+static constexpr char* const kDefaultRoster = "RYBP";
+
+// Ghosts of the given colors, by initial, repeated up to n ghosts (as many as the
+// initials if n is 0). Empty if an initial is unknown
+std::vector<GhostColor> MakeRoster(const char* colors, int n = 0) {
+    std::vector<GhostColor> roster;
+    const size_t length = strlen(colors);
+    if (length == 0) {
+        return roster;
+    }
+    if (n <= 0) {
+        n = static_cast<int>(length);
+    }
+    for (int i = 0; i < n; ++i) {
+        const char* initial = strchr(kRosterInitials, colors[i % length]);
+        if (initial == nullptr) {
+            std::cerr << "Error in MakeRoster: unknown ghost color '" << colors[i % length] << "'.\n";
+            return {};
+        }
+        roster.push_back(static_cast<GhostColor>(initial - kRosterInitials));
+    }
+    return roster;
+}
+
+struct PlayerState {
+    int x = 0;
+    int y = 0;
+    int next_x = 0;
+    int next_y = 0;
+    float precise_x = 0.f;
+    float precise_y = 0.f;
+    float last_x = 0.f;             // precise_x and precise_y before the last Tick
+    float last_y = 0.f;
+    float t = 0.f;
+    unsigned char direction = 0;
+    bool moving = false;
+    bool just_hit = false;
+    bool just_teleported = false;
+    float time_after_hit = 0.f;
+    bool armed = false;
+    bool weapon_vanishing = false;
+    float weapon_t = 0.f;
+    float weapon_duration = 0.f;
+
+    // Cell the player is mostly in, used as target by the ghosts
+    int Cell(int w) const {
+        return t < 0.5f ? y * w + x : next_y * w + next_x;
+    }
+};
+
+struct GhostState {
+    GhostColor color = GhostColor::Red;
+    GhostMode mode = GhostMode::Home;
+    int x = 4;
+    int y = 4;
+    int next_x = 3;
+    int next_y = 4;
+    float precise_x = 0.f;
+    float precise_y = 0.f;
+    float last_x = 0.f;             // precise_x and precise_y before the last Tick
+    float last_y = 0.f;
+    int home_x = 0;
+    int home_y = 0;
+    float t = 0.f;
+    float base_speed = 0.f;
+    float speed = 0.f;
+    unsigned char direction = 2;    // A
+    int target_x = 0;
+    int target_y = 0;
+    int scatter_x = 0;
+    int scatter_y = 0;
+    float state_t = 0.f;
+    bool just_teleported = false;
+    bool teleported = false;        // During the last move
+    CounterRng rng;
+};
+
+struct SimEvent {
+    enum class Type {
+        CrustEaten,         // index: player
+        WeaponGrabbed,      // index: player
+        WeaponExpired,      // index: player
+        Teleported,         // index: -1
+        PlayerCaught,       // index: ghost, which touched an unarmed player
+        GhostKilled,        // index: ghost
+        GameOver,
+        LevelCompleted,
+    };
+    Type type;
+    int index;
+};
+
+static constexpr char kSnapshotMagic[4] = { 'N', 'K', 'S', 'S' };
+static constexpr uint32_t kSnapshotVersion = 2;
+
+struct SimSnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    int32_t h;
+    int32_t w;
+    int32_t n_ghosts;
+    int32_t level_index;    // Must be the loaded one when restoring
+};
+static_assert(sizeof(SimSnapshotHeader) == 24, "SimSnapshotHeader must have no padding");
+
+// Binary image of the mutable state of a Simulation: a SimSnapshotHeader followed by
+// the pieces listed in Simulation::VisitState, as they are in memory. The buffer never
+// shrinks, so saving again into the same snapshot doesn't allocate.
+struct SimSnapshot {
+
+    std::vector<unsigned char> data;
+    size_t size = 0;    // Of the valid part of data, 0 if empty
+
+    bool Empty() const {
+        return size == 0;
+    }
+
+    int Level() const {
+        SimSnapshotHeader header;
+        memcpy(&header, data.data(), sizeof(header));
+        return header.level_index;
+    }
+
+    bool Write(const char* filename) const {
+        std::ofstream os(filename, std::ios::binary);
+        if (!os.is_open()) {
+            std::cerr << "Error in SimSnapshot::Write: can't open filename.\n";
+            return false;
+        }
+        os.write(reinterpret_cast<const char*>(data.data()), size);
+        return os.good();
+    }
+
+    bool Read(const char* filename) {
+        std::ifstream is(filename, std::ios::binary);
+        if (!is.is_open()) {
+            std::cerr << "Error in SimSnapshot::Read: can't open filename.\n";
+            return false;
+        }
+        is.seekg(0, std::ios::end);
+        const size_t file_size = is.tellg();
+        is.seekg(0, std::ios::beg);
+        if (file_size < sizeof(SimSnapshotHeader)) {
+            std::cerr << "Error in SimSnapshot::Read: invalid format.\n";
+            return false;
+        }
+        if (data.size() < file_size) {
+            data.resize(file_size);
+        }
+        is.read(reinterpret_cast<char*>(data.data()), file_size);
+        size = file_size;
+        return is.good();
+    }
+
+};
+
+struct Simulation {
+
+    enum class State { Playing, LevelCompleted, GameOver };
+
+    static constexpr int kStartingLives = 3;
+    static constexpr int kCrustScore = 1;
+    static constexpr int kWeaponScore = 5;
+    static constexpr int kKillScore = 10;
+    static constexpr int kLifePrice = 500;
+
+    static constexpr float kPlayerSpeed = 4.5f;
+    static constexpr float kHitRecoverTime = 2.0f;
+    static constexpr float kBaseWeaponDuration = 8.f;
+    static constexpr float kWeaponVanishingTime = 2.f;
+
+    static constexpr float kGhostSpeeds[5] = { 1.3f, 1.7f, 1.5f, 1.9f, 1.6f };
+    static constexpr float kScatterDuration = 0.f;
+    static constexpr float kChaseDuration = 10.f;
+    static constexpr float kFrightenedDuration = 5.f;
+    static constexpr float kHomeDuration = 4.f;
+
+    static constexpr int kGhostsPerTask = 64;
+
+    int h = 0;
+    int w = 0;
+    std::vector<Slot> grid;
+    std::vector<std::pair<int, int>> teleports;
+    int remaining_crusts = 0;
+
+    Navigation navigation;
+    JunctionGraph junctions;
+
+    PlayerState players[2];     // Indexed by PlayerName
+    std::vector<GhostState> ghosts;
+
+    bool two_players = false;
+    int lives = 0;
+    int score = 0;
+    int level_index = 0;
+    State state = State::Playing;
+
+    CounterRng rng;             // Crust angles, player teleports and the level_seed of each level
+    uint64_t level_seed = 0;
+
+    std::vector<SimEvent> events;       // Of the last Tick
+    std::vector<int> changed_cells;     // Crusts and weapons removed in the last Tick
+
+    ThreadPool* pool;
+
+    SimSnapshot level_start;    // Taken by LoadLevel, for RestartLevel
+
+    // Ghosts are moved on pool, if given
+    Simulation(const std::vector<GhostColor>& roster, ThreadPool* pool_ = nullptr) :
+        navigation(grid),
+        pool(pool_)
+    {
+        for (const auto color : roster) {
+            GhostState ghost;
+            ghost.color = color;
+            ghost.base_speed = kGhostSpeeds[static_cast<int>(color)] * 2.f;
+            ghosts.push_back(ghost);
+        }
+    }
+
+    void NewGame(bool two_players_, uint64_t seed) {
+        two_players = two_players_;
+        lives = kStartingLives;
+        score = 0;
+        rng = CounterRng(seed, 0);
+    }
+
+    void LoadLevel(const LevelDesc& level, int level_index_) {
+        PROFILE_SCOPE("Simulation::LoadLevel");
+        h = level.h;
+        w = level.w;
+        level_index = level_index_;
+        state = State::Playing;
+
+        grid.assign(level.cells.begin(), level.cells.end());
+        ClearSlots(grid, Slot::kDirection);     // Traces are left by the players, never by the level
+        remaining_crusts = static_cast<int>(CountSlots(grid, Slot::kCrust));
+        teleports = level.teleports;
+
+        navigation.LoadLevel(level);
+        junctions.LoadLevel(level);
+
+        LoadPlayer(players[0], level.nik_pos);
+        LoadPlayer(players[1], level.ste_pos);
+
+        level_seed = rng();
+        for (int i = 0; i < static_cast<int>(ghosts.size()); ++i) {
+            LoadGhost(ghosts[i], level, i);
+        }
+
+        events.clear();
+        changed_cells.clear();
+
+        Save(level_start);
+    }
+
+    // Back to the state right after LoadLevel, lives and score included
+    void RestartLevel() {
+        Restore(level_start);
+    }
+
+    // wasd is a bitmapped value containing the keys pressed
+    // 0  1  2  3  4   5     6     7
+    // W  A  S  D  Up  Left  Down  Right
+    // With a single player, Nik moves with both
+    void Tick(float delta, unsigned int wasd) {
+
+        PROFILE_SCOPE("Simulation::Tick");
+        events.clear();
+        changed_cells.clear();
+
+        if (state != State::Playing) {
+            return;
+        }
+
+        for (auto& player : players) {
+            player.last_x = player.precise_x;
+            player.last_y = player.precise_y;
+        }
+        for (auto& ghost : ghosts) {
+            ghost.last_x = ghost.precise_x;
+            ghost.last_y = ghost.precise_y;
+        }
+
+        PlayerState& nik = players[0];
+        PlayerState& ste = players[1];
+
+        int scoreDelta = 0;
+        unsigned int eaten = 0;
+        bool grabWeaponNik = false;
+        bool grabWeaponSte = false;
+
+        unsigned int wasdNik = wasd >> 4;
+        if (!two_players) {
+            wasdNik |= wasd;
+        }
+        UpdatePlayer(nik, 0, delta, wasdNik, ste, eaten, grabWeaponNik);
+        if (two_players) {
+            UpdatePlayer(ste, 1, delta, wasd, nik, eaten, grabWeaponSte);
+        }
+
+        navigation.Update(0, nik.Cell(w));
+        if (two_players) {
+            navigation.Update(1, ste.Cell(w));
+        }
+
+        scoreDelta += eaten * kCrustScore;
+        scoreDelta += (grabWeaponNik + grabWeaponSte) * kWeaponScore;
+
+        // Ghosts move in parallel, each with its own random stream, so the result
+        // doesn't depend on the number of threads. Then collisions are resolved in order
+        const float red_x = ghosts.empty() ? 0.f : ghosts[0].precise_x;
+        const float red_y = ghosts.empty() ? 0.f : ghosts[0].precise_y;
+        auto move = [&](int i) {
+            MoveGhost(ghosts[i], delta, red_x, red_y);
+        };
+        {
+            PROFILE_SCOPE("Simulation::MoveGhosts");
+            if (pool != nullptr) {
+                pool->ParallelFor(static_cast<int>(ghosts.size()), move, kGhostsPerTask);
+            }
+            else {
+                for (int i = 0; i < static_cast<int>(ghosts.size()); ++i) {
+                    move(i);
+                }
+            }
+        }
+
+        bool hitNik = false;
+        bool hitSte = false;
+        for (int i = 0; i < static_cast<int>(ghosts.size()); ++i) {
+            GhostState& ghost = ghosts[i];
+            if (ghost.teleported) {
+                events.push_back({ SimEvent::Type::Teleported, -1 });
+            }
+            bool collisionNik = false;
+            bool collisionSte = false;
+            CollideGhost(ghost, i, collisionNik, collisionSte);
+            if (collisionNik) {
+                if (nik.armed) {
+                    KillGhost(ghost);
+                    scoreDelta += kKillScore;
+                    events.push_back({ SimEvent::Type::GhostKilled, i });
+                }
+                else {
+                    hitNik = true;
+                }
+            }
+
+            if (two_players && collisionSte) {
+                if (ste.armed) {
+                    KillGhost(ghost);
+                    scoreDelta += kKillScore;
+                    events.push_back({ SimEvent::Type::GhostKilled, i });
+                }
+                else {
+                    hitSte = true;
+                }
+            }
+        }
+
+        if (hitNik && !nik.just_hit) {
+            nik.just_hit = true;
+            nik.time_after_hit = 0;
+            lives--;
+        }
+
+        if (hitSte && !ste.just_hit) {
+            ste.just_hit = true;
+            ste.time_after_hit = 0;
+            lives--;
+        }
+
+        if ((hitNik || hitSte) && lives <= 0) {
+            // Game over :(
+            state = State::GameOver;
+            events.push_back({ SimEvent::Type::GameOver, -1 });
+        }
+
+        remaining_crusts -= eaten;
+        if (remaining_crusts <= 0) {
+            state = State::LevelCompleted;
+            events.push_back({ SimEvent::Type::LevelCompleted, -1 });
+        }
+
+        if (grabWeaponNik) {
+            GrabWeapon(nik);
+            events.push_back({ SimEvent::Type::WeaponGrabbed, 0 });
+            for (auto& ghost : ghosts) {
+                FrightenGhost(ghost);
+            }
+        }
+
+        if (grabWeaponSte) {
+            GrabWeapon(ste);
+            events.push_back({ SimEvent::Type::WeaponGrabbed, 1 });
+            for (auto& ghost : ghosts) {
+                FrightenGhost(ghost);
+            }
+        }
+
+        if (scoreDelta) {
+            if ((score + scoreDelta) / kLifePrice > score / kLifePrice) {
+                lives++;
+            }
+            score += scoreDelta;
+        }
+    }
+
+    // Moves (x, y) to another random teleport
+    void TeleportDestination(int& x, int& y, CounterRng& rng) const {
+        while (true) {
+            const uint32_t random_index = rng.Below(static_cast<uint32_t>(teleports.size()));
+            const auto& pos = teleports[random_index];
+            if (pos.first != x || pos.second != y) {
+                x = pos.first;
+                y = pos.second;
+                break;
+            }
+        }
+    }
+
+    // Players
+
+    void LoadPlayer(PlayerState& player, std::pair<int, int> pos) {
+        player.x = pos.first;
+        player.y = pos.second;
+        player.precise_x = player.x;
+        player.precise_y = player.y;
+        player.last_x = player.x;
+        player.last_y = player.y;
+        player.next_x = player.x;
+        player.next_y = player.y;
+        player.t = 0;
+        player.moving = false;
+        player.just_hit = false;
+        player.just_teleported = false;
+        player.armed = false;
+        player.weapon_duration = kBaseWeaponDuration - kBaseWeaponDuration * level_index / 40.f;
+    }
+
+    void FindNext(PlayerState& player, unsigned char wasd) const {
+
+        const int x = player.x;
+        const int y = player.y;
+        unsigned char walls = grid[y * w + x].Walls();
+
+        if ((wasd & 1) && !(walls & 1) && !grid[(y + 1) * w + x].Home()) {
+            player.next_x = x;
+            player.next_y = y + 1;
+            player.direction = 1;
+            player.moving = true;
+        }
+        else if ((wasd & 2) && !(walls & 2) && !grid[y * w + (x - 1)].Home()) {
+            player.next_x = x - 1;
+            player.next_y = y;
+            player.direction = 2;
+            player.moving = true;
+        }
+        else if ((wasd & 4) && !(walls & 4) && !grid[(y - 1) * w + x].Home()) {
+            player.next_x = x;
+            player.next_y = y - 1;
+            player.direction = 4;
+            player.moving = true;
+        }
+        else if ((wasd & 8) && !(walls & 8) && !grid[y * w + (x + 1)].Home()) {
+            player.next_x = x + 1;
+            player.next_y = y;
+            player.direction = 8;
+            player.moving = true;
+        }
+        else {
+            player.moving = false;
+        }
+    }
+
+    void GrabWeapon(PlayerState& player) {
+        player.weapon_t = 0;
+        player.weapon_vanishing = false;
+        player.armed = true;
+    }
+
+    void EatCell(int index, int cell, unsigned int& eaten, bool& weapon) {
+        if (grid[cell].Crust()) {
+            ++eaten;
+            grid[cell].RemoveCrust();
+            changed_cells.push_back(cell);
+            events.push_back({ SimEvent::Type::CrustEaten, index });
+        }
+        if (grid[cell].Weapon()) {
+            weapon = true;
+            grid[cell].RemoveWeapon();
+            changed_cells.push_back(cell);
+        }
+    }
+
+    void UpdatePlayer(PlayerState& player, int index, float delta, unsigned int wasd, const PlayerState& other, unsigned int& eaten, bool& weapon) {
+
+        PROFILE_SCOPE("Simulation::UpdatePlayer");
+
+        // Update weapon
+        if (player.armed) {
+            player.weapon_t += delta;
+            if (player.weapon_t > player.weapon_duration) {
+                player.armed = false;
+                events.push_back({ SimEvent::Type::WeaponExpired, index });
+            }
+            else if (!player.weapon_vanishing && (player.weapon_duration - player.weapon_t < kWeaponVanishingTime)) {
+                player.weapon_vanishing = true;
+            }
+        }
+
+        if (player.just_hit) {
+            player.time_after_hit += delta;
+            if (player.time_after_hit > kHitRecoverTime) {
+                player.just_hit = false;
+            }
+        }
+
+        unsigned char& direction = player.direction;
+        if (player.moving) {
+            if (((direction >> 2) | ((direction << 2) & 15)) & wasd) {
+                direction = ((direction >> 2) | ((direction << 2) & 15));
+                std::swap(player.x, player.next_x);
+                std::swap(player.y, player.next_y);
+                player.t = 1.f - player.t;
+                grid[player.y * w + player.x].SetDirection(direction);
+            }
+
+            constexpr float otherDistMin = 0.5f;
+            const float dx = player.precise_x - other.precise_x;
+            const float dy = player.precise_y - other.precise_y;
+            if (two_players &&
+                dx * dx + dy * dy < otherDistMin &&
+                ((direction == 1 && other.precise_y > player.precise_y) ||
+                    (direction == 2 && other.precise_x < player.precise_x) ||
+                    (direction == 4 && other.precise_y < player.precise_y) ||
+                    (direction == 8 && other.precise_x > player.precise_x))
+                ) {
+            }
+            else {
+                player.t += delta * kPlayerSpeed;
+            }
+            if (player.t >= 1.f) {
+                player.x = player.next_x;
+                player.y = player.next_y;
+                if (grid[player.y * w + player.x].Teleport() && !player.just_teleported) {
+                    TeleportDestination(player.x, player.y, rng);
+                    events.push_back({ SimEvent::Type::Teleported, -1 });
+                    player.next_x = player.x;
+                    player.next_y = player.y;
+                    player.just_teleported = true;
+                }
+                else {
+                    player.just_teleported = false;
+                }
+                player.t -= 1.f;
+                FindNext(player, wasd);
+                grid[player.y * w + player.x].SetDirection(direction);
+            }
+        }
+        else {
+            player.t = 0.f;
+            FindNext(player, wasd);
+            grid[player.y * w + player.x].SetDirection(direction);
+        }
+
+        player.precise_x = (player.x * (1 - player.t) + player.next_x * player.t);
+        player.precise_y = (player.y * (1 - player.t) + player.next_y * player.t);
+
+        // Eat crusts, pick up weapons
+        float dist_threshold = 0.2f;
+        if (player.t < dist_threshold) {
+            EatCell(index, player.y * w + player.x, eaten, weapon);
+        }
+        if (player.t > 1 - dist_threshold) {
+            EatCell(index, player.next_y * w + player.next_x, eaten, weapon);
+        }
+    }
+
+    // Ghosts
+
+    void LoadGhost(GhostState& ghost, const LevelDesc& level, int index) {
+        ghost.rng = CounterRng(level_seed, index);
+        ghost.home_x = level.home.front().first;
+        ghost.home_y = level.home.front().second;
+        ghost.x = ghost.home_x;
+        ghost.y = ghost.home_y;
+        ghost.next_x = ghost.x;
+        ghost.next_y = ghost.y;
+        ghost.precise_x = ghost.x;
+        ghost.precise_y = ghost.y;
+        ghost.last_x = ghost.x;
+        ghost.last_y = ghost.y;
+        ghost.t = 0;
+        ghost.mode = GhostMode::Home;
+        ghost.just_teleported = false;
+        ghost.teleported = false;
+        if (ghost.color == GhostColor::Red) {
+            ghost.scatter_x = -1;
+            ghost.scatter_y = -1;
+        }
+        else if (ghost.color == GhostColor::Yellow) {
+            ghost.scatter_x = w;
+            ghost.scatter_y = -1;
+        }
+        else if (ghost.color == GhostColor::Blue) {
+            ghost.scatter_x = -1;
+            ghost.scatter_y = h;
+        }
+        else if (ghost.color == GhostColor::Purple) {
+            ghost.scatter_x = w;
+            ghost.scatter_y = h;
+        }
+        ghost.target_x = ghost.scatter_x;
+        ghost.target_y = ghost.scatter_y;
+        ghost.state_t = 0;
+        ghost.speed = ghost.base_speed + ghost.base_speed * level_index / 40.f;   // magic number
+    }
+
+    static void DirToNext(const GhostState& ghost, unsigned char direction, int& next_x_ref, int& next_y_ref) {
+        if (direction & 1) {
+            next_x_ref = ghost.x;
+            next_y_ref = ghost.y + 1;
+        }
+        else if (direction & 2) {
+            next_x_ref = ghost.x - 1;
+            next_y_ref = ghost.y;
+        }
+        else if (direction & 4) {
+            next_x_ref = ghost.x;
+            next_y_ref = ghost.y - 1;
+        }
+        else {
+            next_x_ref = ghost.x + 1;
+            next_y_ref = ghost.y;
+        }
+    }
+
+    // Update current direction based on target tile
+    static void TargetTileDirection(GhostState& ghost, unsigned char possible_dirs) {
+
+        float min_dist = std::numeric_limits<float>::max();
+        unsigned char min_direction = 16;
+
+        for (unsigned char i = 1; i < 16; i <<= 1) {
+            if (possible_dirs & i) {
+                int next_x, next_y;
+                DirToNext(ghost, i, next_x, next_y);
+                const float dist = (next_x - ghost.target_x) * (next_x - ghost.target_x) + (next_y - ghost.target_y) * (next_y - ghost.target_y);
+                if (dist < min_dist) {
+                    min_dist = dist;
+                    min_direction = i;
+                }
+            }
+        }
+
+        ghost.direction = min_direction;
+    }
+
+    // Follow the shortest path to the nearest player. The straight-line distance
+    // breaks ties, and is all that is left when no player can be reached
+    void ApproachNearest(GhostState& ghost, unsigned char possible_dirs_without_back) const {
+        int min_path = Navigation::kUnreachable;
+        float min_dist = std::numeric_limits<float>::max();
+        unsigned char min_direction = 16;
+
+        for (unsigned char i = 1; i < 16; i <<= 1) {
+            if (possible_dirs_without_back & i) {
+                int next_x, next_y;
+                DirToNext(ghost, i, next_x, next_y);
+                for (int p = 0; p < (two_players ? 2 : 1); ++p) {
+                    const PlayerState& player = players[p];
+                    const int path = navigation.Distance(p, next_x, next_y);
+                    const float dist = (next_x - player.precise_x) * (next_x - player.precise_x) + (next_y - player.precise_y) * (next_y - player.precise_y);
+                    if (path < min_path || (path == min_path && dist < min_dist)) {
+                        min_path = path;
+                        min_dist = dist;
+                        min_direction = i;
+                    }
+                }
+            }
+        }
+
+        ghost.direction = min_direction;
+    }
+
+    // Update current direction with a random one
+    static void RandomDirection(GhostState& ghost, unsigned char possible_dirs_without_back, unsigned char n_dirs) {
+        int random_int = static_cast<int>(ghost.rng.Below(n_dirs));
+
+        int i;
+        for (i = 0; i < 4; ++i) {
+            if (!(possible_dirs_without_back & (1 << i))) {
+                continue;
+            }
+            if (random_int == 0) {
+                break;
+            }
+            random_int--;
+        }
+
+        ghost.direction = (1 << i);
+    }
+
+    void SetNewDir(GhostState& ghost, float player_x, float player_y, unsigned char player_dir, float red_x, float red_y) const {
+
+        const int x = ghost.x;
+        const int y = ghost.y;
+        const unsigned char walls = grid[y * w + x].Walls();
+
+        unsigned char possible_dirs = ~walls & 15;
+
+        const unsigned char backward_dir = (ghost.direction >> 2) | ((ghost.direction << 2) & 15);
+
+        if (ghost.mode == GhostMode::Home) {
+            // Remove directions outside of home
+            if ((possible_dirs & 1) && !grid[(y + 1) * w + x].Home())
+                possible_dirs &= ~1;
+            if ((possible_dirs & 2) && !grid[y * w + x - 1].Home())
+                possible_dirs &= ~2;
+            if ((possible_dirs & 4) && !grid[(y - 1) * w + x].Home())
+                possible_dirs &= ~4;
+            if ((possible_dirs & 8) && !grid[y * w + x + 1].Home())
+                possible_dirs &= ~8;
+        }
+
+        const unsigned char possible_dirs_without_back = possible_dirs & ~backward_dir;
+        if (possible_dirs_without_back == 0) {
+            ghost.direction = backward_dir;
+            return;
+        }
+
+        const int n_dirs = std::bitset<8>(possible_dirs_without_back).count();
+        if (n_dirs == 1) {
+            ghost.direction = possible_dirs_without_back;
+        }
+        else if (ghost.mode == GhostMode::Frightened || ghost.mode == GhostMode::Home) {
+            RandomDirection(ghost, possible_dirs_without_back, n_dirs);
+        }
+        else if (ghost.mode == GhostMode::Scatter) {
+            // Approach scatter tile
+            TargetTileDirection(ghost, possible_dirs_without_back);
+        }
+        else if (ghost.mode == GhostMode::Chase) {
+            // Determine target tile and approach it
+
+            if (ghost.color == GhostColor::Yellow) {
+                unsigned char player_trace = grid[y * w + x].Direction();
+                if (player_trace & possible_dirs_without_back) {
+                    ghost.direction = player_trace & possible_dirs_without_back;
+                }
+                else {
+                    RandomDirection(ghost, possible_dirs_without_back, n_dirs);
+                }
+                return;
+            }
+            else if (ghost.color == GhostColor::Blue) {
+                unsigned char player_trace = grid[y * w + x].Direction();
+                if (player_trace & possible_dirs_without_back) {
+                    ghost.direction = player_trace & possible_dirs_without_back;
+                }
+                else {
+                    ApproachNearest(ghost, possible_dirs_without_back);
+                }
+                return;
+            }
+            else if (ghost.color == GhostColor::Purple) {
+                RandomDirection(ghost, possible_dirs_without_back, n_dirs);
+                return;
+            }
+            else if (ghost.color == GhostColor::Red) {
+                ApproachNearest(ghost, possible_dirs_without_back);
+                return;
+            }
+            else if (ghost.color == GhostColor::Brown) {
+                // Legacy
+                if (player_dir & 1) {
+                    ghost.target_x = player_x;
+                    ghost.target_y = player_y + 4;
+                }
+                else if (player_dir & 2) {
+                    ghost.target_x = player_x - 4;
+                    ghost.target_y = player_y;
+                }
+                else if (player_dir & 4) {
+                    ghost.target_x = player_x;
+                    ghost.target_y = player_y - 4;
+                }
+                else {
+                    ghost.target_x = player_x + 4;
+                    ghost.target_y = player_y;
+                }
+            }
+            else if (ghost.color == GhostColor::Gray) {
+                // Legacy
+                int player_front_two_x, player_front_two_y;
+                if (player_dir & 1) {
+                    player_front_two_x = player_x;
+                    player_front_two_y = player_y + 2;
+                }
+                else if (player_dir & 2) {
+                    player_front_two_x = player_x - 2;
+                    player_front_two_y = player_y;
+                }
+                else if (player_dir & 4) {
+                    player_front_two_x = player_x;
+                    player_front_two_y = player_y - 2;
+                }
+                else {
+                    player_front_two_x = player_x + 2;
+                    player_front_two_y = player_y;
+                }
+                // Double the vector from red to the position two tiles in front of the player
+                ghost.target_x = 2 * player_front_two_x - red_x;
+                ghost.target_y = 2 * player_front_two_y - red_y;
+            }
+            else if (ghost.color == GhostColor::Green) {
+                // Legacy
+                const float dist = (ghost.precise_x - player_x) * (ghost.precise_x - player_x) + (ghost.precise_y - player_y) * (ghost.precise_y - player_y);
+                if (dist > 6.f) { // TODO remove magic number
+                    ghost.target_x = player_x;
+                    ghost.target_y = player_y;
+                }
+                else {
+                    ghost.target_x = ghost.scatter_x;
+                    ghost.target_y = ghost.scatter_y;
+                }
+            }
+
+            TargetTileDirection(ghost, possible_dirs_without_back);
+        }
+    }
+
+    // Touches only ghost, so that all of them can move in parallel
+    void MoveGhost(GhostState& ghost, float delta, float red_x, float red_y) const {
+
+        ghost.teleported = false;
+        ghost.state_t += delta;
+        if (ghost.mode == GhostMode::Scatter) {
+            if (ghost.state_t >= kScatterDuration) {
+                ghost.mode = GhostMode::Chase;
+                ghost.state_t = 0;
+            }
+        }
+        else if (ghost.mode == GhostMode::Frightened) {
+            if (ghost.state_t >= kFrightenedDuration) {
+                ghost.mode = GhostMode::Chase;
+                ghost.state_t = 0;
+            }
+        }
+        else if (ghost.mode == GhostMode::Home) {
+            if (ghost.state_t >= kHomeDuration) {
+                ghost.mode = GhostMode::Chase;
+                ghost.state_t = 0;
+            }
+        }
+        // Chase lasts forever: scatter mode does not exist anymore
+
+        ghost.t += delta * ghost.speed;
+        if (ghost.t >= 1.f) {
+            ghost.x = ghost.next_x;
+            ghost.y = ghost.next_y;
+            if (grid[ghost.y * w + ghost.x].Teleport() && !ghost.just_teleported) {
+                TeleportDestination(ghost.x, ghost.y, ghost.rng);
+                ghost.next_x = ghost.x;
+                ghost.next_y = ghost.y;
+                ghost.just_teleported = true;
+                ghost.teleported = true;
+            }
+            else {
+                ghost.just_teleported = false;
+            }
+            ghost.t -= 1.f;
+            // Corridors leave no choice, except at home where the exits are closed
+            const unsigned char forced_dir = ghost.mode != GhostMode::Home ? junctions.Forced(ghost.y * w + ghost.x, ghost.direction) : 0;
+            if (forced_dir) {
+                ghost.direction = forced_dir;
+            }
+            else {
+                const PlayerState& nik = players[0];
+                SetNewDir(ghost, nik.precise_x, nik.precise_y, nik.direction, red_x, red_y);
+            }
+            DirToNext(ghost, ghost.direction, ghost.next_x, ghost.next_y);
+        }
+
+        ghost.precise_x = ghost.x * (1 - ghost.t) + ghost.next_x * ghost.t;
+        ghost.precise_y = ghost.y * (1 - ghost.t) + ghost.next_y * ghost.t;
+    }
+
+    void CollideGhost(const GhostState& ghost, int index, bool& hitNik, bool& hitSte) {
+
+        constexpr float threshold = 0.1;
+        for (int p = 0; p < (two_players ? 2 : 1); ++p) {
+            const PlayerState& player = players[p];
+            const float squaredDist = (ghost.precise_x - player.precise_x) * (ghost.precise_x - player.precise_x) + (ghost.precise_y - player.precise_y) * (ghost.precise_y - player.precise_y);
+            if (squaredDist < threshold) {
+                (p == 0 ? hitNik : hitSte) = true;
+                if (!player.armed && !player.just_hit) {
+                    events.push_back({ SimEvent::Type::PlayerCaught, index });
+                }
+            }
+        }
+    }
+
+    static void KillGhost(GhostState& ghost) {
+        ghost.x = ghost.home_x;
+        ghost.y = ghost.home_y;
+        ghost.next_x = ghost.x;
+        ghost.next_y = ghost.y;
+        ghost.mode = GhostMode::Home;
+        ghost.state_t = 0;
+    }
+
+    static void FrightenGhost(GhostState& ghost) {
+        ghost.mode = GhostMode::Frightened;
+        ghost.state_t = 0;
+        std::swap(ghost.x, ghost.next_x);
+        std::swap(ghost.y, ghost.next_y);
+        ghost.direction = ((ghost.direction >> 2) | ((ghost.direction << 2) & 15));
+        ghost.t = 1 - ghost.t;
+    }
+
+    // Calls visit(pointer, size) on every piece of mutable state. What is left out
+    // (walls, teleports, navigation) depends only on the level
+    template <typename Visitor>
+    void VisitState(Visitor&& visit) {
+        visit(&remaining_crusts, sizeof(remaining_crusts));
+        visit(&two_players, sizeof(two_players));
+        visit(&lives, sizeof(lives));
+        visit(&score, sizeof(score));
+        visit(&level_index, sizeof(level_index));
+        visit(&state, sizeof(state));
+        visit(&rng, sizeof(rng));
+        visit(&level_seed, sizeof(level_seed));
+        visit(grid.data(), grid.size() * sizeof(Slot));
+        visit(players, sizeof(players));
+        visit(ghosts.data(), ghosts.size() * sizeof(GhostState));
+    }
+
+    size_t SnapshotSize() const {
+        size_t size = sizeof(SimSnapshotHeader);
+        const_cast<Simulation*>(this)->VisitState([&](const void*, size_t piece_size) { size += piece_size; });
+        return size;
+    }
+
+    void Save(SimSnapshot& snapshot) const {
+
+        snapshot.size = SnapshotSize();
+        if (snapshot.data.size() < snapshot.size) {
+            snapshot.data.resize(snapshot.size);
+        }
+
+        SimSnapshotHeader header;
+        memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+        header.version = kSnapshotVersion;
+        header.h = h;
+        header.w = w;
+        header.n_ghosts = static_cast<int32_t>(ghosts.size());
+        header.level_index = level_index;
+
+        unsigned char* p = snapshot.data.data();
+        memcpy(p, &header, sizeof(header));
+        p += sizeof(header);
+        const_cast<Simulation*>(this)->VisitState([&](const void* data, size_t size) {
+            memcpy(p, data, size);
+            p += size;
+        });
+    }
+
+    // The level of the snapshot must be loaded. Fails without touching the state if
+    // the snapshot doesn't match it
+    bool Restore(const SimSnapshot& snapshot) {
+
+        if (snapshot.size != SnapshotSize()) {
+            std::cerr << "Error in Simulation::Restore: invalid size.\n";
+            return false;
+        }
+
+        SimSnapshotHeader header;
+        memcpy(&header, snapshot.data.data(), sizeof(header));
+        if (memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0 || header.version != kSnapshotVersion) {
+            std::cerr << "Error in Simulation::Restore: invalid format.\n";
+            return false;
+        }
+        if (header.h != h || header.w != w || header.n_ghosts != static_cast<int32_t>(ghosts.size()) || header.level_index != level_index) {
+            std::cerr << "Error in Simulation::Restore: snapshot of a different level.\n";
+            return false;
+        }
+
+        const unsigned char* p = snapshot.data.data() + sizeof(header);
+        VisitState([&](void* data, size_t size) {
+            memcpy(data, p, size);
+            p += size;
+        });
+        events.clear();
+        changed_cells.clear();
+        return true;
+    }
+
+    // Hash of the whole state, to compare runs
+    uint64_t Checksum() const {
+        uint64_t hash = HashBytes(&score, sizeof(score));
+        hash = HashBytes(&lives, sizeof(lives), hash);
+        hash = HashBytes(&remaining_crusts, sizeof(remaining_crusts), hash);
+        hash = HashBytes(&rng.counter, sizeof(rng.counter), hash);
+        hash = HashBytes(grid.data(), grid.size() * sizeof(Slot), hash);
+        for (const auto& player : players) {
+            hash = HashBytes(&player.precise_x, sizeof(float), hash);
+            hash = HashBytes(&player.precise_y, sizeof(float), hash);
+        }
+        for (const auto& ghost : ghosts) {
+            hash = HashBytes(&ghost.precise_x, sizeof(float), hash);
+            hash = HashBytes(&ghost.precise_y, sizeof(float), hash);
+            hash = HashBytes(&ghost.mode, sizeof(ghost.mode), hash);
+        }
+        return hash;
+    }
+
+    Simulation(const Simulation& other) = delete;
+    Simulation(Simulation&& other) = delete;
+    Simulation& operator=(const Simulation& other) = delete;
+    Simulation& operator=(Simulation&& other) = delete;
+
+};
+
+#endif // NIKMAN_SIMULATION_H
@@ -0,0 +1,162 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#if !defined NIKMAN_SLOT_H
+#define NIKMAN_SLOT_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// The flags of a cell, the grid is a dense plane of these. What is only needed to
+// draw a cell (the angle of its crust) is not stored, see CrustAngle
+struct Slot {
+
+    static constexpr uint16_t kWalls = 15;          // w a s d
+    static constexpr uint16_t kCrust = 16;
+    static constexpr uint16_t kWeapon = 32;
+    static constexpr uint16_t kHome = 64;
+    static constexpr uint16_t kTeleport = 128;
+    static constexpr uint16_t kDirection = 256 + 512 + 1024 + 2048;
+    static constexpr uint16_t kMud = 4096;
+
+    // Default data is just a crust
+    uint16_t data = kCrust;    // wasd walls 0 1 2 3 crust 4 weapon 5 home 6 teleport 7 dir 8 9 10 11 mud 12
+
+    constexpr unsigned char Walls() const {
+        return data & kWalls;
+    }
+
+    constexpr bool Crust() const {
+        return data & kCrust;
+    }
+
+    constexpr bool Weapon() const {
+        return data & kWeapon;
+    }
+
+    constexpr bool Home() const {
+        return data & kHome;
+    }
+
+    constexpr bool Teleport() const {
+        return data & kTeleport;
+    }
+
+    constexpr unsigned char Direction() const {
+        return (data & kDirection) >> 8;
+    }
+
+    constexpr bool Mud() const {
+        return data & kMud;
+    }
+
+    constexpr void SetCrust() {
+        data |= kCrust;
+    }
+
+    constexpr void RemoveCrust() {
+        data &= ~kCrust;
+    }
+
+    constexpr void SetWeapon() {
+        data |= kWeapon;
+    }
+
+    constexpr void RemoveWeapon() {
+        data &= ~kWeapon;
+    }
+
+    constexpr void SetHome() {
+        data |= kHome;
+    }
+
+    constexpr void RemoveHome() {
+        data &= ~kHome;
+    }
+
+    constexpr void SetTeleport() {
+        data |= kTeleport;
+    }
+
+    constexpr void RemoveTeleport() {
+        data &= ~kTeleport;
+    }
+
+    constexpr void SetMud() {
+        data |= kMud;
+    }
+
+    // dir is a 4-bit value: w a s d
+    constexpr void SetDirection(unsigned char dir) {
+        data = (data & ~kDirection) | (dir << 8);
+    }
+
+    constexpr Slot() {}
+    constexpr Slot(uint16_t data_) : data(data_) {}
+};
+
+static_assert(sizeof(Slot) == 2, "The grid is uploaded and saved as it is, one uint16_t per cell");
+
+// Grid-wide operations, on four cells at a time: mask is spread over a 64-bit word.
+// Slot is not trivial (a default cell has a crust), so the words are copied from and
+// to the uint16_t of the cells, which are contiguous
+
+constexpr uint64_t SlotMask4(uint16_t mask) {
+    return mask * 0x0001000100010001ull;
+}
+
+// Cells of grid with any of the bits of mask set
+size_t CountSlots(const std::vector<Slot>& grid, uint16_t mask) {
+    const uint64_t mask4 = SlotMask4(mask);
+    const size_t n4 = grid.size() / 4;
+    size_t count = 0;
+    for (size_t i = 0; i < n4; ++i) {
+        uint64_t word;
+        memcpy(&word, &grid[i * 4].data, sizeof(word));
+        word &= mask4;
+        // The top bit of each cell is set if any of its bits is, without carries
+        // between cells, then the four top bits are added by the multiplication
+        word = (((word & SlotMask4(0x7FFF)) + SlotMask4(0x7FFF)) | word) & SlotMask4(0x8000);
+        count += ((word >> 15) * SlotMask4(1)) >> 48;
+    }
+    for (size_t i = n4 * 4; i < grid.size(); ++i) {
+        count += (grid[i].data & mask) != 0;
+    }
+    return count;
+}
+
+// Clears the bits of mask in every cell
+void ClearSlots(std::vector<Slot>& grid, uint16_t mask) {
+    const uint64_t keep4 = ~SlotMask4(mask);
+    const size_t n4 = grid.size() / 4;
+    for (size_t i = 0; i < n4; ++i) {
+        uint64_t word;
+        memcpy(&word, &grid[i * 4].data, sizeof(word));
+        word &= keep4;
+        memcpy(&grid[i * 4].data, &word, sizeof(word));
+    }
+    for (size_t i = n4 * 4; i < grid.size(); ++i) {
+        grid[i].data &= ~mask;
+    }
+}
+
+#endif // NIKMAN_SLOT_H
@@ -0,0 +1,131 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_SPRITE_BATCH_H
+#define NIKMAN_SPRITE_BATCH_H
+
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "shader.h"
+#include "utility.h"
+#include "profiler.h"
+
+// Collects the dynamic sprites taken from the atlas (players, held weapons, ghosts)
+// into a single streamed vertex buffer, drawn with one call per frame.
+struct SpriteBatch {
+
+    // xy-pos, xy-tex, shiftX, alpha
+    static constexpr int kFloatsPerVertex = 6;
+    static constexpr int kFloatsPerSprite = kFloatsPerVertex * 6;
+
+    unsigned int VBO;
+    unsigned int VAO;
+    Shader shader;
+    std::vector<float> vertices;
+    size_t buffer_size = 0;     // In bytes
+
+    SpriteBatch(int reserved_sprites = 512) : shader("sprite") {
+
+        vertices.reserve(reserved_sprites * kFloatsPerSprite);
+
+        glGenVertexArrays(1, &VAO);
+        render_state.BindVertexArray(VAO);
+
+        glGenBuffers(1, &VBO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        buffer_size = vertices.capacity() * sizeof(float);
+        glBufferData(GL_ARRAY_BUFFER, buffer_size, nullptr, GL_STREAM_DRAW);
+
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, kFloatsPerVertex * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, kFloatsPerVertex * sizeof(float), (void*)(sizeof(float) * 2));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, kFloatsPerVertex * sizeof(float), (void*)(sizeof(float) * 4));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, kFloatsPerVertex * sizeof(float), (void*)(sizeof(float) * 5));
+        glEnableVertexAttribArray(3);
+
+        shader.use();
+        shader.SetMat4("projection", kProjection);
+
+    }
+
+    ~SpriteBatch() {
+        glDeleteBuffers(1, &VBO);
+        render_state.DeleteVertexArray(VAO);
+    }
+
+    // (x, y) is the center of the sprite in world coordinates
+    // Point a and Point b are the South-West and North-East corners in the texture atlas
+    void Add(float x, float y, float width, float height, Point a, Point b, float shiftX = 0.f, float alpha = 1.f) {
+
+        const float l = x - width / 2;
+        const float r = x + width / 2;
+        const float d = y - height / 2;
+        const float u = y + height / 2;
+
+        const float sprite[kFloatsPerSprite] = {
+            // xy-pos   // xy-tex   // shift  // alpha
+            l, u,       a.x, b.y,   shiftX,   alpha,
+            l, d,       a.x, a.y,   shiftX,   alpha,
+            r, u,       b.x, b.y,   shiftX,   alpha,
+            l, d,       a.x, a.y,   shiftX,   alpha,
+            r, d,       b.x, a.y,   shiftX,   alpha,
+            r, u,       b.x, b.y,   shiftX,   alpha,
+        };
+        vertices.insert(vertices.end(), sprite, sprite + kFloatsPerSprite);
+    }
+
+    void Flush() {
+
+        if (vertices.empty()) {
+            return;
+        }
+        PROFILE_SCOPE("SpriteBatch::Flush");
+
+        render_state.BindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        const size_t size = vertices.size() * sizeof(float);
+        if (size > buffer_size) {
+            buffer_size = vertices.capacity() * sizeof(float);
+        }
+        // Orphan the previous storage, so that the driver does not wait for the last frame
+        glBufferData(GL_ARRAY_BUFFER, buffer_size, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size, vertices.data());
+
+        shader.use();
+        render_state.BindTexture(atlas);
+        render_state.DrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(vertices.size() / kFloatsPerVertex));
+
+        vertices.clear();
+    }
+
+    SpriteBatch(const SpriteBatch& other) = delete;
+    SpriteBatch(SpriteBatch&& other) = delete;
+    SpriteBatch& operator=(const SpriteBatch& other) = delete;
+    SpriteBatch& operator=(SpriteBatch&& other) = delete;
+
+};
+
+#endif // NIKMAN_SPRITE_BATCH_H
@@ -0,0 +1,146 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_THREAD_POOL_H
+#define NIKMAN_THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <string>
+
+#include "profiler.h"
+
+// Fixed set of worker threads running parallel loops. ParallelFor doesn't allocate:
+// the loop body is passed to the workers by pointer, and it blocks until all the
+// iterations are done, calling thread included.
+struct ThreadPool {
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    unsigned long long generation = 0;
+    bool stop = false;
+    int busy = 0;
+
+    void (*task)(void* context, int begin, int end) = nullptr;
+    void* context = nullptr;
+    int count = 0;
+    int grain = 1;
+    std::atomic<int> next{ 0 };
+
+    ThreadPool(int n_workers = std::max(0, static_cast<int>(std::thread::hardware_concurrency()) - 1)) {
+        for (int i = 0; i < n_workers; ++i) {
+            workers.emplace_back([this, i]() {
+                profiler.SetThreadName("Worker " + std::to_string(i + 1));
+                WorkerLoop();
+            });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        start_cv.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Calls body(i) for each i in [0, n), in chunks of grain iterations.
+    // Loops no longer than a chunk run on the calling thread only
+    template <typename Body>
+    void ParallelFor(int n, Body&& body, int grain_ = 1) {
+        if (workers.empty() || n <= grain_) {
+            for (int i = 0; i < n; ++i) {
+                body(i);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = [](void* context, int begin, int end) {
+                auto& body = *static_cast<std::remove_reference_t<Body>*>(context);
+                for (int i = begin; i < end; ++i) {
+                    body(i);
+                }
+            };
+            context = const_cast<void*>(static_cast<const void*>(&body));
+            count = n;
+            grain = grain_;
+            next = 0;
+            busy = static_cast<int>(workers.size());
+            ++generation;
+        }
+        start_cv.notify_all();
+
+        Run();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [this]() { return busy == 0; });
+    }
+
+    void Run() {
+        PROFILE_SCOPE("ThreadPool::Run");
+        int begin;
+        while ((begin = next.fetch_add(grain)) < count) {
+            task(context, begin, std::min(begin + grain, count));
+        }
+    }
+
+    void WorkerLoop() {
+        unsigned long long seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                start_cv.wait(lock, [&]() { return stop || generation != seen; });
+                if (stop) {
+                    return;
+                }
+                seen = generation;
+            }
+            Run();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--busy == 0) {
+                    done_cv.notify_one();
+                }
+            }
+        }
+    }
+
+    ThreadPool(const ThreadPool& other) = delete;
+    ThreadPool(ThreadPool&& other) = delete;
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+    ThreadPool& operator=(ThreadPool&& other) = delete;
+
+};
+
+#endif // NIKMAN_THREAD_POOL_H
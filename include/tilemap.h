@@ -0,0 +1,165 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined NIKMAN_TILEMAP_H
+#define NIKMAN_TILEMAP_H
+
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "shader.h"
+#include "entity.h"
+#include "level.h"
+#include "render_prep.h"
+#include "profiler.h"
+
+// Draws the whole static part of the maze (floor, mud, home, walls, teleports,
+// crusts and weapons on the ground) in a single pass. The grid is uploaded once
+// per level as an integer texture holding Slot::data, and only the cells that
+// change during play are uploaded again.
+struct TileMap {
+
+    // Walls overhang the map border by this much (see Wall)
+    static constexpr float margin = 7.f / 72.f;
+
+    unsigned int VBO;
+    unsigned int VAO;
+    unsigned int slot_texture;
+    unsigned int angle_texture;
+    Shader shader;
+    int h;
+    int w;
+
+    const std::vector<Slot>& grid;
+
+    TileMap(const std::vector<Slot>& grid_) :
+        shader("tilemap"),
+        grid(grid_)
+    {
+
+        MakeRect(1.f, 1.f, VAO, VBO);
+
+        glGenTextures(1, &slot_texture);
+        render_state.BindTexture(slot_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glGenTextures(1, &angle_texture);
+        render_state.BindTexture(angle_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        shader.use();
+        shader.SetMat4("projection", kProjection);
+        shader.SetInt("atlasTexture", 0);
+        shader.SetInt("slotTexture", 1);
+        shader.SetInt("angleTexture", 2);
+
+        // South-West and North-East corners in the texture atlas, as in the single entities
+        auto set_rect = [&](const char* name, const SpriteRect& sprite) {
+            shader.SetVec4(name, glm::vec4(sprite.x0, sprite.y0, sprite.x1, sprite.y1));
+        };
+        set_rect("floorRect", kSpriteFloor);
+        set_rect("mudRect", kSpriteMud);
+        set_rect("homeRect", kSpriteHome);
+        set_rect("wallRect", kSpriteWall);
+        set_rect("teleportRect", kSpriteTeleport);
+        set_rect("crustRect", kSpriteCrust);
+        set_rect("weaponRect", kSpriteWeapon);
+
+    }
+
+    ~TileMap() {
+        glDeleteBuffers(1, &VBO);
+        render_state.DeleteVertexArray(VAO);
+        render_state.DeleteTexture(slot_texture);
+        render_state.DeleteTexture(angle_texture);
+    }
+
+    void Render() const {
+
+        PROFILE_SCOPE("TileMap::Render");
+        shader.use();
+
+        render_state.BindTexture(atlas, 0);
+        render_state.BindTexture(slot_texture, 1);
+        render_state.BindTexture(angle_texture, 2);
+
+        render_state.BindVertexArray(VAO);
+        render_state.DrawArrays(GL_TRIANGLES, 0, 6);
+
+    }
+
+    // Uploads again a single cell, after a crust or a weapon has been removed
+    void Refresh(int x, int y) const {
+
+        render_state.BindTexture(slot_texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_SHORT, &grid[y * w + x].data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    }
+
+    // Uploads the whole grid, when more than a few cells have changed. The grid is
+    // already a plane of uint16_t, so it goes as it is
+    void Upload() const {
+
+        render_state.BindTexture(slot_texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, w, h, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, grid.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    }
+
+    // Must be called after Simulation::LoadLevel, since it uploads the grid
+    void LoadLevel(const LevelDesc& level) {
+
+        h = level.h;
+        w = level.w;
+
+        Upload();
+
+        // The angles depend only on the cells, not on what is in them
+        std::vector<float> angles;
+        BuildCrustAngles(h * w, angles);
+        render_state.BindTexture(angle_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, w, h, 0, GL_RED, GL_FLOAT, angles.data());
+
+        shader.use();
+        glm::mat4 world(1.f);
+        world = glm::scale(world, glm::vec3(w + 2.f * margin, h + 2.f * margin, 1.f));
+        shader.SetMat4("world", world);
+        shader.SetFloat("h", (float)h);
+        shader.SetFloat("w", (float)w);
+        shader.SetFloat("margin", margin);
+
+    }
+
+    TileMap(const TileMap& other) = delete;
+    TileMap(TileMap&& other) = delete;
+    TileMap& operator=(const TileMap& other) = delete;
+    TileMap& operator=(TileMap&& other) = delete;
+
+};
+
+#endif // NIKMAN_TILEMAP_H
@@ -32,6 +32,12 @@
 
 #include "utility.h"
 #include "shader.h"
+#include "profiler.h"
+#include "frame_arena.h"
+#include "sprites.h"
+#include "asset_loader.h"
+
+static constexpr char* const kFontFilename = "centaur_regular_32.xml";
 
 
 struct Glyph {
@@ -55,9 +61,13 @@ struct Font {
     int size;
     int h_space;
     Glyph glyphs[95];
-    unsigned int texture;
-    int texture_width;
-    int texture_height;
+
+    // Where the glyph sheet is in the texture atlas: texture coordinates of its top-left
+    // corner, and of a pixel step (negative in y, the glyphs are measured from the top)
+    float sheet_x = 0.f;
+    float sheet_y = 0.f;
+    float sheet_dx = 0.f;
+    float sheet_dy = 0.f;
 
     Font() {}
 
@@ -66,13 +76,12 @@ struct Font {
     Font& operator=(const Font& other) = delete;
     
     Font& operator=(Font&& other) {
-        glDeleteTextures(1, &texture);        
-        texture = other.texture;
-
         family = std::move(other.family);
         size = other.size;
-        texture_width = other.texture_width;
-        texture_height = other.texture_height;
+        sheet_x = other.sheet_x;
+        sheet_y = other.sheet_y;
+        sheet_dx = other.sheet_dx;
+        sheet_dy = other.sheet_dy;
         h_space = other.h_space;
         for (int i = 0; i < 95; ++i) {
             glyphs[i] = std::move(other.glyphs[i]);
@@ -81,19 +90,23 @@ struct Font {
         return *this;
     }
 
-    ~Font() {
-        glDeleteTextures(1, &texture);
-    };
+    void SetSheet(const SpriteRect& sprite) {
+        sheet_x = sprite.x0;
+        sheet_y = sprite.y1;
+        sheet_dx = (sprite.x1 - sprite.x0) / sprite.w;
+        sheet_dy = -(sprite.y1 - sprite.y0) / sprite.h;
+    }
 
 };
 
 
-bool ReadFont(const char* filename, Font& font) {
+// Reads the glyphs of a font description, but not where they are in the texture atlas
+bool ReadFontDesc(const char* filename, Font& font) {
 
     font = Font();
 
     // Very dirty and specific xml parser
-    std::ifstream is(filename);
+    AssetStream is(filename);
     if (!is.is_open()) {
         std::cerr << "Error in ReadFont: can't open font description.\n";
         return false;
@@ -157,19 +170,47 @@ bool ReadFont(const char* filename, Font& font) {
 
     }
 
-    // Texture
-    stbi_set_flip_vertically_on_load(false);
-    font.texture = MakeFontTexture("centaur_regular_32.png", font.texture_width, font.texture_height, false, true);
-    stbi_set_flip_vertically_on_load(true);
     return true;
 
 #undef READ_UNTIL
 }
 
+// Font description read on an AssetLoader by PreloadFont, taken by ReadFont
+struct PreloadedFont {
+    std::string filename;
+    Font font;
+    bool valid = false;
+};
+static PreloadedFont preloaded_font;
 
-std::vector<float> GetStringVertices(const char* str, const Font& font) {
+void PreloadFont(AssetLoader& loader, const std::string& filename) {
+    preloaded_font.filename = filename;
+    loader.Add([]() {
+        preloaded_font.valid = ReadFontDesc(preloaded_font.filename.c_str(), preloaded_font.font);
+    });
+}
+
+bool ReadFont(const char* filename, Font& font) {
+
+    PROFILE_SCOPE("ReadFont");
+    if (preloaded_font.valid && preloaded_font.filename == filename && !asset_loader.Busy()) {
+        font = std::move(preloaded_font.font);
+        preloaded_font.valid = false;
+    }
+    else if (!ReadFontDesc(filename, font)) {
+        return false;
+    }
+
+    font.SetSheet(kSpriteFont);
+    return true;
+}
+
+
+// Two textured triangles for each character, in any vector of floats
+template <typename Vector>
+void GetStringVertices(const char* str, const Font& font, Vector& vertices) {
     int len = strlen(str);
-    std::vector<float> vertices(strlen(str) * 24);
+    vertices.resize(len * 24);
     float current_x = 0;
     float current_y = 0;
     for (int i = 0; i < len; ++i) {
@@ -212,12 +253,15 @@ std::vector<float> GetStringVertices(const char* str, const Font& font) {
 
     }
 
-    for (int i = 0; i < len * 24; ) {
-        i += 2;
-        vertices[i++] /= font.texture_width;
-        vertices[i++] /= font.texture_height;
+    for (int i = 0; i < len * 24; i += 4) {
+        vertices[i + 2] = font.sheet_x + vertices[i + 2] * font.sheet_dx;
+        vertices[i + 3] = font.sheet_y + vertices[i + 3] * font.sheet_dy;
     }
+}
 
+std::vector<float> GetStringVertices(const char* str, const Font& font) {
+    std::vector<float> vertices;
+    GetStringVertices(str, font, vertices);
     return vertices;
 }
 
@@ -287,17 +331,16 @@ struct Writing {
 
         }
 
-        for (int i = 0; i < len * 24; ) {
-            i += 2;
-            vertices[i++] /= font.texture_width;
-            vertices[i++] /= font.texture_height;
+        for (int i = 0; i < len * 24; i += 4) {
+            vertices[i + 2] = font.sheet_x + vertices[i + 2] * font.sheet_dx;
+            vertices[i + 3] = font.sheet_y + vertices[i + 3] * font.sheet_dy;
         }
 
         // 1. bind Vertex Array Object
         unsigned int VAO_;
         unsigned int VBO_;
         glGenVertexArrays(1, &VAO_);
-        glBindVertexArray(VAO_);
+        render_state.BindVertexArray(VAO_);
 
         // 2. copy our vertices array in a buffer for OpenGL to use
         glGenBuffers(1, &VBO_);
@@ -325,7 +368,7 @@ struct Writing {
 
     ~Writing() {
         glDeleteBuffers(1, &VBO);
-        glDeleteVertexArrays(1, &VAO);
+        render_state.DeleteVertexArray(VAO);
     }
 
     void Update(const char* str) {
@@ -335,8 +378,10 @@ struct Writing {
             return;
         }
 
+        // Writings change during the game, which shouldn't touch the heap
         int len = strlen(str);
-        std::vector<float> vertices = GetStringVertices(str, font);        
+        FrameVector<float> vertices;
+        GetStringVertices(str, font, vertices);
 
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
         glBufferSubData(GL_ARRAY_BUFFER, 0, len * 24 * sizeof(float), vertices.data());
@@ -358,9 +403,9 @@ struct Writing {
             shader.SetVec3("color", normal_color);
         }
 
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_TRIANGLES, 0, n_vertices);
+        render_state.BindTexture(texture);
+        render_state.BindVertexArray(VAO);
+        render_state.DrawArrays(GL_TRIANGLES, 0, n_vertices);
     }
 
     // Temporarily deleted for safety
@@ -406,7 +451,7 @@ struct RectBackground {
 
         // 1. bind Vertex Array Object
         glGenVertexArrays(1, &VAO);
-        glBindVertexArray(VAO);
+        render_state.BindVertexArray(VAO);
 
         // 2. copy our vertices array in a buffer for OpenGL to use
         glGenBuffers(1, &VBO);
@@ -425,13 +470,13 @@ struct RectBackground {
         world = glm::translate(world, glm::vec3(panel_x, panel_y, 0.f));
         shader.SetMat4("world", world);
 
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+        render_state.BindVertexArray(VAO);
+        render_state.DrawArrays(GL_TRIANGLES, 0, 6);
     }
 
     ~RectBackground() {
         glDeleteBuffers(1, &VBO);
-        glDeleteVertexArrays(1, &VAO);
+        render_state.DeleteVertexArray(VAO);
     }
 
     // Temporarily deleted for safety
@@ -488,7 +533,7 @@ struct UI {
     std::map<std::string, std::pair<Panel, bool>> panel_map;
 
     UI() : shader("glyph"), shader_background("background") {
-        if (!ReadFont((std::filesystem::path(kFontRoot) / std::filesystem::path("centaur_regular_32.xml")).string().c_str(), font)) {
+        if (!ReadFont(FontPath(kFontFilename).c_str(), font)) {
             std::cerr << "UI::UI: can't read font!\n";
         }
 
@@ -521,9 +566,10 @@ struct UI {
         game_ui.AddWriting("Score: 0   ", 650, 0, font, true, false);
         AddPanel("game_ui", std::move(game_ui), false);
 
-        Panel pause(850, 600, 220, font.h_space*2);
+        Panel pause(850, 600, 240, font.h_space*3);
         pause.AddWriting("Resume", 0, 0, font, false, true);
-        pause.AddWriting("Back to menu", 0, -font.h_space, font, false);
+        pause.AddWriting("Restart level", 0, -font.h_space, font, false);
+        pause.AddWriting("Back to menu", 0, -font.h_space*2, font, false);
         AddPanel("pause", std::move(pause), false);
 
         Panel transition(890, 600, 140, font.h_space);
@@ -533,9 +579,10 @@ struct UI {
     }
 
     void Render() const {
+        PROFILE_SCOPE("UI::Render");
         for (const auto& x : panel_map) {
             if (x.second.second) {
-                x.second.first.Render(shader, shader_background, font.texture);
+                x.second.first.Render(shader, shader_background, atlas);
             }
         }
     }
@@ -24,22 +24,27 @@
 #define NIKMAN_UTILITY_H
 
 #include <vector>
+#include <cstdint>
 #include <fstream>
 #include <filesystem>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-static bool isSte = false;
+#include "common.h"
+#include "render_state.h"
+#include "profiler.h"
+#include "asset_loader.h"
+#include "sprites.h"
+
 static unsigned int atlas;
 
 static constexpr char* const kShaderRoot = "../shaders";
 static constexpr char* const kTextureRoot = "../resources/textures";
-static constexpr char* const kLevelRoot = "../resources/levels";
 static constexpr char* const kSoundsRoot = "../resources/sounds";
 static constexpr char* const kFontRoot = "../resources/fonts";
 static constexpr char* const kScoresPath = "highscores.txt";
-static constexpr char* const kLevelsList = "list.txt";
+static constexpr char* const kShaderCacheRoot = "shader_cache";
 
 static constexpr float kRatio = 16.f / 9.f;
 static constexpr float kWorldHeight = 15.f;  // It shall be higher in production
@@ -48,6 +53,11 @@ static constexpr int kWindowWidth = 1920;
 static constexpr int kWindowHeight = kWindowWidth / kRatio;
 static constexpr float kVerticalShift = 0.3f;  // kWorldHeight / 20.f;
 
+struct Point {
+    float x;
+    float y;
+};
+
 static const glm::mat4 kProjection = glm::ortho(
     -kWorldWidth / 2.f,
     kWorldWidth / 2.f, 
@@ -57,10 +67,12 @@ static const glm::mat4 kProjection = glm::ortho(
     10.f);
 
 unsigned int MakeTextureGeneral(const char* filename, int& width, int& height, bool nearest = false, bool alpha = false) {
+    PROFILE_SCOPE("MakeTexture");
+
     // Texture 
     unsigned int texture;
     glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    render_state.BindTexture(texture);
 
     // set the texture wrapping/filtering options (on the currently bound texture object)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -70,10 +82,14 @@ unsigned int MakeTextureGeneral(const char* filename, int& width, int& height, b
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, interp);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, interp);
 
-    // load and generate the texture
-    int nrChannels;
-
-    unsigned char* data = stbi_load(filename, &width, &height, &nrChannels, 0);
+    // load and generate the texture, unless the asset_loader has decoded it already
+    DecodedImage image = asset_loader.TakeImage(filename);
+    if (image.pixels == nullptr) {
+        image = DecodeImage(filename);
+    }
+    width = image.width;
+    height = image.height;
+    const unsigned char* data = image.pixels;
     if (data)
     {
         //GLenum format = alpha ? GL_RGBA : GL_RGB;
@@ -85,69 +101,34 @@ unsigned int MakeTextureGeneral(const char* filename, int& width, int& height, b
     {
         std::cerr << "Failed to load texture" << std::endl;
     }
-    stbi_image_free(data);
     return texture;
 }
 
-unsigned int MakeTexture(const char* filename, int& width, int& height, bool nearest = false, bool alpha = false) {
-
-    std::filesystem::path texture_path = std::filesystem::path(kTextureRoot) / std::filesystem::path(filename);
-    std::string texture_path_string = texture_path.string();
-    const char* texture_path_cstring = texture_path_string.c_str();
-
-    return MakeTextureGeneral(texture_path_cstring, width, height, nearest, alpha);
-}
-
-unsigned int MakeFontTexture(const char* filename, int& width, int& height, bool nearest = false, bool alpha = false) {
-
-    std::filesystem::path texture_path = std::filesystem::path(kFontRoot) / std::filesystem::path(filename);
-    std::string texture_path_string = texture_path.string();
-    const char* texture_path_cstring = texture_path_string.c_str();
-
-    return MakeTextureGeneral(texture_path_cstring, width, height, nearest, alpha);
-}
-
 std::string SoundPath(const char* name) {
-    return (std::filesystem::path(kSoundsRoot) / std::filesystem::path(name)).string();
+    return JoinPath(kSoundsRoot, name);
 }
 
 std::string TexturePath(const char* name) {
-    return (std::filesystem::path(kTextureRoot) / std::filesystem::path(name)).string();
+    return JoinPath(kTextureRoot, name);
 }
 
 std::string FontPath(const char* name) {
-    return (std::filesystem::path(kFontRoot) / std::filesystem::path(name)).string();
+    return JoinPath(kFontRoot, name);
 }
 
-unsigned char DirTo2Bit(unsigned char dir) {
-    if (dir == 1) return 0;
-    else if (dir == 2) return 1;
-    else if (dir == 4) return 2;
-    else return 3;
+unsigned int MakeTexture(const char* filename, int& width, int& height, bool nearest = false, bool alpha = false) {
+    return MakeTextureGeneral(TexturePath(filename).c_str(), width, height, nearest, alpha);
 }
 
-std::vector<std::string> LoadLevelsList() {
-
-    std::vector<std::string> res;
-
-    std::ifstream is(std::filesystem::path(kLevelRoot) / std::filesystem::path(kLevelsList));
-    if (!is.is_open()) {
-        std::cerr << "LoadLevelList: can't open levels list.\n";
-        return res;
+// The image packed by NikmanAtlas: from the asset pack or the installed textures if
+// they have it, otherwise from the build directory, where NikmanAtlas writes it
+std::string AtlasPath() {
+    std::string path = TexturePath(kAtlasFilename);
+    std::error_code ec;
+    if (asset_pack.Find(path).data == nullptr && !std::filesystem::exists(path, ec)) {
+        path = kAtlasPath;
     }
-
-    while (true) {
-        std::string s;
-        std::getline(is, s);
-        if (s.size() > 0) {
-            res.push_back(std::move(s));
-        }
-        else {
-            break;
-        }
-    }
-
-    return res;
+    return path;
 }
 
 #endif // NIKMAN_UTILITY_H
\ No newline at end of file
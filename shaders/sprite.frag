@@ -2,12 +2,14 @@
 out vec4 FragColor;
 
 in vec2 texCoord;
-uniform sampler2D ghostTexture;
+in float alpha;
+uniform sampler2D atlasTexture;
 
 void main()
 {
-    FragColor = texture(ghostTexture, texCoord);
+    FragColor = texture(atlasTexture, texCoord);
+    FragColor.a *= alpha;
     if (FragColor.a < 0.01)
         discard;
     FragColor.rgb = pow(FragColor.rgb, vec3(1.0/2.2));
-} 
\ No newline at end of file
+}
@@ -0,0 +1,17 @@
+#version 330 core
+layout (location = 0) in vec2 aPos;
+layout (location = 1) in vec2 aTex;
+layout (location = 2) in float aShiftX;
+layout (location = 3) in float aAlpha;
+
+out vec2 texCoord;
+out float alpha;
+
+uniform mat4 projection;
+
+void main()
+{
+    gl_Position = projection * vec4(aPos.x, aPos.y, -5.0, 1.0);
+    texCoord = vec2(aTex.x + aShiftX, aTex.y);
+    alpha = aAlpha;
+}
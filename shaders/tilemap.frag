@@ -0,0 +1,147 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 gridPos;
+
+uniform sampler2D atlasTexture;
+uniform usampler2D slotTexture;
+uniform sampler2D angleTexture;
+
+uniform float h;
+uniform float w;
+
+// South-West and North-East corners in the atlas
+uniform vec4 floorRect;
+uniform vec4 mudRect;
+uniform vec4 homeRect;
+uniform vec4 wallRect;
+uniform vec4 teleportRect;
+uniform vec4 crustRect;
+uniform vec4 weaponRect;
+
+// Sprite sizes, in cells
+const vec2 wallSize = vec2(14.0 / 72.0, 86.0 / 72.0);
+const vec2 teleportSize = vec2(55.0 / 72.0, 55.0 / 72.0);
+const vec2 crustSize = vec2(16.0 / 72.0, 32.0 / 72.0);
+const vec2 weaponSize = vec2(30.0 / 72.0, 44.0 / 72.0);
+
+// Slot::data bits
+const uint kW = 1u;
+const uint kA = 2u;
+const uint kS = 4u;
+const uint kD = 8u;
+const uint kCrust = 16u;
+const uint kWeapon = 32u;
+const uint kHome = 64u;
+const uint kTeleport = 128u;
+const uint kMud = 4096u;
+
+uint Cell(int x, int y)
+{
+    if (x < 0 || y < 0 || x >= int(w) || y >= int(h))
+        return 0u;
+    return texelFetch(slotTexture, ivec2(x, y), 0).r;
+}
+
+// Vertical wall on the left side of column x, in row y
+bool VerWall(int x, int y)
+{
+    return ((Cell(x, y) & kA) | (Cell(x - 1, y) & kD)) != 0u;
+}
+
+// Horizontal wall below row y, in column x
+bool HorWall(int x, int y)
+{
+    return ((Cell(x, y) & kS) | (Cell(x, y - 1) & kW)) != 0u;
+}
+
+vec4 Atlas(vec4 rect, vec2 uv)
+{
+    vec4 c = texture(atlasTexture, mix(rect.xy, rect.zw, uv));
+    return vec4(pow(c.rgb, vec3(1.0/2.2)), c.a);
+}
+
+bool Inside(vec2 uv)
+{
+    return all(greaterThanEqual(uv, vec2(0.0))) && all(lessThanEqual(uv, vec2(1.0)));
+}
+
+// Blends a sprite over the current color, like the single draws did
+vec4 Over(vec4 dst, vec4 src, float threshold)
+{
+    if (src.a < threshold)
+        return dst;
+    float a = src.a + dst.a * (1.0 - src.a);
+    return vec4((src.rgb * src.a + dst.rgb * dst.a * (1.0 - src.a)) / a, a);
+}
+
+void main()
+{
+    ivec2 cell = ivec2(floor(gridPos));
+    vec2 local = gridPos - vec2(cell);
+    bool inMap = gridPos.x >= 0.0 && gridPos.y >= 0.0 && gridPos.x < w && gridPos.y < h;
+    uint data = inMap ? Cell(cell.x, cell.y) : 0u;
+
+    vec4 color = vec4(0.0);
+
+    // Floor, mud and home
+    if (inMap) {
+        color = Atlas(floorRect, local);
+        if ((data & kMud) != 0u)
+            color = Over(color, Atlas(mudRect, local), 0.5);
+        if ((data & kHome) != 0u)
+            color = Over(color, Atlas(homeRect, local), 0.5);
+    }
+
+    // Walls: a wall sprite overhangs its cell edge on both ends, so the neighbouring rows (columns) are checked too
+    float overhang = (wallSize.y - 1.0) / 2.0;
+    int line_x = int(floor(gridPos.x + 0.5));
+    float dx = gridPos.x - float(line_x);
+    if (abs(dx) < wallSize.x / 2.0) {
+        int row = -1000;
+        if (VerWall(line_x, cell.y)) row = cell.y;
+        else if (local.y < overhang && VerWall(line_x, cell.y - 1)) row = cell.y - 1;
+        else if (local.y > 1.0 - overhang && VerWall(line_x, cell.y + 1)) row = cell.y + 1;
+        if (row != -1000) {
+            vec2 uv = vec2(dx / wallSize.x + 0.5, (gridPos.y - float(row) + overhang) / wallSize.y);
+            color = Over(color, Atlas(wallRect, uv), 0.001);
+        }
+    }
+    int line_y = int(floor(gridPos.y + 0.5));
+    float dy = gridPos.y - float(line_y);
+    if (abs(dy) < wallSize.x / 2.0) {
+        int col = -1000;
+        if (HorWall(cell.x, line_y)) col = cell.x;
+        else if (local.x < overhang && HorWall(cell.x - 1, line_y)) col = cell.x - 1;
+        else if (local.x > 1.0 - overhang && HorWall(cell.x + 1, line_y)) col = cell.x + 1;
+        if (col != -1000) {
+            // Rotated by 90 degrees, as in Wall::Render
+            vec2 uv = vec2(dy / wallSize.x + 0.5, (float(col) + 1.0 + overhang - gridPos.x) / wallSize.y);
+            color = Over(color, Atlas(wallRect, uv), 0.001);
+        }
+    }
+
+    // Teleports, crusts and weapons
+    vec2 centered = local - vec2(0.5);
+    if ((data & kTeleport) != 0u) {
+        vec2 uv = centered / teleportSize + vec2(0.5);
+        if (Inside(uv))
+            color = Over(color, Atlas(teleportRect, uv), 0.01);
+    }
+    if ((data & kCrust) != 0u) {
+        float angle = texelFetch(angleTexture, cell, 0).r;
+        mat2 inverse = mat2(cos(angle), -sin(angle), sin(angle), cos(angle));
+        vec2 uv = (inverse * centered) / crustSize + vec2(0.5);
+        if (Inside(uv))
+            color = Over(color, Atlas(crustRect, uv), 0.01);
+    }
+    if ((data & kWeapon) != 0u) {
+        vec2 uv = centered / weaponSize + vec2(0.5);
+        if (Inside(uv))
+            color = Over(color, Atlas(weaponRect, uv), 0.01);
+    }
+
+    if (color.a < 0.01)
+        discard;
+    FragColor = color;
+}
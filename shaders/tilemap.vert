@@ -0,0 +1,17 @@
+#version 330 core
+layout (location = 0) in vec2 aPos;
+layout (location = 1) in vec2 aTex;
+
+out vec2 gridPos;
+
+uniform mat4 projection;
+uniform mat4 world;
+uniform float h;
+uniform float w;
+uniform float margin;
+
+void main()
+{
+    gl_Position = projection * world * vec4(aPos.x, aPos.y, -8.0, 1.0);
+    gridPos = aTex * vec2(w + 2.0 * margin, h + 2.0 * margin) - vec2(margin, margin);
+}
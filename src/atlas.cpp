@@ -0,0 +1,366 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Build step that packs the sprites listed in resources/textures/sprites.txt, the
+// glyph sheet of the font included, into a single texture, so that every draw of the
+// game can keep the same texture bound. It writes the packed image, as a RLE TGA
+// which stb_image reads, and a header with a SpriteRect for each sprite, in the
+// texture coordinates of the packed image. The build runs it when the list or one
+// of the images changes, so the image and the header are never committed: both go in
+// the build directory, and the header has the path of the image for the game.
+//
+// Every sprite is surrounded by kPadding pixels repeating its border, so that linear
+// filtering never reaches its neighbours in the packed image.
+//
+// NikmanAtlas <sprite list> <output image> <output header>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <filesystem>
+#include <cstdio>
+#include <cstdint>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#undef STB_IMAGE_IMPLEMENTATION
+
+static constexpr int kPadding = 2;
+
+// Widths tried for the packed image, the one with the smallest area wins
+static constexpr int kAtlasWidths[] = { 512, 1024, 2048, 4096 };
+
+struct Image {
+    int width = 0;
+    int height = 0;
+    std::vector<uint32_t> pixels;   // RGBA, rows from the bottom
+
+    uint32_t At(int x, int y) const {
+        return pixels[static_cast<size_t>(y) * width + x];
+    }
+};
+
+struct Sprite {
+    std::string name;
+    std::string file;
+    int x = 0;
+    int y = 0;
+    int w = 0;
+    int h = 0;
+    int frames = 1;
+    int step = 0;
+
+    // Position of the first frame in the packed image
+    int packed_x = 0;
+    int packed_y = 0;
+
+    // Size of the sprite in the packed image, frames and padding included
+    int PackedWidth() const {
+        return (frames - 1) * step + w + 2 * kPadding;
+    }
+    int PackedHeight() const {
+        return h + 2 * kPadding;
+    }
+};
+
+bool ReadSpriteList(const std::filesystem::path& filename, std::vector<Sprite>& sprites) {
+    std::ifstream is(filename);
+    if (!is.is_open()) {
+        std::cerr << "Error in ReadSpriteList: can't open " << filename << ".\n";
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(is, line)) {
+        ++line_number;
+        line = line.substr(0, line.find('#'));
+        std::istringstream ls(line);
+        Sprite sprite;
+        if (!(ls >> sprite.name)) {
+            continue;
+        }
+        if (!(ls >> sprite.file)) {
+            std::cerr << "Error in ReadSpriteList: no file at line " << line_number << ".\n";
+            return false;
+        }
+        if (ls >> sprite.x) {
+            if (!(ls >> sprite.y >> sprite.w >> sprite.h) || sprite.w <= 0 || sprite.h <= 0) {
+                std::cerr << "Error in ReadSpriteList: bad rectangle at line " << line_number << ".\n";
+                return false;
+            }
+            if (ls >> sprite.frames) {
+                if (!(ls >> sprite.step) || sprite.frames < 1 || sprite.step < sprite.w) {
+                    std::cerr << "Error in ReadSpriteList: bad frames at line " << line_number << ".\n";
+                    return false;
+                }
+            }
+            else {
+                sprite.frames = 1;
+            }
+        }
+        else {
+            sprite.w = 0;   // the whole image, once it is loaded
+        }
+        sprites.push_back(std::move(sprite));
+    }
+
+    return true;
+}
+
+bool LoadImage(const std::filesystem::path& filename, Image& image) {
+    int channels;
+    unsigned char* data = stbi_load(filename.string().c_str(), &image.width, &image.height, &channels, 4);
+    if (data == nullptr) {
+        std::cerr << "Error in LoadImage: can't open " << filename << ".\n";
+        return false;
+    }
+    image.pixels.resize(static_cast<size_t>(image.width) * image.height);
+    std::copy_n(data, image.pixels.size() * 4, reinterpret_cast<unsigned char*>(image.pixels.data()));
+    stbi_image_free(data);
+    return true;
+}
+
+// Shelves from the top of the list, sorted by height: returns the height needed for
+// the given width, or 0 if a sprite doesn't fit in it
+int Pack(std::vector<Sprite*>& order, int width) {
+    int x = 0;
+    int y = 0;
+    int shelf_height = 0;
+    for (Sprite* sprite : order) {
+        if (sprite->PackedWidth() > width) {
+            return 0;
+        }
+        if (x + sprite->PackedWidth() > width) {
+            x = 0;
+            y += shelf_height;
+            shelf_height = 0;
+        }
+        sprite->packed_x = x + kPadding;
+        sprite->packed_y = y + kPadding;
+        x += sprite->PackedWidth();
+        shelf_height = std::max(shelf_height, sprite->PackedHeight());
+    }
+    return y + shelf_height;
+}
+
+// Copies the frames of a sprite, with their gaps, and repeats its border in the padding
+void Blit(const Sprite& sprite, const Image& src, Image& dst) {
+    const int w = sprite.PackedWidth() - 2 * kPadding;
+    for (int y = -kPadding; y < sprite.h + kPadding; ++y) {
+        const int sy = sprite.y + std::clamp(y, 0, sprite.h - 1);
+        for (int x = -kPadding; x < w + kPadding; ++x) {
+            const int sx = sprite.x + std::clamp(x, 0, w - 1);
+            dst.pixels[static_cast<size_t>(sprite.packed_y + y) * dst.width + sprite.packed_x + x] = src.At(sx, sy);
+        }
+    }
+}
+
+void PutPixel(std::ofstream& os, uint32_t rgba) {
+    const char bgra[4] = {
+        static_cast<char>((rgba >> 16) & 0xFF),
+        static_cast<char>((rgba >> 8) & 0xFF),
+        static_cast<char>(rgba & 0xFF),
+        static_cast<char>((rgba >> 24) & 0xFF),
+    };
+    os.write(bgra, 4);
+}
+
+// Run-length encoded, 32 bits per pixel, with the first row at the bottom as in Image
+bool WriteTga(const char* filename, const Image& image) {
+    std::ofstream os(filename, std::ios::binary);
+    if (!os.is_open()) {
+        std::cerr << "Error in WriteTga: can't open " << filename << ".\n";
+        return false;
+    }
+
+    const unsigned char header[18] = {
+        0, 0, 10, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        static_cast<unsigned char>(image.width & 0xFF), static_cast<unsigned char>(image.width >> 8),
+        static_cast<unsigned char>(image.height & 0xFF), static_cast<unsigned char>(image.height >> 8),
+        32, 8
+    };
+    os.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    // Packets don't cross rows
+    for (int y = 0; y < image.height; ++y) {
+        const uint32_t* row = &image.pixels[static_cast<size_t>(y) * image.width];
+        int x = 0;
+        while (x < image.width) {
+            int run = 1;
+            while (x + run < image.width && run < 128 && row[x + run] == row[x]) {
+                ++run;
+            }
+            if (run > 1) {
+                os.put(static_cast<char>(0x80 | (run - 1)));
+                PutPixel(os, row[x]);
+                x += run;
+                continue;
+            }
+            int raw = 1;
+            while (x + raw < image.width && raw < 128 && (x + raw + 1 >= image.width || row[x + raw] != row[x + raw + 1])) {
+                ++raw;
+            }
+            os.put(static_cast<char>(raw - 1));
+            for (int i = 0; i < raw; ++i) {
+                PutPixel(os, row[x + i]);
+            }
+            x += raw;
+        }
+    }
+
+    return static_cast<bool>(os);
+}
+
+// ghost_red -> GhostRed
+std::string CamelCase(const std::string& name) {
+    std::string result;
+    bool upper = true;
+    for (char c : name) {
+        if (c == '_') {
+            upper = true;
+        }
+        else {
+            result += upper ? static_cast<char>(toupper(c)) : c;
+            upper = false;
+        }
+    }
+    return result;
+}
+
+bool WriteHeader(const char* filename, const std::string& image_name, const std::string& image_path, const Image& atlas, const std::vector<Sprite>& sprites) {
+    std::ofstream os(filename);
+    if (!os.is_open()) {
+        std::cerr << "Error in WriteHeader: can't open " << filename << ".\n";
+        return false;
+    }
+
+    const std::string W = std::to_string(atlas.width) + ".f";
+    const std::string H = std::to_string(atlas.height) + ".f";
+
+    os << "// Generated by NikmanAtlas from resources/textures/sprites.txt: do not edit\n\n";
+    os << "#if !defined NIKMAN_SPRITES_H\n";
+    os << "#define NIKMAN_SPRITES_H\n\n";
+    os << "// A sprite in the packed atlas: South-West and North-East corners of its first frame,\n";
+    os << "// in texture coordinates, the distance between two frames, and the size in pixels\n";
+    os << "struct SpriteRect {\n";
+    os << "    float x0, y0, x1, y1;\n";
+    os << "    float step;\n";
+    os << "    int w, h;\n";
+    os << "};\n\n";
+    os << "static constexpr char* const kAtlasFilename = \"" << image_name << "\";\n";
+    os << "static constexpr char* const kAtlasPath = \"" << image_path << "\";   // as written by the build\n";
+    os << "static constexpr int kAtlasWidth = " << atlas.width << ";\n";
+    os << "static constexpr int kAtlasHeight = " << atlas.height << ";\n\n";
+    for (const Sprite& s : sprites) {
+        os << "static constexpr SpriteRect kSprite" << CamelCase(s.name) << " = { "
+            << s.packed_x << ".f / " << W << ", "
+            << s.packed_y << ".f / " << H << ", "
+            << s.packed_x + s.w << ".f / " << W << ", "
+            << s.packed_y + s.h << ".f / " << H << ", "
+            << s.step << ".f / " << W << ", "
+            << s.w << ", " << s.h << " };\n";
+    }
+    os << "\n#endif // NIKMAN_SPRITES_H\n";
+
+    return static_cast<bool>(os);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 4) {
+        std::cerr << "Usage: NikmanAtlas <sprite list> <output image> <output header>\n";
+        return 1;
+    }
+
+    const std::filesystem::path list_filename = argv[1];
+    std::vector<Sprite> sprites;
+    if (!ReadSpriteList(list_filename, sprites)) {
+        return 1;
+    }
+
+    // Rows from the bottom, like the textures of the game
+    stbi_set_flip_vertically_on_load(true);
+
+    std::map<std::string, Image> images;
+    for (Sprite& sprite : sprites) {
+        auto it = images.find(sprite.file);
+        if (it == images.end()) {
+            it = images.emplace(sprite.file, Image()).first;
+            if (!LoadImage(list_filename.parent_path() / sprite.file, it->second)) {
+                return 1;
+            }
+        }
+        const Image& image = it->second;
+        if (sprite.w == 0) {
+            sprite.w = image.width;
+            sprite.h = image.height;
+        }
+        if (sprite.x < 0 || sprite.y < 0 || sprite.x + (sprite.frames - 1) * sprite.step + sprite.w > image.width || sprite.y + sprite.h > image.height) {
+            std::cerr << "NikmanAtlas: sprite " << sprite.name << " is outside of " << sprite.file << "\n";
+            return 1;
+        }
+    }
+
+    // Tallest first, then by name so that the output doesn't depend on the list order
+    std::vector<Sprite*> order;
+    for (Sprite& sprite : sprites) {
+        order.push_back(&sprite);
+    }
+    std::sort(order.begin(), order.end(), [](const Sprite* a, const Sprite* b) {
+        return a->PackedHeight() != b->PackedHeight() ? a->PackedHeight() > b->PackedHeight() : a->name < b->name;
+    });
+
+    Image atlas;
+    long long best_area = 0;
+    for (int width : kAtlasWidths) {
+        const int height = Pack(order, width);
+        if (height > 0 && (best_area == 0 || static_cast<long long>(width) * height < best_area)) {
+            best_area = static_cast<long long>(width) * height;
+            atlas.width = width;
+            atlas.height = height;
+        }
+    }
+    if (best_area == 0) {
+        std::cerr << "NikmanAtlas: the sprites don't fit in " << kAtlasWidths[std::size(kAtlasWidths) - 1] << " pixels\n";
+        return 1;
+    }
+    Pack(order, atlas.width);
+
+    atlas.pixels.assign(static_cast<size_t>(atlas.width) * atlas.height, 0);
+    for (const Sprite& sprite : sprites) {
+        Blit(sprite, images[sprite.file], atlas);
+    }
+
+    const std::string image_name = std::filesystem::path(argv[2]).filename().string();
+    const std::string image_path = std::filesystem::absolute(argv[2]).generic_string();
+    if (!WriteTga(argv[2], atlas) || !WriteHeader(argv[3], image_name, image_path, atlas, sprites)) {
+        return 1;
+    }
+
+    std::cout << "NikmanAtlas: " << sprites.size() << " sprites in " << atlas.width << "x" << atlas.height << "\n";
+    return 0;
+}
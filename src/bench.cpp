@@ -0,0 +1,368 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Micro-benchmarks of the hot paths that don't need a GL context: level parsing and
+// generation, ghost decisions and the CPU side of rendering. Every benchmark runs in
+// batches for at least --min-time seconds, and the fastest batch is reported, in
+// nanoseconds per operation, as JSON. Like NikmanSim, it runs from the directory of
+// the game or from the one given with --dir.
+//
+// The output of a run can be kept as a baseline: with --baseline, each result is
+// compared to it, and the exit code is 1 if any is slower by more than --tolerance.
+//
+// NikmanBench [--dir path] [--filter substring] [--min-time seconds] [--output file]
+//             [--baseline file [--tolerance fraction]]
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <filesystem>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#undef STB_IMAGE_IMPLEMENTATION
+
+#include "common.h"
+#include "level.h"
+#include "simulation.h"
+#include "render_prep.h"
+#include "ui.h"
+
+// Samples taken of each benchmark, once the batch size is found
+static constexpr int kSamples = 5;
+
+struct BenchResult {
+    std::string name;
+    double ns_per_op;
+};
+
+// Whatever the operations return ends up here, so that they can't be optimized away
+static volatile size_t sink;
+
+// op is called in batches, doubled until one takes min_seconds / kSamples
+template <typename Op>
+BenchResult Measure(const std::string& name, double min_seconds, Op&& op)
+{
+    using Clock = std::chrono::steady_clock;
+    auto RunBatch = [&](uint64_t batch) {
+        size_t result = 0;
+        const Clock::time_point start = Clock::now();
+        for (uint64_t i = 0; i < batch; ++i) {
+            result += op();
+        }
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        sink = sink + result;
+        return seconds;
+    };
+
+    uint64_t batch = 1;
+    double seconds = RunBatch(batch);
+    while (seconds < min_seconds / kSamples && batch < (1ull << 40)) {
+        batch *= 2;
+        seconds = RunBatch(batch);
+    }
+
+    double best = seconds / batch;
+    for (int i = 1; i < kSamples; ++i) {
+        best = std::min(best, RunBatch(batch) / batch);
+    }
+    return { name, best * 1e9 };
+}
+
+// Reads the results written by WriteResults, by name
+std::map<std::string, double> ReadBaseline(const char* filename)
+{
+    std::map<std::string, double> baseline;
+    std::ifstream is(filename);
+    if (!is.is_open()) {
+        std::cerr << "Error in ReadBaseline: can't open filename.\n";
+        return baseline;
+    }
+    std::string line;
+    while (std::getline(is, line)) {
+        const size_t name_pos = line.find("\"name\": \"");
+        const size_t ns_pos = line.find("\"ns_per_op\": ");
+        if (name_pos == std::string::npos || ns_pos == std::string::npos) {
+            continue;
+        }
+        const size_t name_start = name_pos + strlen("\"name\": \"");
+        const std::string name = line.substr(name_start, line.find('"', name_start) - name_start);
+        baseline[name] = std::stod(line.substr(ns_pos + strlen("\"ns_per_op\": ")));
+    }
+    return baseline;
+}
+
+// One result per line, in the order they were run, so that baselines diff well
+void WriteResults(std::ostream& os, const std::vector<BenchResult>& results)
+{
+    os << "{\n";
+    os << "  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        char ns[32];
+        snprintf(ns, sizeof(ns), "%.1f", results[i].ns_per_op);
+        os << "    { \"name\": \"" << results[i].name << "\", \"ns_per_op\": " << ns << " }";
+        os << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    os << "  ]\n";
+    os << "}\n";
+}
+
+int main(int argc, char* argv[])
+{
+    const char* filter = "";
+    double min_seconds = 0.2;
+    const char* output_filename = nullptr;
+    const char* baseline_filename = nullptr;
+    double tolerance = 0.25;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--dir") == 0) {
+            std::filesystem::current_path(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--filter") == 0) {
+            filter = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--min-time") == 0) {
+            min_seconds = std::stod(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--output") == 0) {
+            output_filename = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--baseline") == 0) {
+            baseline_filename = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--tolerance") == 0) {
+            tolerance = std::stod(argv[i + 1]);
+        }
+        else {
+            std::cerr << "NikmanBench: unknown option \"" << argv[i] << "\"\n";
+            return 1;
+        }
+    }
+
+#if !defined NDEBUG
+    std::cerr << "NikmanBench: not an optimized build, results are not comparable with a Release baseline\n";
+#endif
+
+    std::vector<BenchResult> results;
+    auto Run = [&](const std::string& name, auto&& op) {
+        if (name.find(filter) == std::string::npos) {
+            return;
+        }
+        results.push_back(Measure(name, min_seconds, op));
+        std::cerr << name << ": " << results.back().ns_per_op << " ns\n";
+    };
+
+    // Shipped levels, and generated ones written in the same format
+    std::vector<std::pair<std::string, std::string>> level_files;    // Name and path
+    for (const auto& filename : LoadLevelsList()) {
+        if (std::filesystem::path(filename).extension() != kCompiledLevelExtension) {
+            level_files.emplace_back(filename, (std::filesystem::path(kLevelRoot) / std::filesystem::path(filename)).string());
+        }
+    }
+    if (level_files.empty()) {
+        std::cerr << "NikmanBench: no levels found in \"" << kLevelRoot << "\"\n";
+        return 1;
+    }
+
+    std::mt19937 mt(1);
+    LevelDesc maze = GenerateLevel(256, 256, mt);
+    for (int size : { 64, 256, 1024 }) {
+        LevelDesc level = size == 256 ? maze : GenerateLevel(size, size, mt);
+        const std::string name = "maze" + std::to_string(size);
+        if (!LevelConnected(level) || level.home.size() < 2) {
+            std::cerr << "NikmanBench: " << name << " is not a playable maze\n";
+            return 1;
+        }
+        const std::string path = (std::filesystem::temp_directory_path() / std::filesystem::path("nikman_bench_" + name + ".txt")).string();
+        if (!WriteLevelDesc(level, path.c_str()) || ReadLevelDesc(path.c_str()).cells != level.cells) {
+            std::cerr << "NikmanBench: can't write \"" << path << "\"\n";
+            return 1;
+        }
+        level_files.emplace_back(name, path);
+    }
+
+    for (const auto& file : level_files) {
+        Run("ReadLevelDesc/" + file.first, [&]() { return ReadLevelDesc(file.second.c_str()).cells.size(); });
+    }
+
+    for (int size : { 32, 128, 512 }) {
+        Run("GenerateLevel/" + std::to_string(size), [&]() { return GenerateLevel(size, size, mt).cells.size(); });
+    }
+
+    // Program binaries, as the ShaderRegistry caches them: what is written must be read
+    // back, or every start would compile again, and a truncated file must be refused
+    {
+        const std::string path = (std::filesystem::temp_directory_path() / std::filesystem::path("nikman_bench_program.bin")).string();
+        std::vector<char> binary(64 << 10);
+        for (size_t i = 0; i < binary.size(); ++i) {
+            binary[i] = static_cast<char>(i * 31);
+        }
+        GLenum format = 0;
+        std::vector<char> read;
+        if (!ShaderRegistry::WriteCacheFile(path, 0x8E21, binary) || !ShaderRegistry::ReadCacheFile(path, format, read) || format != 0x8E21 || read != binary) {
+            std::cerr << "NikmanBench: the shader cache doesn't read back what it writes\n";
+            return 1;
+        }
+        std::filesystem::resize_file(path, binary.size() / 2);
+        if (ShaderRegistry::ReadCacheFile(path, format, read)) {
+            std::cerr << "NikmanBench: the shader cache accepts a truncated file\n";
+            return 1;
+        }
+        ShaderRegistry::WriteCacheFile(path, 0x8E21, binary);
+        Run("ShaderCache/Read", [&]() { return ShaderRegistry::ReadCacheFile(path, format, read) ? read.size() : 0; });
+    }
+
+    // Ghost decisions: a chasing ghost of each color at every junction of the first
+    // level, with the players where a few ticks have brought them
+    {
+        Simulation sim(MakeRoster(kDefaultRoster));
+        sim.NewGame(false, 1);
+        sim.LoadLevel(ReadLevelDesc(level_files.front().second.c_str()), 0);
+        for (int i = 0; i < 60; ++i) {
+            sim.Tick(1.f / 60.f, 8);
+        }
+
+        std::vector<std::pair<int, int>> junctions;
+        for (int y = 0; y < sim.h; ++y) {
+            for (int x = 0; x < sim.w; ++x) {
+                if (std::bitset<4>(~sim.grid[y * sim.w + x].Walls() & 15).count() >= 3) {
+                    junctions.emplace_back(x, y);
+                }
+            }
+        }
+
+        const PlayerState& nik = sim.players[0];
+        const char* const color_names[] = { "Red", "Yellow", "Blue", "Purple", "Gray", "Brown", "Green" };
+        for (int color = 0; color <= static_cast<int>(GhostColor::Green); ++color) {
+            GhostState ghost = sim.ghosts[0];
+            ghost.color = static_cast<GhostColor>(color);
+            ghost.mode = GhostMode::Chase;
+            Run(std::string("SetNewDir/") + color_names[color], [&]() {
+                size_t directions = 0;
+                for (const auto& junction : junctions) {
+                    ghost.x = junction.first;
+                    ghost.y = junction.second;
+                    ghost.direction = 1;
+                    sim.SetNewDir(ghost, nik.precise_x, nik.precise_y, nik.direction, sim.ghosts[0].precise_x, sim.ghosts[0].precise_y);
+                    directions += ghost.direction;
+                }
+                return directions;
+            });
+        }
+    }
+
+    // Render preparation, on the first level and on the large maze
+    LevelDesc first = ReadLevelDesc(level_files.front().second.c_str());
+    ExpandCells(first);
+    auto RunRenderPrep = [&](const std::string& name, const LevelDesc& level) {
+
+        Simulation sim(MakeRoster(kDefaultRoster));
+        sim.NewGame(false, 1);
+        sim.LoadLevel(level, 0);
+
+        std::vector<glm::mat4> worlds;
+        Run("BuildWallMatrices/" + name, [&]() {
+            BuildWallMatrices(level.ver_walls, level.hor_walls, static_cast<float>(level.h), static_cast<float>(level.w), 1.f, worlds);
+            return worlds.size();
+        });
+        Run("BuildCrustMatrices/" + name, [&]() {
+            BuildCrustMatrices(sim.grid, sim.h, sim.w, 1.f, worlds);
+            return worlds.size();
+        });
+
+        std::vector<float> angles;
+        Run("BuildCrustAngles/" + name, [&]() {
+            BuildCrustAngles(sim.h * sim.w, angles);
+            return angles.size();
+        });
+        Run("CountSlots/" + name, [&]() {
+            return CountSlots(sim.grid, Slot::kCrust);
+        });
+    };
+    RunRenderPrep(level_files.front().first, first);
+    RunRenderPrep("maze256", maze);
+
+    // Text, with the glyphs of the game font
+    {
+        Font font;
+        if (!ReadFontDesc(FontPath("centaur_regular_32.xml").c_str(), font)) {
+            std::cerr << "NikmanBench: can't read the font\n";
+            return 1;
+        }
+        font.SetSheet(kSpriteFont);
+
+        std::string all_glyphs;
+        for (int i = 0; i < 4; ++i) {
+            for (char c = ' '; c <= '~'; ++c) {
+                all_glyphs += c;
+            }
+        }
+        Run("GetStringVertices/score", [&]() { return GetStringVertices("Score: 1234", font).size(); });
+        Run("GetStringVertices/glyphs", [&]() { return GetStringVertices(all_glyphs.c_str(), font).size(); });
+    }
+
+    if (output_filename != nullptr) {
+        std::ofstream os(output_filename);
+        if (!os.is_open()) {
+            std::cerr << "NikmanBench: can't open \"" << output_filename << "\"\n";
+            return 1;
+        }
+        WriteResults(os, results);
+    }
+    else {
+        WriteResults(std::cout, results);
+    }
+
+    if (baseline_filename != nullptr) {
+        const std::map<std::string, double> baseline = ReadBaseline(baseline_filename);
+        int slower = 0;
+        for (const auto& result : results) {
+            const auto it = baseline.find(result.name);
+            if (it == baseline.end()) {
+                fprintf(stderr, "%-36s %12.1f ns   (new)\n", result.name.c_str(), result.ns_per_op);
+                continue;
+            }
+            const double ratio = result.ns_per_op / it->second;
+            const bool regression = ratio > 1. + tolerance;
+            slower += regression;
+            fprintf(stderr, "%-36s %12.1f ns   %5.2fx%s\n", result.name.c_str(), result.ns_per_op, ratio, regression ? "   SLOWER" : "");
+        }
+        if (slower > 0) {
+            fprintf(stderr, "%d benchmarks slower than the baseline by more than %.0f%%\n", slower, tolerance * 100);
+            return 1;
+        }
+    }
+
+    return 0;
+}
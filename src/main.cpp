@@ -23,8 +23,14 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <cstring>
 #include <sstream>
 #include <filesystem>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <cstdio>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -44,6 +50,11 @@
 #include "level.h"
 #include "game.h"
 #include "ui.h"
+#include "counter_rng.h"
+#include "profiler.h"
+#include "allocation_tracker.h"
+#include "frame_arena.h"
+#include "asset_loader.h"
 
 // TODO this worked once, and then no more
 // #pragma comment(linker, "/SUBSYSTEM:windows /ENTRY:mainCRTStartup") 
@@ -88,13 +99,277 @@ void processInput(GLFWwindow* window, unsigned int& wasd)
         wasd |= 256;
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         wasd |= 512;
+    if (glfwGetKey(window, GLFW_KEY_F5) == GLFW_PRESS)
+        wasd |= 1024;
+    if (glfwGetKey(window, GLFW_KEY_F9) == GLFW_PRESS)
+        wasd |= 2048;
+    if (glfwGetKey(window, GLFW_KEY_BACKSPACE) == GLFW_PRESS)
+        wasd |= 4096;
+    if (glfwGetKey(window, GLFW_KEY_F10) == GLFW_PRESS)
+        wasd |= 8192;
+    if (glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS)
+        wasd |= 16384;
+    if (glfwGetKey(window, GLFW_KEY_F11) == GLFW_PRESS)
+        wasd |= 32768;
 
 }
 
 
-int main()
+// F12 writes the profiler zones here, unless another file was given with --profile
+static constexpr char* const kProfileFilename = "nikman_trace.json";
+
+// Every frame of the timedemo simulates this much, however long it takes
+static constexpr float kTimedemoFrameDuration = 1.f / 60.f;
+static constexpr uint64_t kTimedemoSeed = 1;
+
+// Plays scene with a bot for the given number of frames, as fast as possible, and
+// writes the frame times as JSON to output (stdout if null). The scene is a level in
+// kLevelRoot, or mazeN for a GenerateLevel maze of N x N cells. The GPU is waited for
+// at the end of every Render, so that its time is not hidden in the next frame. The
+// GPU time of each render pass is averaged over the frames that drew it. With
+// NIKMAN_TRACK_ALLOCATIONS the heap allocations of the frames are counted too
+int RunTimedemo(GLFWwindow* window, Game& game, const char* scene, int frames, const char* output)
+{
+    LevelDesc level;
+    int size;
+    if (sscanf(scene, "maze%d", &size) == 1 && size > 0) {
+        std::mt19937 mt(static_cast<unsigned int>(kTimedemoSeed));
+        level = GenerateLevel(size, size, mt);
+    }
+    else {
+        level = LoadLevelDesc(scene, !game.tilemap_mode);
+    }
+    if (level.cells.empty()) {
+        std::cerr << "Error in RunTimedemo: can't load scene \"" << scene << "\".\n";
+        return 1;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    auto Milliseconds = [](Clock::time_point a, Clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+
+    std::vector<double> frame_ms(frames);
+    double update_ms = 0;
+    double render_ms = 0;
+    double swap_ms = 0;
+    unsigned long long draw_calls = 0;
+    int restarts = 0;
+    AllocationCounts allocations;
+    uint64_t max_frame_allocations = 0;
+
+    game.StartTimedemo(level, kTimedemoSeed);
+    game.gpu_timing = true;
+    game.gpu_timer.Reset();
+    CounterRng bot(kTimedemoSeed, UINT64_MAX);
+    unsigned int wasd = 0;
+    bool stop_game = false;
+
+    for (int frame = 0; frame < frames; ++frame) {
+
+        // Random walk, as in NikmanSim
+        if (frame % 10 == 0) {
+            const uint64_t r = bot();
+            wasd = (1u << (r & 3)) | ((1u << ((r >> 2) & 3)) << 4);
+        }
+
+        PROFILE_SCOPE("Frame");
+        const Clock::time_point start = Clock::now();
+        const AllocationCounts frame_start = Allocations();
+        render_state.BeginFrame();
+
+        game.Update(kTimedemoFrameDuration, wasd, stop_game);
+        if (game.state != GameState::Game) {
+            // Game over or level completed: the scene starts again
+            game.StartTimedemo(level, kTimedemoSeed);
+            restarts++;
+        }
+        const Clock::time_point updated = Clock::now();
+
+        glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        game.Render();
+        glFinish();
+        draw_calls += render_state.frame.draw_calls;
+        const Clock::time_point rendered = Clock::now();
+
+        glfwPollEvents();
+        glfwSwapBuffers(window);
+        frame_arena.Reset();
+        const Clock::time_point end = Clock::now();
+
+        const AllocationCounts frame_allocations = Allocations() - frame_start;
+        allocations.count += frame_allocations.count;
+        allocations.bytes += frame_allocations.bytes;
+        max_frame_allocations = std::max(max_frame_allocations, frame_allocations.count);
+
+        update_ms += Milliseconds(start, updated);
+        render_ms += Milliseconds(updated, rendered);
+        swap_ms += Milliseconds(rendered, end);
+        frame_ms[frame] = Milliseconds(start, end);
+    }
+
+    double mean_ms = 0;
+    for (double x : frame_ms) {
+        mean_ms += x;
+    }
+    mean_ms /= frames;
+    std::sort(frame_ms.begin(), frame_ms.end());
+    auto Percentile = [&](double p) {
+        return frame_ms[std::min(frames - 1, static_cast<int>(frames * p))];
+    };
+
+    std::ofstream os;
+    if (output != nullptr) {
+        os.open(output);
+        if (!os.is_open()) {
+            std::cerr << "Error in RunTimedemo: can't open output.\n";
+            return 1;
+        }
+    }
+    std::ostream& out = output != nullptr ? os : std::cout;
+
+    // Scene names and renderer strings don't need escaping
+    out << "{\n";
+    out << "  \"scene\": \"" << scene << "\",\n";
+    out << "  \"size\": [" << level.w << ", " << level.h << "],\n";
+    out << "  \"ghosts\": " << game.ghost_colors.size() << ",\n";
+    out << "  \"renderer\": \"" << reinterpret_cast<const char*>(glGetString(GL_RENDERER)) << "\",\n";
+    out << "  \"frames\": " << frames << ",\n";
+    out << "  \"restarts\": " << restarts << ",\n";
+    out << "  \"frame_ms\": { \"mean\": " << mean_ms << ", \"p50\": " << Percentile(0.5) << ", \"p99\": " << Percentile(0.99) << ", \"max\": " << frame_ms.back() << " },\n";
+    out << "  \"update_ms\": " << update_ms / frames << ",\n";
+    out << "  \"render_ms\": " << render_ms / frames << ",\n";
+    out << "  \"swap_ms\": " << swap_ms / frames << ",\n";
+    out << "  \"draw_calls\": " << static_cast<double>(draw_calls) / frames << ",\n";
+    out << "  \"shader_cache\": { \"hits\": " << shader_registry.cache_hits << ", \"misses\": " << shader_registry.cache_misses << " },\n";
+    out << "  \"gpu_ms\": {";
+    const char* separator = " ";
+    for (const auto& pass : game.gpu_timer.passes) {
+        if (pass.n_total > 0) {
+            out << separator << "\"" << pass.name << "\": " << pass.total / pass.n_total;
+            separator = ", ";
+        }
+    }
+    out << " }";
+    if (kTrackAllocations) {
+        out << ",\n  \"allocations\": { \"per_frame\": " << static_cast<double>(allocations.count) / frames
+            << ", \"bytes_per_frame\": " << static_cast<double>(allocations.bytes) / frames
+            << ", \"max\": " << max_frame_allocations << " }";
+    }
+    out << "\n";
+    out << "}\n";
+
+    return out.good() ? 0 : 1;
+}
+
+
+// Progress of the asset_loader until it is done, as a bar drawn with scissored clears,
+// since neither textures nor the UI are ready yet
+void ShowLoadingScreen(GLFWwindow* window) {
+
+    PROFILE_SCOPE("ShowLoadingScreen");
+    while (!asset_loader.Done()) {
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        const int bar_width = width / 3;
+        const int bar_height = std::max(4, height / 100);
+        const int x = (width - bar_width) / 2;
+        const int y = height / 4;
+
+        glClearColor(0.f, 0.f, 0.f, 1.f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(x - 2, y - 2, bar_width + 4, bar_height + 4);
+        glClearColor(0.3f, 0.3f, 0.3f, 1.f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glScissor(x, y, static_cast<int>(bar_width * asset_loader.Progress()), bar_height);
+        glClearColor(0.9f, 0.8f, 0.4f, 1.f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDisable(GL_SCISSOR_TEST);
+
+        glfwSwapBuffers(window);
+        glfwPollEvents();
+    }
+}
+
+// Nikman [--record file] [--replay file [--seek seconds]] [--ghosts n] [--roster colors]
+//        [--timedemo scene [--frames n] [--output file]] [--profile file] [--pack file]
+//
+// F10 turns the profiler on and off, F12 writes its zones as a Chrome trace. With
+// --profile it is on from the start, and the trace is also written at exit. F11
+// shows the GPU time of each render pass. Assets are read from the asset pack given
+// with --pack (the installed one, or else the one of the build, by default), and from
+// the single files if missing.
+// They are read and decoded on all the cores while the window is created
+int main(int argc, char* argv[])
 {
 
+    const char* record_filename = nullptr;
+    const char* replay_filename = nullptr;
+    float seek = 0.f;
+    int n_ghosts = 0;
+    const char* roster_colors = kDefaultRoster;
+    const char* timedemo_scene = nullptr;
+    int timedemo_frames = 1000;
+    const char* timedemo_output = nullptr;
+    const char* profile_filename = nullptr;
+    const char* pack_filename = nullptr;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--record") == 0) {
+            record_filename = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--replay") == 0) {
+            replay_filename = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--seek") == 0) {
+            seek = std::stof(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--ghosts") == 0) {
+            n_ghosts = std::stoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--roster") == 0) {
+            roster_colors = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--timedemo") == 0) {
+            timedemo_scene = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--frames") == 0) {
+            timedemo_frames = std::max(1, std::stoi(argv[i + 1]));
+        }
+        else if (strcmp(argv[i], "--output") == 0) {
+            timedemo_output = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--profile") == 0) {
+            profile_filename = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--pack") == 0) {
+            pack_filename = argv[i + 1];
+        }
+    }
+
+    const std::vector<Ghost::Color> roster = MakeRoster(roster_colors, n_ghosts);
+    if (roster.empty()) {
+        return -1;
+    }
+
+    profiler.SetThreadName("Main");
+    profiler.SetEnabled(profile_filename != nullptr);
+
+    // Textures have their rows from the bottom, the workers of the asset_loader included
+    stbi_set_flip_vertically_on_load(true);
+
+    if (pack_filename != nullptr) {
+        asset_pack.Open(pack_filename);
+    }
+    else {
+        OpenAssetPack();
+    }
+    asset_loader.AddImage(AtlasPath());
+    PreloadFont(asset_loader, FontPath(kFontFilename));
+    PreloadSounds(asset_loader);
+    asset_loader.Start();
+
     // Initialize glfw
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -102,9 +377,13 @@ int main()
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     //glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 
-    // Create window object
+    // Create window object, hidden and windowed for the timedemo, which may run on
+    // build machines with a software renderer
     glfwWindowHint(GLFW_SAMPLES, 4);    // MSAA
-    GLFWwindow* window = glfwCreateWindow(kWindowWidth, kWindowHeight, "Nikman", glfwGetPrimaryMonitor(), NULL);
+    if (timedemo_scene != nullptr) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    }
+    GLFWwindow* window = glfwCreateWindow(kWindowWidth, kWindowHeight, "Nikman", timedemo_scene != nullptr ? NULL : glfwGetPrimaryMonitor(), NULL);
     //GLFWwindow* window = glfwCreateWindow(kWindowWidth, kWindowHeight, "Nikman", NULL, NULL);
     if (window == NULL)
     {
@@ -113,6 +392,9 @@ int main()
         return -1;
     }
     glfwMakeContextCurrent(window);
+    if (timedemo_scene != nullptr) {
+        glfwSwapInterval(0);    // As fast as possible
+    }
 
     // Initialize GLAD function pointers
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
@@ -129,47 +411,112 @@ int main()
         }
     );
     
-    stbi_set_flip_vertically_on_load(true);
+    // Compile (or fetch from the binary cache) every program before they are needed
+    shader_registry.Init((GLADloadproc)glfwGetProcAddress);
+    shader_registry.PreloadAll();
+
+    // Only the GL uploads and the sound buffers are left to this thread
+    if (timedemo_scene == nullptr) {
+        ShowLoadingScreen(window);
+    }
+    asset_loader.Wait();
     
+    int result = 0;
     int height, width;
-    atlas = MakeTexture("atlas.png", width, height, true, true);   // it would be better to use RAII
+    atlas = MakeTextureGeneral(AtlasPath().c_str(), width, height, false, true);   // it would be better to use RAII
 
     {
-        Game game;
+        Game game(roster, record_filename != nullptr);
+        preloaded_sounds.clear();
+        if (replay_filename != nullptr) {
+            game.StartPlayback(replay_filename, seek);
+        }
         glEnable(GL_MULTISAMPLE);
-        glEnable(GL_BLEND);
+        render_state.SetBlend(true);
         //glEnable(GL_FRAMEBUFFER_SRGB);
 
         // Very simple render loop
         float formerFrame = glfwGetTime();
         bool stop_game = false;
+        unsigned int prev_wasd = 0;
+        if (timedemo_scene != nullptr) {
+            result = RunTimedemo(window, game, timedemo_scene, timedemo_frames, timedemo_output);
+            stop_game = true;
+        }
         while (!glfwWindowShouldClose(window) && !stop_game)
         {
+            PROFILE_SCOPE("Frame");
+            const AllocationCounts frame_start = Allocations();
             float currentFrame = glfwGetTime();
             float delta = currentFrame - formerFrame;
             formerFrame = currentFrame;
+            render_state.BeginFrame();
 
             // Input
             unsigned int wasd;
-            processInput(window, wasd);
+            {
+                PROFILE_SCOPE("Input");
+                processInput(window, wasd);
+            }
+            if ((wasd & 8192) && !(prev_wasd & 8192)) {
+                profiler.SetEnabled(!profiler.Enabled());
+                std::cout << "Profiler " << (profiler.Enabled() ? "on" : "off") << std::endl;
+            }
+            if ((wasd & 16384) && !(prev_wasd & 16384)) {
+                const char* filename = profile_filename != nullptr ? profile_filename : kProfileFilename;
+                if (profiler.WriteTrace(filename)) {
+                    std::cout << "Profile written to " << filename << std::endl;
+                }
+            }
+            if ((wasd & 32768) && !(prev_wasd & 32768)) {
+                game.ToggleGpuOverlay();
+            }
+            prev_wasd = wasd;
 
             // Update
-            game.Update(delta, wasd, stop_game);
+            {
+                PROFILE_SCOPE("Update");
+                game.Update(delta, wasd, stop_game);
+            }
 
             // Render
-            glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
-            glClear(GL_COLOR_BUFFER_BIT);
-            game.Render();
+            {
+                PROFILE_SCOPE("Render");
+                glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT);
+                game.Render();
+            }
 
             // check and call events and swap the buffers
-            glfwPollEvents();
-            glfwSwapBuffers(window);
+            {
+                PROFILE_SCOPE("Swap");
+                glfwPollEvents();
+                glfwSwapBuffers(window);
+            }
+
+            // Transient data of this frame is gone
+            frame_arena.Reset();
+            if (kTrackAllocations && profiler.Enabled()) {
+                const AllocationCounts frame_allocations = Allocations() - frame_start;
+                profiler.RecordCounter("Heap allocations", "frame", static_cast<double>(frame_allocations.count));
+                profiler.RecordCounter("Heap bytes", "frame", static_cast<double>(frame_allocations.bytes));
+            }
+        }
+
+        if (record_filename != nullptr) {
+            game.replay.Finish(game.sim);
+            game.replay.Write(record_filename);
+        }
+
+        if (profile_filename != nullptr && !profiler.WriteTrace(profile_filename)) {
+            result = 1;
         }
 
         // Clean/Delete all of GLFW's resources that were allocated
 
-        glDeleteTextures(1, &atlas);
+        render_state.DeleteTexture(atlas);
     }
+    shader_registry.Clear();
     glfwTerminate();
-    return 0;
+    return result;
 }
\ No newline at end of file
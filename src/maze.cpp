@@ -93,139 +93,15 @@ void processInput(GLFWwindow* window, unsigned int& wasd)
 }
 
 
-LevelDesc GenerateLevel(int h, int w, std::mt19937& mt) {
-
-    LevelDesc level;
-
-    level.h = h;
-    level.w = w;
-
-    std::vector<bool> hor_walls((h + 1) * w, true);
-    std::vector<bool> ver_walls(h * (w + 1), true);
-
-#define DOWN(x, y) (hor_walls[y*w+x])
-#define UP(x, y) (hor_walls[(y+1)*w+x])
-#define LEFT(x, y) (ver_walls[y*(w+1)+x])
-#define RIGHT(x, y) (ver_walls[y*(w+1)+x+1])
-
-    // Set borders
-    //for (int y = 0; y < h; ++y) {
-    //    LEFT(0, y) = true;
-    //    RIGHT(w - 1, y) = true;
-    //}
-
-    //for (int x = 0; x < w; ++x) {
-    //    DOWN(x, 0) = true;
-    //    UP(x, h - 1) = true;
-    //}
-
-    std::vector<int> visited(h * w, false);
-
-    std::uniform_int_distribution x_dis(0, w - 1);
-    std::uniform_int_distribution y_dis(0, h - 1);
-    std::uniform_int_distribution dir_dis(0, 3);
-
-    // Start from random cell
-    int x = x_dis(mt);
-    int y = y_dis(mt);
-
-    int prev_dir = -1;
-    int dir;
-
-    while (!visited[y * w + x]) {
-        visited[y * w + x] = true;
-
-        do {
-            dir = dir_dis(mt);
-        } while ((x == 0 && dir == 1) || (x == w - 1 && dir == 3) || (y == 0 && dir == 2) || (y == h - 1 && dir == 0) || (dir == prev_dir));
-
-        if (dir == 0) {
-            UP(x, y) = false;
-            ++y;
-            prev_dir = 2;
-        }
-        else if (dir == 2) {
-            DOWN(x, y) = false;
-            --y;
-            prev_dir = 0;
-        }
-        else if (dir == 1) {
-            LEFT(x, y) = false;
-            --x;
-            prev_dir = 3;
-        }
-        else {
-            RIGHT(x, y) = false;
-            ++x;
-            prev_dir = 1;
-        }
-    }
-
-    int r = 0;
-    while (r < 2) {
-
-        do {
-            x = x_dis(mt);
-            y = y_dis(mt);
-        } while (!visited[y * w + x]);
-
-        do {
-            visited[y * w + x] = true;
-
-            do {
-                dir = dir_dis(mt);
-            } while ((x == 0 && dir == 1) || (x == w - 1 && dir == 3) || (y == 0 && dir == 2) || (y == h - 1 && dir == 0) || (dir == prev_dir));
-
-            if (dir == 0) {
-                UP(x, y) = false;
-                ++y;
-                prev_dir = 2;
-            }
-            else if (dir == 2) {
-                DOWN(x, y) = false;
-                --y;
-                prev_dir = 0;
-            }
-            else if (dir == 1) {
-                LEFT(x, y) = false;
-                --x;
-                prev_dir = 3;
-            }
-            else {
-                RIGHT(x, y) = false;
-                ++x;
-                prev_dir = 1;
-            }
-        } while (!visited[y * w + x]);
-
-        ++r;
-    }
-
+int main(int argc, char* argv[])
+{
 
-    // Make level desc 
-    for (int y = 0; y < h; ++y) {
-        for (int x = 0; x < w + 1; ++x) {
-            if (ver_walls[y * (w + 1) + x]) {
-                level.ver_walls.emplace_back(x, y);
-            }
-        }
-    }
-    for (int y = 0; y < h + 1; ++y) {
-        for (int x = 0; x < w; ++x) {
-            if (hor_walls[y * w + x]) {
-                level.hor_walls.emplace_back(x, y);
-            }
-        }
+    // Level converter: Maze --compile <level.txt> <level.nkl>
+    if (argc == 4 && strcmp(argv[1], "--compile") == 0) {
+        LevelDesc level = ReadLevelDesc(argv[2]);
+        return WriteCompiledLevel(level, argv[3]) ? 0 : 1;
     }
 
-    return level;
-
-}
-
-
-int main()
-{
-
     //LevelDesc level = ReadLevelDesc((std::filesystem::path(kLevelRoot) / std::filesystem::path("level.txt")).string().c_str()); // TODO remove this
 
     // Initialize glfw
@@ -262,10 +138,13 @@ int main()
         }
     );
     
+    OpenAssetPack();
+    shader_registry.Init((GLADloadproc)glfwGetProcAddress);
+
     stbi_set_flip_vertically_on_load(true);
     
     int height, width;
-    atlas = MakeTexture("atlas.png", width, height, true, true);   // it would be better to use RAII
+    atlas = MakeTextureGeneral(AtlasPath().c_str(), width, height, false, true);   // it would be better to use RAII
 
     {
         std::random_device rd;
@@ -276,12 +155,12 @@ int main()
 
         LevelDesc level = GenerateLevel(14, 26, mt);
 
-        map.LoadLevel(level, mt);
+        map.LoadLevel(level);
         wall.LoadLevel(level);
 
-        Game game;
+        Game game(MakeRoster(kDefaultRoster));
         glEnable(GL_MULTISAMPLE);
-        glEnable(GL_BLEND);
+        render_state.SetBlend(true);
         glEnable(GL_FRAMEBUFFER_SRGB);
 
         // Very simple render loop
@@ -292,6 +171,7 @@ int main()
             float currentFrame = glfwGetTime();
             float delta = currentFrame - formerFrame;
             formerFrame = currentFrame;
+            render_state.BeginFrame();
 
             // Input
             unsigned int wasd;
@@ -314,8 +194,9 @@ int main()
 
         // Clean/Delete all of GLFW's resources that were allocated
 
-        glDeleteTextures(1, &atlas);
+        render_state.DeleteTexture(atlas);
     }
+    shader_registry.Clear();
     glfwTerminate();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,183 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Build step that writes the asset pack read by the game (see asset_pack.h): every
+// file given, or found in the directories given, relative to the root directory,
+// which is where the game finds the files. --root changes the root of the files that
+// follow, for those generated in the build directory with the same layout. PNG and
+// TGA images are decoded here, so that the game only has to upload them.
+//
+// NikmanPack <output> <root> <file or directory>... [--root <root> <file or directory>...]
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <cstring>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#undef STB_IMAGE_IMPLEMENTATION
+
+#include "asset_pack.h"
+
+struct Asset {
+    std::filesystem::path root;
+    std::string name;
+    AssetPackEntry entry = {};
+    std::vector<unsigned char> payload;
+};
+
+bool ReadAsset(Asset& asset) {
+
+    const std::filesystem::path path = asset.root / std::filesystem::path(asset.name);
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+
+    if (extension == ".png" || extension == ".tga") {
+        int width, height, channels;
+        unsigned char* data = stbi_load(path.string().c_str(), &width, &height, &channels, 4);
+        if (data == nullptr) {
+            std::cerr << "Error in ReadAsset: can't decode " << path << ".\n";
+            return false;
+        }
+        asset.payload.assign(data, data + static_cast<size_t>(width) * height * 4);
+        stbi_image_free(data);
+        asset.entry.format = AssetFormat::Rgba8;
+        asset.entry.width = width;
+        asset.entry.height = height;
+        return true;
+    }
+
+    std::ifstream is(path, std::ios::binary);
+    if (!is.is_open()) {
+        std::cerr << "Error in ReadAsset: can't open " << path << ".\n";
+        return false;
+    }
+    asset.payload.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    asset.entry.format = AssetFormat::Raw;
+    return true;
+}
+
+bool WritePack(const char* filename, std::vector<Asset>& assets) {
+
+    AssetPackHeader header;
+    memcpy(header.magic, kAssetPackMagic, sizeof(header.magic));
+    header.version = kAssetPackVersion;
+    header.n_entries = static_cast<uint32_t>(assets.size());
+
+    std::string names;
+    for (Asset& asset : assets) {
+        asset.entry.name_offset = static_cast<uint32_t>(names.size());
+        asset.entry.name_size = static_cast<uint32_t>(asset.name.size());
+        names += asset.name;
+    }
+    header.names_size = static_cast<uint32_t>(names.size());
+
+    auto align = [](uint64_t offset) {
+        return (offset + kAssetPackAlignment - 1) / kAssetPackAlignment * kAssetPackAlignment;
+    };
+    uint64_t offset = sizeof(header) + assets.size() * sizeof(AssetPackEntry) + names.size();
+    for (Asset& asset : assets) {
+        offset = align(offset);
+        asset.entry.offset = offset;
+        asset.entry.size = asset.payload.size();
+        offset += asset.payload.size();
+    }
+
+    std::ofstream os(filename, std::ios::binary);
+    if (!os.is_open()) {
+        std::cerr << "Error in WritePack: can't open " << filename << ".\n";
+        return false;
+    }
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const Asset& asset : assets) {
+        os.write(reinterpret_cast<const char*>(&asset.entry), sizeof(asset.entry));
+    }
+    os.write(names.data(), names.size());
+    for (const Asset& asset : assets) {
+        const std::vector<char> padding(asset.entry.offset - static_cast<uint64_t>(os.tellp()), 0);
+        os.write(padding.data(), padding.size());
+        os.write(reinterpret_cast<const char*>(asset.payload.data()), asset.payload.size());
+    }
+    return static_cast<bool>(os);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 4) {
+        std::cerr << "Usage: NikmanPack <output> <root> <file or directory>... [--root <root> <file or directory>...]\n";
+        return 1;
+    }
+
+    // Rows from the bottom, like the textures of the game
+    stbi_set_flip_vertically_on_load(true);
+
+    std::filesystem::path root = argv[2];
+    std::vector<Asset> assets;
+    for (int i = 3; i < argc; ++i) {
+        if (strcmp(argv[i], "--root") == 0 && i + 1 < argc) {
+            root = argv[++i];
+            continue;
+        }
+        const std::filesystem::path path = root / std::filesystem::path(argv[i]);
+        std::error_code ec;
+        if (std::filesystem::is_directory(path, ec)) {
+            for (const auto& entry : std::filesystem::recursive_directory_iterator(path, ec)) {
+                if (entry.is_regular_file()) {
+                    assets.emplace_back();
+                    assets.back().root = root;
+                    assets.back().name = entry.path().lexically_relative(root).generic_string();
+                }
+            }
+        }
+        else if (std::filesystem::is_regular_file(path, ec)) {
+            assets.emplace_back();
+            assets.back().root = root;
+            assets.back().name = path.lexically_relative(root).generic_string();
+        }
+        else {
+            std::cerr << "NikmanPack: can't find " << path << "\n";
+            return 1;
+        }
+    }
+
+    std::stable_sort(assets.begin(), assets.end(), [](const Asset& a, const Asset& b) { return a.name < b.name; });
+    assets.erase(std::unique(assets.begin(), assets.end(), [](const Asset& a, const Asset& b) { return a.name == b.name; }), assets.end());
+
+    size_t total = 0;
+    for (Asset& asset : assets) {
+        if (!ReadAsset(asset)) {
+            return 1;
+        }
+        total += asset.payload.size();
+    }
+
+    if (!WritePack(argv[1], assets)) {
+        return 1;
+    }
+
+    std::cout << "NikmanPack: " << assets.size() << " assets, " << total / 1024 << " KB\n";
+    return 0;
+}
@@ -0,0 +1,334 @@
+// MIT License
+// 
+// Copyright (c) 2021 Stefano Allegretti, Davide Papazzoni, Nicola Baldini, Lorenzo Governatori e Simone Gemelli
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Headless driver for the Simulation: plays the levels with random inputs as fast as
+// possible, for batch testing and benchmarking. Runs from the same directory as the
+// game, or from the one given with --dir, since levels are looked up in kLevelRoot.
+// With --record the run is saved as a replay; with --replay a replay is played back
+// instead, from the tick given with --seek, and checked against its recorded checksum.
+// With --restart the current level is restarted from its snapshot every n ticks. With
+// --rewind the last seconds are kept in a RewindBuffer, which at the end goes back as
+// far as it can, checked against the checksum the state had then. With --profile the
+// zones of the whole run are written to a Chrome trace at the end. Built with
+// NIKMAN_TRACK_ALLOCATIONS, it also counts the heap allocations of the ticks.
+//
+// NikmanSim [--ticks n] [--seed s] [--players 1|2] [--ghosts n] [--roster colors] [--threads n] [--dt seconds] [--dir path]
+//           [--record file] [--replay file [--seek tick]] [--restart n] [--rewind seconds] [--profile file]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <filesystem>
+
+#include "common.h"
+#include "level.h"
+#include "simulation.h"
+#include "counter_rng.h"
+#include "thread_pool.h"
+#include "replay.h"
+#include "rewind.h"
+#include "profiler.h"
+#include "allocation_tracker.h"
+
+// Seconds between keyframes of recorded replays
+static constexpr float kKeyframePeriod = 5.f;
+
+// Same as the game
+static constexpr uint32_t kRewindStride = 30;
+static constexpr size_t kRewindCapacity = 4 << 20;
+
+int PlayReplay(const char* filename, uint64_t seek, int threads)
+{
+    Replay replay;
+    if (!replay.Read(filename)) {
+        return 1;
+    }
+
+    ThreadPool pool(threads - 1);
+    Simulation sim(replay.roster, threads > 1 ? &pool : nullptr);
+
+    bool loaded = true;
+    auto load_level = [&](int index) {
+        LevelDesc level = LoadLevelDesc(replay.level_filenames[index], false);
+        loaded = loaded && !level.cells.empty();
+        if (loaded) {
+            sim.LoadLevel(level, index);
+        }
+    };
+    // Restarts, quick loads and rewinds of the recorded session
+    uint64_t restores = 0;
+    auto restored = [&]() {
+        restores++;
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+
+    ReplayCursor cursor;
+    if (!replay.Seek(cursor, seek, sim, load_level, restored) || !loaded) {
+        std::cerr << "NikmanSim: can't seek to tick " << seek << "\n";
+        return 1;
+    }
+    while (loaded && replay.Step(cursor, sim, load_level, restored)) {}
+    if (!loaded) {
+        return 1;
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "ticks: " << cursor.tick - seek << " (from " << seek << ")\n";
+    std::cout << "seconds: " << seconds << " (" << static_cast<long long>((cursor.tick - seek) / seconds) << " ticks/s)\n";
+    std::cout << "level: " << sim.level_index + 1 << ", lives: " << sim.lives << ", score: " << sim.score << "\n";
+    std::cout << "restores: " << restores << "\n";
+    printf("checksum: %016" PRIx64 "\n", sim.Checksum());
+
+    if (sim.Checksum() != replay.end_checksum) {
+        printf("replay: desync, %016" PRIx64 " was recorded\n", replay.end_checksum);
+        return 1;
+    }
+    std::cout << "replay: ok\n";
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    long long ticks = 100000;
+    uint64_t seed = 1;
+    int players = 1;
+    int n_ghosts = 4;
+    const char* roster_colors = kDefaultRoster;
+    int threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    float dt = 1.f / 60.f;
+    const char* record_filename = nullptr;
+    const char* replay_filename = nullptr;
+    long long restart = 0;
+    float rewind_seconds = 0.f;
+    const char* profile_filename = nullptr;
+    uint64_t seek = 0;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--ticks") == 0) {
+            ticks = std::stoll(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--seed") == 0) {
+            seed = std::stoull(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--players") == 0) {
+            players = std::stoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--ghosts") == 0) {
+            n_ghosts = std::stoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--roster") == 0) {
+            roster_colors = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--threads") == 0) {
+            threads = std::max(1, std::stoi(argv[i + 1]));
+        }
+        else if (strcmp(argv[i], "--dt") == 0) {
+            dt = std::stof(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--dir") == 0) {
+            std::filesystem::current_path(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--record") == 0) {
+            record_filename = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--replay") == 0) {
+            replay_filename = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--seek") == 0) {
+            seek = std::stoull(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--restart") == 0) {
+            restart = std::stoll(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--rewind") == 0) {
+            rewind_seconds = std::stof(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--profile") == 0) {
+            profile_filename = argv[i + 1];
+        }
+        else {
+            std::cerr << "NikmanSim: unknown option \"" << argv[i] << "\"\n";
+            return 1;
+        }
+    }
+
+    profiler.SetThreadName("Main");
+    profiler.SetEnabled(profile_filename != nullptr);
+    auto write_trace = [&]() {
+        return profile_filename == nullptr || profiler.WriteTrace(profile_filename);
+    };
+
+    if (replay_filename != nullptr) {
+        const int result = PlayReplay(replay_filename, seek, threads);
+        return write_trace() ? result : 1;
+    }
+
+    const std::vector<std::string> level_filenames = LoadLevelsList();
+    if (level_filenames.empty()) {
+        std::cerr << "NikmanSim: no levels found in \"" << kLevelRoot << "\"\n";
+        return 1;
+    }
+
+    const std::vector<GhostColor> roster = MakeRoster(roster_colors, n_ghosts);
+    if (roster.empty()) {
+        return 1;
+    }
+
+    ThreadPool pool(threads - 1);
+    Simulation sim(roster, threads > 1 ? &pool : nullptr);
+
+    Replay replay;
+    if (record_filename != nullptr) {
+        replay.Start(dt, std::max(1, static_cast<int>(kKeyframePeriod / dt)), level_filenames, roster);
+    }
+
+    CounterRng bot(seed, UINT64_MAX);
+    auto new_game = [&]() {
+        const uint64_t game_seed = bot();
+        sim.NewGame(players == 2, game_seed);
+        if (record_filename != nullptr) {
+            replay.RecordNewGame(players == 2, game_seed);
+        }
+    };
+    new_game();
+
+    RewindBuffer rewind(rewind_seconds, dt, kRewindStride, rewind_seconds > 0.f ? kRewindCapacity : 0);
+    std::vector<uint64_t> checksums;    // Of every tick since the last rewind.Reset
+
+    int current_level = 0;
+    auto load = [&]() {
+        LevelDesc level = LoadLevelDesc(level_filenames[current_level], false);
+        if (level.cells.empty()) {
+            return false;
+        }
+        sim.LoadLevel(level, current_level);
+        if (record_filename != nullptr) {
+            replay.RecordLoadLevel(current_level);
+        }
+        if (rewind_seconds > 0.f) {
+            rewind.Reset(sim);
+            checksums.clear();
+        }
+        return true;
+    };
+    if (!load()) {
+        return 1;
+    }
+
+    int levels_completed = 0;
+    int games_over = 0;
+    int restarts = 0;
+    unsigned int wasd = 0;
+    AllocationCounts tick_allocations;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (long long tick = 0; tick < ticks; ++tick) {
+
+        // Random walk: each player keeps a direction for a while
+        if (tick % 20 == 0) {
+            const uint64_t r = bot();
+            wasd = (1u << (r & 3)) | ((1u << ((r >> 2) & 3)) << 4);
+        }
+
+        if (restart > 0 && tick > 0 && tick % restart == 0) {
+            sim.RestartLevel();
+            if (record_filename != nullptr) {
+                replay.RecordRestore(sim.level_start);
+            }
+            restarts++;
+            if (rewind_seconds > 0.f) {
+                rewind.Reset(sim);
+                checksums.clear();
+            }
+        }
+
+        if (rewind_seconds > 0.f) {
+            checksums.push_back(sim.Checksum());
+            rewind.Record(wasd, sim);
+        }
+
+        if (record_filename != nullptr) {
+            replay.RecordTick(wasd, sim);
+        }
+        const AllocationCounts before = Allocations();
+        sim.Tick(dt, wasd);
+        const AllocationCounts allocated = Allocations() - before;
+        tick_allocations.count += allocated.count;
+        tick_allocations.bytes += allocated.bytes;
+
+        if (sim.state == Simulation::State::LevelCompleted) {
+            levels_completed++;
+            current_level = (current_level + 1) % level_filenames.size();
+            if (current_level == 0) {
+                new_game();
+            }
+            if (!load()) {
+                return 1;
+            }
+        }
+        else if (sim.state == Simulation::State::GameOver) {
+            games_over++;
+            current_level = 0;
+            new_game();
+            if (!load()) {
+                return 1;
+            }
+        }
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "ticks: " << ticks << "\n";
+    std::cout << "seconds: " << seconds << " (" << static_cast<long long>(ticks / seconds) << " ticks/s)\n";
+    std::cout << "levels completed: " << levels_completed << ", games over: " << games_over << ", restarts: " << restarts << "\n";
+    std::cout << "level: " << current_level + 1 << ", lives: " << sim.lives << ", score: " << sim.score << "\n";
+    printf("checksum: %016" PRIx64 "\n", sim.Checksum());
+    if (kTrackAllocations) {
+        std::cout << "allocations in ticks: " << tick_allocations.count << " (" << tick_allocations.bytes << " bytes)\n";
+    }
+
+    if (record_filename != nullptr) {
+        replay.Finish(sim);
+        if (!replay.Write(record_filename)) {
+            return 1;
+        }
+    }
+
+    if (rewind_seconds > 0.f) {
+        std::cout << "rewind: " << rewind.Seconds() << " seconds in " << rewind.BytesUsed() << " bytes\n";
+        const uint64_t rewound = rewind.Rewind(rewind.tick, sim);
+        if (rewound > 0 && sim.Checksum() != checksums[checksums.size() - rewound]) {
+            std::cout << "rewind: desync " << rewound << " ticks back\n";
+            return 1;
+        }
+        std::cout << "rewind: ok, " << rewound << " ticks back\n";
+    }
+
+    return write_trace() ? 0 : 1;
+}